@@ -0,0 +1,550 @@
+// fs_bench.c - Host benchmark and stress test for the file system
+//
+// Runs filesystem.c as a Linux process (see host.c) through workloads that
+// are impractical to type into the shell: tens of thousands of files with
+// random, sorted and long shared-prefix names, deep directory chains, and a
+// random mix of every operation over a changing tree. Each operation is
+// timed and reported per kind as throughput and latency percentiles. With
+// -c, fs_check() runs after every operation and the first inconsistency
+// ends the run; file contents are compared on every read either way. With
+// -d the file system sits on a journalled disk, and a last workload crashes
+// it and checks what replay brings back.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "filesystem.h"
+#include "bcache.h"
+#include "blockdev.h"
+#include "timer.h"
+
+#define DEEP_LEVELS 100         // "/d" per level stays inside MAX_PATH_LENGTH
+#define CHURN_MAX_DEPTH 4
+#define CHURN_MAX_SIZE 2048
+#define DISK_BLOCKS 65536       // Same 32 MiB as disk.img
+
+enum op {
+    OP_CREATE,
+    OP_LOOKUP,
+    OP_MISS,
+    OP_WRITE,
+    OP_READ,
+    OP_DELETE,
+    OP_MKDIR,
+    OP_CD,
+    OP_RMDIR,
+    OP_COUNT
+};
+
+static const char* op_names[OP_COUNT] = {
+    "create", "lookup", "miss", "write", "read", "delete", "mkdir", "cd", "rmdir"
+};
+
+struct samples {
+    uint64_t* ns;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t failures;
+};
+
+static struct samples samples[OP_COUNT];
+
+static uint32_t scale;
+static int check_every_op;
+static int on_disk;
+static int verbose;
+static uint64_t rng_state;
+static uint32_t seed;
+static uint32_t checks;
+static uint32_t total_failures;
+static uint64_t started;
+static const char* current_workload;
+
+static char data[CHURN_MAX_SIZE];
+static char buffer[CHURN_MAX_SIZE + 1];
+
+// xorshift64*
+static uint32_t next_random(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 2685821657736338717ull) >> 32);
+}
+
+static uint32_t random_below(uint32_t limit) {
+    return next_random() % limit;
+}
+
+static void shuffle(uint32_t* order, uint32_t count) {
+    for (uint32_t i = count; i > 1; i--) {
+        uint32_t j = random_below(i);
+        uint32_t swap = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = swap;
+    }
+}
+
+static uint32_t* identity(uint32_t count) {
+    uint32_t* order = malloc(count * sizeof(uint32_t));
+    if (!order) {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    return order;
+}
+
+static void verify(void) {
+    host_console = 1;
+    int result = fs_check();
+    host_console = verbose;
+    checks++;
+    if (result < 0) {
+        printf("%s: consistency check failed after %u checks (seed %u)\n", current_workload, checks, seed);
+        exit(1);
+    }
+}
+
+static void begin(void) {
+    started = timer_now_ns();
+}
+
+// Record the operation timed since begin(); ok is whether it did what the
+// workload expected
+static int finish(enum op op, int ok) {
+    uint64_t elapsed = timer_now_ns() - started;
+    struct samples* s = &samples[op];
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity ? s->capacity * 2 : 1024;
+        s->ns = realloc(s->ns, s->capacity * sizeof(uint64_t));
+        if (!s->ns) {
+            fprintf(stderr, "Out of memory\n");
+            exit(2);
+        }
+    }
+    s->ns[s->count++] = elapsed;
+    if (!ok) {
+        s->failures++;
+        total_failures++;
+        if (verbose) {
+            printf("%s: %s failed\n", current_workload, op_names[op]);
+        }
+    }
+    if (check_every_op) {
+        verify();
+    }
+    return ok;
+}
+
+static int compare_ns(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(struct samples* s, uint32_t percent) {
+    uint32_t index = (uint32_t)((uint64_t)(s->count - 1) * percent / 100);
+    return s->ns[index];
+}
+
+// Print and reset the samples of the workload that just ran
+static void report(void) {
+    for (int op = 0; op < OP_COUNT; op++) {
+        struct samples* s = &samples[op];
+        if (s->count == 0) {
+            continue;
+        }
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < s->count; i++) {
+            total += s->ns[i];
+        }
+        qsort(s->ns, s->count, sizeof(uint64_t), compare_ns);
+        double rate = total ? s->count * 1e9 / total : 0;
+        printf("%-10s %-7s %8u %11.0f %8llu %8llu %8llu %9llu %6u\n", current_workload, op_names[op],
+               s->count, rate, (unsigned long long)percentile(s, 50), (unsigned long long)percentile(s, 90),
+               (unsigned long long)percentile(s, 99), (unsigned long long)s->ns[s->count - 1], s->failures);
+        s->count = 0;
+        s->failures = 0;
+    }
+}
+
+// Start a workload on an empty file system
+static void start(const char* name) {
+    current_workload = name;
+    rng_state = ((uint64_t)seed << 32 | seed) ^ 0x9E3779B97F4A7C15ull;
+    host_set_disk(on_disk ? DISK_BLOCKS : 0);
+    host_console = verbose;
+    // The tables of the previous run are simply leaked
+    if (bcache_init() != 0 || fs_init() != 0) {
+        fprintf(stderr, "%s: file system did not start\n", name);
+        exit(2);
+    }
+    if (check_every_op) {
+        verify();
+    }
+}
+
+static void end(void) {
+    fs_sync();
+    if (check_every_op) {
+        verify();
+    }
+    report();
+}
+
+static void fill(uint32_t key, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        data[i] = (char)('a' + (key + i * 7) % 26);
+    }
+}
+
+static int read_matches(const char* path, uint32_t key, uint32_t size) {
+    int result = fs_read_file(path, buffer, sizeof(buffer));
+    if (result != (int)size) {
+        return 0;
+    }
+    fill(key, size);
+    return memcmp(buffer, data, size) == 0;
+}
+
+enum names {
+    NAMES_RANDOM,       // Hex of a scrambled index: unique, in no order
+    NAMES_SORTED,       // Ascending, the worst order for an unbalanced tree
+    NAMES_PREFIX        // Descending behind a long common prefix
+};
+
+static void make_name(char* name, enum names kind, uint32_t i) {
+    switch (kind) {
+    case NAMES_RANDOM:
+        sprintf(name, "f%08x", (i * 2654435761u) ^ seed);
+        break;
+    case NAMES_SORTED:
+        sprintf(name, "f%07u", i);
+        break;
+    case NAMES_PREFIX:
+        sprintf(name, "shared_prefix_of_twenty%07u", scale - i);
+        break;
+    }
+}
+
+static void make_miss(char* name, enum names kind, uint32_t i) {
+    make_name(name, kind, i);
+    name[strlen(name) - 1] = 'z';   // Shares all but the last character
+}
+
+// Create, look up, miss, write, read and delete count files in the root
+static void run_flat(const char* workload, enum names kind, uint32_t count) {
+    char name[MAX_FILENAME_LENGTH];
+    uint32_t* order = identity(count);
+    uint32_t written = count / 8;
+
+    start(workload);
+    for (uint32_t i = 0; i < count; i++) {
+        make_name(name, kind, i);
+        begin();
+        finish(OP_CREATE, fs_create_file(name) == 0);
+    }
+    if (kind == NAMES_RANDOM) {
+        shuffle(order, count);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        make_name(name, kind, order[i]);
+        begin();
+        finish(OP_LOOKUP, fs_file_exists(name));
+        make_miss(name, kind, order[i]);
+        begin();
+        finish(OP_MISS, !fs_file_exists(name));
+    }
+    for (uint32_t i = 0; i < written; i++) {
+        uint32_t size = 1 + random_below(1024);
+        make_name(name, kind, order[i]);
+        fill(order[i], size);
+        begin();
+        finish(OP_WRITE, fs_write_file(name, data, size) == 0);
+    }
+    for (uint32_t i = 0; i < written; i++) {
+        make_name(name, kind, order[i]);
+        uint32_t size = fs_get_file_size(name);
+        begin();
+        finish(OP_READ, read_matches(name, order[i], size));
+    }
+    if (kind == NAMES_RANDOM) {
+        shuffle(order, count);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        make_name(name, kind, order[i]);
+        begin();
+        finish(OP_DELETE, fs_delete_file(name) == 0);
+    }
+    end();
+    free(order);
+}
+
+// Build chains DEEP_LEVELS directories deep one cd at a time, jump to the
+// bottom by absolute path, then take them down again
+static void run_deep(uint32_t rounds) {
+    char path[MAX_PATH_LENGTH];
+
+    start("deep");
+    for (uint32_t round = 0; round < rounds; round++) {
+        uint32_t length = 0;
+        for (uint32_t level = 0; level < DEEP_LEVELS; level++) {
+            begin();
+            finish(OP_MKDIR, fs_create_directory("d") == 0);
+            begin();
+            finish(OP_CD, fs_change_directory("d") == 0);
+            length += sprintf(path + length, "/d");
+        }
+        fill(round, 100);
+        begin();
+        finish(OP_CREATE, fs_create_file("leaf") == 0);
+        begin();
+        finish(OP_WRITE, fs_write_file("leaf", data, 100) == 0);
+
+        begin();
+        finish(OP_CD, fs_change_directory("/") == 0);
+        begin();
+        finish(OP_CD, fs_change_directory(path) == 0);
+        begin();
+        finish(OP_READ, read_matches("leaf", round, 100));
+        begin();
+        finish(OP_DELETE, fs_delete_file("leaf") == 0);
+
+        for (uint32_t level = 0; level < DEEP_LEVELS; level++) {
+            begin();
+            finish(OP_CD, fs_change_directory("..") == 0);
+            begin();
+            finish(OP_RMDIR, fs_remove_directory("d") == 0);
+        }
+    }
+    end();
+}
+
+// On a full disk, delete a file and write another into the space it freed,
+// then crash with the new data written back but nothing more committed. The
+// deleted file must either be gone for good or replay with its contents.
+static void run_replay(void) {
+    char name[MAX_FILENAME_LENGTH];
+    uint32_t size = CHURN_MAX_SIZE;
+    char* filler = calloc(MAX_FILE_SIZE / 4, 1);
+    if (!filler) {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+
+    start("replay");
+    fill(1, size);
+    begin();
+    finish(OP_CREATE, fs_create_file("victim") == 0);
+    begin();
+    finish(OP_WRITE, fs_write_file("victim", data, size) == 0);
+    fs_sync();
+
+    // Fill the rest of the disk, halving the file size each time one fails
+    uint32_t count = 0;
+    for (uint32_t chunk = MAX_FILE_SIZE / 4; chunk >= FS_BLOCK_SIZE; chunk /= 2) {
+        do {
+            sprintf(name, "fill%u", count++);
+        } while (fs_create_file(name) == 0 && fs_write_file(name, filler, chunk) == 0);
+    }
+    fs_sync();
+
+    begin();
+    finish(OP_DELETE, fs_delete_file("victim") == 0);
+    fill(2, size);
+    begin();
+    finish(OP_CREATE, fs_create_file("grower") == 0);
+    begin();
+    finish(OP_WRITE, fs_write_file("grower", data, size) == 0);
+
+    // Crash: dirty data reaches the disk as an eviction would write it, the
+    // rest of the cache is lost, and mounting replays the journal
+    bcache_sync(ata_block_device());
+    if (bcache_init() != 0 || fs_init() != 0) {
+        fprintf(stderr, "replay: file system did not remount\n");
+        exit(2);
+    }
+    if (check_every_op) {
+        verify();
+    }
+    begin();
+    finish(OP_READ, !fs_file_exists("victim") || read_matches("victim", 1, size));
+    end();
+    free(filler);
+}
+
+struct churn_dir {
+    char path[MAX_PATH_LENGTH];
+    uint32_t depth;
+    uint32_t parent;
+    uint32_t children;          // Files and directories in it
+};
+
+struct churn_file {
+    char path[MAX_PATH_LENGTH];
+    uint32_t dir;
+    uint32_t key;
+    uint32_t size;
+};
+
+// Random operations over a tree that grows to about live entries and then
+// holds there, with the current directory wandering through it
+static void run_churn(uint32_t operations, uint32_t live) {
+    struct churn_dir* dirs = calloc(live + 1, sizeof(struct churn_dir));
+    struct churn_file* files = calloc(live + 1, sizeof(struct churn_file));
+    if (!dirs || !files) {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+    uint32_t dir_count = 1;
+    uint32_t file_count = 0;
+    uint32_t cwd = 0;
+    uint32_t serial = 0;
+    strcpy(dirs[0].path, "");
+
+    start("churn");
+    for (uint32_t n = 0; n < operations; n++) {
+        uint32_t roll = random_below(100);
+        int full = dir_count + file_count >= live;
+
+        if (roll < 25 && !full) {
+            struct churn_file* f = &files[file_count];
+            f->dir = random_below(dir_count);
+            f->key = serial;
+            f->size = 0;
+            sprintf(f->path, "%s/f%u", dirs[f->dir].path, serial++);
+            begin();
+            if (finish(OP_CREATE, fs_create_file(f->path) == 0)) {
+                dirs[f->dir].children++;
+                file_count++;
+            }
+        } else if (roll < 45 && file_count) {
+            struct churn_file* f = &files[random_below(file_count)];
+            f->key = serial++;
+            f->size = random_below(CHURN_MAX_SIZE + 1);
+            fill(f->key, f->size);
+            begin();
+            finish(OP_WRITE, fs_write_file(f->path, data, f->size) == 0);
+        } else if (roll < 65 && file_count) {
+            struct churn_file* f = &files[random_below(file_count)];
+            begin();
+            finish(OP_READ, read_matches(f->path, f->key, f->size));
+        } else if (roll < 85 && file_count) {
+            uint32_t victim = random_below(file_count);
+            begin();
+            if (finish(OP_DELETE, fs_delete_file(files[victim].path) == 0)) {
+                dirs[files[victim].dir].children--;
+                files[victim] = files[--file_count];
+            }
+        } else if (roll < 90 && !full) {
+            uint32_t parent = random_below(dir_count);
+            if (dirs[parent].depth == CHURN_MAX_DEPTH) {
+                continue;
+            }
+            struct churn_dir* d = &dirs[dir_count];
+            d->depth = dirs[parent].depth + 1;
+            d->parent = parent;
+            d->children = 0;
+            sprintf(d->path, "%s/d%u", dirs[parent].path, serial++);
+            begin();
+            if (finish(OP_MKDIR, fs_create_directory(d->path) == 0)) {
+                dirs[parent].children++;
+                dir_count++;
+            }
+        } else if (roll < 95 && dir_count > 1) {
+            uint32_t victim = 1 + random_below(dir_count - 1);
+            if (dirs[victim].children || victim == cwd) {
+                continue;
+            }
+            begin();
+            if (!finish(OP_RMDIR, fs_remove_directory(dirs[victim].path) == 0)) {
+                continue;
+            }
+            // Move the last directory into the hole and repoint what
+            // referred to it
+            uint32_t last = --dir_count;
+            dirs[dirs[victim].parent].children--;
+            dirs[victim] = dirs[last];
+            for (uint32_t i = 0; i < dir_count; i++) {
+                if (dirs[i].parent == last) {
+                    dirs[i].parent = victim;
+                }
+            }
+            for (uint32_t i = 0; i < file_count; i++) {
+                if (files[i].dir == last) {
+                    files[i].dir = victim;
+                }
+            }
+            if (cwd == last) {
+                cwd = victim;
+            }
+        } else {
+            uint32_t target = random_below(dir_count);
+            begin();
+            if (finish(OP_CD, fs_change_directory(target ? dirs[target].path : "/") == 0)) {
+                cwd = target;
+            }
+        }
+    }
+    end();
+    free(dirs);
+    free(files);
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-n scale] [-s seed] [-c] [-d] [-v]\n"
+                    "  -n  files per flat workload (default 20000, 2000 with -c)\n"
+                    "  -s  random seed (default 1)\n"
+                    "  -c  check every invariant after every operation\n"
+                    "  -d  put the file system on a disk with a journal instead of a ramdisk\n"
+                    "  -v  show the file system's own messages\n", program);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    seed = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            scale = (uint32_t)strtoul(argv[++i], 0, 0);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = (uint32_t)strtoul(argv[++i], 0, 0);
+        } else if (strcmp(argv[i], "-c") == 0) {
+            check_every_op = 1;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            on_disk = 1;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (scale == 0) {
+        scale = check_every_op ? 2000 : 20000;
+    }
+    if (scale > FS_MAX_ENTRIES - 16) {
+        scale = FS_MAX_ENTRIES - 16;
+    }
+    // Enough memory for the largest tables the file system will build
+    host_set_memory(256u << 20);
+
+    printf("File system benchmark: scale %u, seed %u, %s%s\n", scale, seed,
+           on_disk ? "disk with journal" : "ramdisk", check_every_op ? ", checked" : "");
+    printf("%-10s %-7s %8s %11s %8s %8s %8s %9s %6s\n",
+           "workload", "op", "count", "ops/s", "p50 ns", "p90 ns", "p99 ns", "max ns", "failed");
+
+    uint64_t begin_ns = timer_now_ns();
+    run_flat("random", NAMES_RANDOM, scale);
+    run_flat("sorted", NAMES_SORTED, scale);
+    run_flat("prefix", NAMES_PREFIX, scale);
+    run_deep(scale / 1000 ? scale / 1000 : 1);
+    run_churn(scale * 5, scale / 2);
+    if (on_disk) {
+        run_replay();
+    }
+    uint64_t elapsed_ms = (timer_now_ns() - begin_ns) / 1000000;
+
+    printf("%llu ms, %u checks, %u failed operations\n", (unsigned long long)elapsed_ms, checks, total_failures);
+    return total_failures ? 1 : 0;
+}
@@ -0,0 +1,159 @@
+// host.c - Linux stand-ins for the kernel services the file system uses
+//
+// Enough of the console, heap, memory manager, ATA driver, timer and initrd
+// for filesystem.c and the block layer under it to run as an ordinary
+// process. The disk lives in memory and there is no initrd.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "host.h"
+#include "vga.h"
+#include "kheap.h"
+#include "pmm.h"
+#include "paging.h"
+#include "ata.h"
+#include "initrd.h"
+#include "timer.h"
+
+int host_console;
+
+static uint32_t memory_bytes = 64u << 20;
+static uint8_t* disk;
+static uint32_t disk_blocks;
+
+void host_set_memory(uint32_t bytes) {
+    memory_bytes = bytes;
+}
+
+void host_set_disk(uint32_t blocks) {
+    free(disk);
+    disk = blocks ? calloc(blocks, 512) : 0;
+    disk_blocks = disk ? blocks : 0;
+}
+
+// Console
+void vga_puts(const char* str) {
+    if (host_console) {
+        fputs(str, stdout);
+    }
+}
+
+void vga_vprintf(const char* format, va_list args) {
+    if (host_console) {
+        vprintf(format, args);
+    }
+}
+
+void vga_printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vga_vprintf(format, args);
+    va_end(args);
+}
+
+void vga_set_color(enum vga_color fg, enum vga_color bg) {
+    (void)fg;
+    (void)bg;
+}
+
+void vga_batch_begin(void) {
+}
+
+void vga_batch_end(void) {
+}
+
+// Heap
+void* kmalloc(uint32_t size) {
+    return malloc(size);
+}
+
+void* kzalloc(uint32_t size) {
+    return calloc(1, size);
+}
+
+void* krealloc(void* ptr, uint32_t size) {
+    return realloc(ptr, size);
+}
+
+void kfree(void* ptr) {
+    free(ptr);
+}
+
+// Memory
+void pmm_get_stats(struct pmm_stats* stats) {
+    memset(stats, 0, sizeof(struct pmm_stats));
+    stats->total_memory = memory_bytes;
+    stats->total_frames = memory_bytes / PAGE_SIZE;
+    stats->free_frames = stats->total_frames;
+    stats->highest_frame = stats->total_frames;
+}
+
+// Without lazy mappings fs_map_file() reports failure, as on a kernel out of
+// address space
+void* paging_map_lazy(uint32_t size, page_fill_t fill, void* context) {
+    (void)size;
+    (void)fill;
+    (void)context;
+    return 0;
+}
+
+void paging_unmap_lazy(void* address) {
+    (void)address;
+}
+
+// Disk
+int ata_present(void) {
+    return disk != 0;
+}
+
+uint32_t ata_sector_count(void) {
+    return disk_blocks;
+}
+
+int ata_read(uint32_t lba, uint32_t count, void* buffer) {
+    if (lba > disk_blocks || count > disk_blocks - lba) {
+        return -1;
+    }
+    memcpy(buffer, disk + (uint64_t)lba * 512, (uint64_t)count * 512);
+    return 0;
+}
+
+int ata_write(uint32_t lba, uint32_t count, const void* buffer) {
+    if (lba > disk_blocks || count > disk_blocks - lba) {
+        return -1;
+    }
+    memcpy(disk + (uint64_t)lba * 512, buffer, (uint64_t)count * 512);
+    return 0;
+}
+
+int ata_flush(void) {
+    return 0;
+}
+
+// Timer
+uint64_t timer_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// No initrd
+int initrd_present(void) {
+    return 0;
+}
+
+uint32_t initrd_size(void) {
+    return 0;
+}
+
+const uint8_t* initrd_data(uint32_t offset) {
+    (void)offset;
+    return 0;
+}
+
+int initrd_read_entry(uint32_t offset, struct initrd_entry* entry) {
+    (void)offset;
+    (void)entry;
+    return -1;
+}
@@ -0,0 +1,17 @@
+// host.h - Linux stand-ins for the kernel services the file system uses
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+
+// Kernel console output is dropped unless this is set
+extern int host_console;
+
+// Memory the file system sizes its tables from, as pmm_get_stats() reports it
+void host_set_memory(uint32_t bytes);
+
+// Replace the disk with a blank one of the given blocks; 0 removes it so the
+// file system falls back to a ramdisk
+void host_set_disk(uint32_t blocks);
+
+#endif
@@ -0,0 +1,184 @@
+// acpi.c - ACPI table discovery for the processor and interrupt controller layout
+//
+// Only the MADT is needed: it lists the local APIC of every processor, the IO
+// APIC and how ISA IRQs map onto its inputs. The tables are read once through
+// physical addresses, before paging is enabled, and the parts we use are
+// copied into a struct acpi_madt.
+#include "acpi.h"
+#include "vga.h"
+#include "klib.h"
+
+#define RSDP_SIGNATURE "RSD PTR "
+#define BIOS_AREA_START 0xE0000
+#define BIOS_AREA_END   0x100000
+#define EBDA_POINTER    0x40E
+
+// MADT entry types
+#define MADT_LOCAL_APIC 0
+#define MADT_IO_APIC    1
+#define MADT_OVERRIDE   2
+
+#define MADT_CPU_ENABLED 0x1
+
+struct rsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+} __attribute__((packed));
+
+struct sdt_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct madt_header {
+    struct sdt_header sdt;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed));
+
+struct madt_entry {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+struct madt_local_apic {
+    struct madt_entry entry;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed));
+
+struct madt_io_apic {
+    struct madt_entry entry;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed));
+
+struct madt_override {
+    struct madt_entry entry;
+    uint8_t bus;
+    uint8_t irq;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed));
+
+static struct acpi_madt madt;
+static int madt_found = 0;
+
+static int checksum_ok(const void* table, uint32_t length) {
+    const uint8_t* bytes = (const uint8_t*)table;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+// The RSDP sits on a 16-byte boundary in the first KiB of the EBDA or in
+// the BIOS area below 1 MiB
+static const struct rsdp* scan_rsdp(uint32_t start, uint32_t end) {
+    for (uint32_t address = start; address + sizeof(struct rsdp) <= end; address += 16) {
+        const struct rsdp* rsdp = (const struct rsdp*)address;
+        if (memcmp(rsdp->signature, RSDP_SIGNATURE, 8) == 0 && checksum_ok(rsdp, sizeof(struct rsdp))) {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+static const struct rsdp* find_rsdp(void) {
+    uint32_t ebda = (uint32_t)*(const uint16_t*)EBDA_POINTER << 4;
+    const struct rsdp* rsdp = 0;
+    if (ebda >= 0x80000 && ebda < BIOS_AREA_START) {
+        rsdp = scan_rsdp(ebda, ebda + 1024);
+    }
+    return rsdp ? rsdp : scan_rsdp(BIOS_AREA_START, BIOS_AREA_END);
+}
+
+static const struct sdt_header* find_table(const struct rsdp* rsdp, const char* signature) {
+    const struct sdt_header* rsdt = (const struct sdt_header*)rsdp->rsdt_address;
+    if (memcmp(rsdt->signature, "RSDT", 4) != 0 || !checksum_ok(rsdt, rsdt->length)) {
+        return 0;
+    }
+    const uint32_t* entries = (const uint32_t*)(rsdt + 1);
+    uint32_t count = (rsdt->length - sizeof(struct sdt_header)) / sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++) {
+        const struct sdt_header* table = (const struct sdt_header*)entries[i];
+        if (memcmp(table->signature, signature, 4) == 0 && checksum_ok(table, table->length)) {
+            return table;
+        }
+    }
+    return 0;
+}
+
+static void parse_madt(const struct madt_header* header) {
+    madt.lapic_address = header->lapic_address;
+    for (uint32_t irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        madt.isa_gsi[irq] = irq;    // Identity unless overridden
+    }
+
+    const uint8_t* position = (const uint8_t*)(header + 1);
+    const uint8_t* end = (const uint8_t*)header + header->sdt.length;
+    while (position + sizeof(struct madt_entry) <= end) {
+        const struct madt_entry* entry = (const struct madt_entry*)position;
+        if (entry->length < sizeof(struct madt_entry) || position + entry->length > end) {
+            break;
+        }
+
+        if (entry->type == MADT_LOCAL_APIC) {
+            const struct madt_local_apic* cpu = (const struct madt_local_apic*)entry;
+            if ((cpu->flags & MADT_CPU_ENABLED) && madt.cpu_count < ACPI_MAX_CPUS) {
+                madt.apic_ids[madt.cpu_count++] = cpu->apic_id;
+            }
+        } else if (entry->type == MADT_IO_APIC && !madt.ioapic_address) {
+            // Only the first IO APIC is used; it carries the ISA interrupts
+            const struct madt_io_apic* ioapic = (const struct madt_io_apic*)entry;
+            madt.ioapic_address = ioapic->address;
+            madt.ioapic_id = ioapic->id;
+            madt.ioapic_gsi_base = ioapic->gsi_base;
+        } else if (entry->type == MADT_OVERRIDE) {
+            const struct madt_override* override = (const struct madt_override*)entry;
+            if (override->bus == 0 && override->irq < ACPI_ISA_IRQS) {
+                madt.isa_gsi[override->irq] = override->gsi;
+                madt.isa_flags[override->irq] = override->flags;
+            }
+        }
+        position += entry->length;
+    }
+}
+
+int acpi_init(void) {
+    const struct rsdp* rsdp = find_rsdp();
+    if (!rsdp) {
+        vga_puts("ACPI: no RSDP found, running on one CPU.\n");
+        return -1;
+    }
+    const struct sdt_header* table = find_table(rsdp, "APIC");
+    if (!table) {
+        vga_puts("ACPI: no MADT found, running on one CPU.\n");
+        return -1;
+    }
+
+    parse_madt((const struct madt_header*)table);
+    madt_found = 1;
+    vga_printf("ACPI: %u CPUs, local APIC at %08x, IO APIC at %08x.\n",
+               madt.cpu_count, madt.lapic_address, madt.ioapic_address);
+    return 0;
+}
+
+// Null when there is no usable MADT
+const struct acpi_madt* acpi_get_madt(void) {
+    return madt_found ? &madt : 0;
+}
@@ -0,0 +1,32 @@
+// acpi.h - ACPI table discovery for the processor and interrupt controller layout
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+#define ACPI_MAX_CPUS 32
+#define ACPI_ISA_IRQS 16
+
+// MADT interrupt source override flags
+#define ACPI_POLARITY_MASK 0x3
+#define ACPI_POLARITY_LOW  0x3
+#define ACPI_TRIGGER_MASK  0xC
+#define ACPI_TRIGGER_LEVEL 0xC
+
+// What the MADT says about the machine, copied out of the firmware tables
+struct acpi_madt {
+    uint32_t lapic_address;
+    uint32_t cpu_count;                     // Enabled processors
+    uint8_t apic_ids[ACPI_MAX_CPUS];
+    uint32_t ioapic_address;                // 0 if there is no IO APIC
+    uint8_t ioapic_id;
+    uint32_t ioapic_gsi_base;
+    uint32_t isa_gsi[ACPI_ISA_IRQS];        // Global interrupt for each ISA IRQ
+    uint16_t isa_flags[ACPI_ISA_IRQS];      // Polarity and trigger mode
+};
+
+// Function prototypes
+int acpi_init(void);
+const struct acpi_madt* acpi_get_madt(void);
+
+#endif
@@ -0,0 +1,169 @@
+// apic.c - Local APIC and IO APIC
+//
+// Once apic_init() has found an IO APIC, device IRQs no longer come from the
+// 8259s: each ISA IRQ is programmed into the IO APIC input the MADT maps it
+// to, with the vector the PIC used, delivered to the bootstrap processor and
+// acknowledged at its local APIC. IRQs already unmasked at the PIC stay
+// enabled across the switch. The local APICs also carry the IPIs that start
+// and wake the other CPUs. Without a MADT the PIC stays in charge.
+#include "apic.h"
+#include "acpi.h"
+#include "cpu.h"
+#include "paging.h"
+#include "pic.h"
+#include "vga.h"
+
+#define NO_PIN 0xFFFFFFFFu
+
+static volatile uint32_t* lapic = 0;
+static volatile uint32_t* ioapic = 0;
+static uint32_t ioapic_entries;
+static uint32_t isa_pin[IRQ_COUNT];     // IO APIC input of each ISA IRQ
+static int ioapic_routing = 0;
+
+static uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+}
+
+static uint32_t ioapic_read(uint32_t reg) {
+    ioapic[IOAPIC_SELECT / 4] = reg;
+    return ioapic[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t value) {
+    ioapic[IOAPIC_SELECT / 4] = reg;
+    ioapic[IOAPIC_WINDOW / 4] = value;
+}
+
+// Enable the calling CPU's local APIC and let every priority through
+void lapic_init(void) {
+    wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TPR, 0);
+}
+
+// Program an ISA IRQ's input, masked, for delivery to this CPU
+static void ioapic_route(const struct acpi_madt* madt, uint8_t irq, uint32_t apic_id) {
+    uint32_t pin = madt->isa_gsi[irq] - madt->ioapic_gsi_base;
+    if (pin >= ioapic_entries) {
+        return;
+    }
+
+    uint32_t low = (IRQ_BASE_VECTOR + irq) | IOAPIC_MASKED;
+    if ((madt->isa_flags[irq] & ACPI_POLARITY_MASK) == ACPI_POLARITY_LOW) {
+        low |= IOAPIC_ACTIVE_LOW;
+    }
+    if ((madt->isa_flags[irq] & ACPI_TRIGGER_MASK) == ACPI_TRIGGER_LEVEL) {
+        low |= IOAPIC_LEVEL;
+    }
+    ioapic_write(IOAPIC_REDIRECT + pin * 2 + 1, apic_id << 24);
+    ioapic_write(IOAPIC_REDIRECT + pin * 2, low);
+    isa_pin[irq] = pin;
+}
+
+// Bring up the bootstrap processor's local APIC and move device IRQs from
+// the PIC to the IO APIC. Call with the PIC's handlers installed.
+int apic_init(void) {
+    const struct acpi_madt* madt = acpi_get_madt();
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!madt || !(edx & CPUID_EDX_APIC) || paging_map_device(madt->lapic_address) != 0) {
+        return -1;
+    }
+    lapic = (volatile uint32_t*)madt->lapic_address;
+    lapic_init();
+
+    if (!madt->ioapic_address || paging_map_device(madt->ioapic_address) != 0) {
+        vga_puts("APIC: no IO APIC, IRQs stay on the PIC.\n");
+        return 0;
+    }
+    ioapic = (volatile uint32_t*)madt->ioapic_address;
+    ioapic_entries = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+    for (uint32_t pin = 0; pin < ioapic_entries; pin++) {
+        ioapic_write(IOAPIC_REDIRECT + pin * 2, IOAPIC_MASKED);
+    }
+
+    uint32_t flags = irq_save();
+    uint16_t enabled = ~pic_get_mask();
+    for (uint8_t irq = 0; irq < IRQ_COUNT; irq++) {
+        isa_pin[irq] = NO_PIN;
+        if (irq != IRQ_CASCADE) {
+            ioapic_route(madt, irq, lapic_id());
+        }
+    }
+    pic_disable();
+    ioapic_routing = 1;
+    for (uint8_t irq = 0; irq < IRQ_COUNT; irq++) {
+        if (irq != IRQ_CASCADE && (enabled & (1u << irq))) {
+            ioapic_unmask_irq(irq);
+        }
+    }
+    irq_restore(flags);
+
+    vga_printf("APIC: IRQs routed through the IO APIC (%u inputs).\n", ioapic_entries);
+    return 0;
+}
+
+int apic_enabled(void) {
+    return lapic != 0;
+}
+
+// Whether IRQs come through the IO APIC (and are acknowledged at the local
+// APIC) rather than the PIC
+int ioapic_enabled(void) {
+    return ioapic_routing;
+}
+
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void send_command(uint32_t apic_id, uint32_t command) {
+    // A handler sending an IPI between the two writes would retarget ours
+    uint32_t flags = irq_save();
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+        cpu_relax();
+    }
+    irq_restore(flags);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    send_command(apic_id, ICR_ASSERT | vector);
+}
+
+void lapic_send_init(uint32_t apic_id) {
+    send_command(apic_id, ICR_INIT | ICR_ASSERT);
+}
+
+// Start a CPU waiting after INIT at address, which must be page-aligned and
+// below 1 MiB
+void lapic_send_startup(uint32_t apic_id, uint32_t address) {
+    send_command(apic_id, ICR_STARTUP | (address >> 12));
+}
+
+static void ioapic_set_mask(uint8_t irq, int masked) {
+    if (irq >= IRQ_COUNT || isa_pin[irq] == NO_PIN) {
+        return;
+    }
+    uint32_t reg = IOAPIC_REDIRECT + isa_pin[irq] * 2;
+    uint32_t low = ioapic_read(reg);
+    ioapic_write(reg, masked ? low | IOAPIC_MASKED : low & ~IOAPIC_MASKED);
+}
+
+void ioapic_mask_irq(uint8_t irq) {
+    ioapic_set_mask(irq, 1);
+}
+
+void ioapic_unmask_irq(uint8_t irq) {
+    ioapic_set_mask(irq, 0);
+}
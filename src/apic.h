@@ -0,0 +1,53 @@
+// apic.h - Local APIC and IO APIC
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+#include "idt.h"
+
+// Local APIC register offsets
+#define LAPIC_ID        0x020
+#define LAPIC_VERSION   0x030
+#define LAPIC_TPR       0x080
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0
+#define LAPIC_ESR       0x280
+#define LAPIC_ICR_LOW   0x300
+#define LAPIC_ICR_HIGH  0x310
+
+#define LAPIC_SVR_ENABLE 0x100
+
+// Interrupt command register
+#define ICR_INIT        0x00000500
+#define ICR_STARTUP     0x00000600
+#define ICR_ASSERT      0x00004000
+#define ICR_PENDING     0x00001000
+
+// IO APIC registers, reached through the select/window pair
+#define IOAPIC_SELECT   0x00
+#define IOAPIC_WINDOW   0x10
+#define IOAPIC_VERSION  0x01
+#define IOAPIC_REDIRECT 0x10
+
+#define IOAPIC_ACTIVE_LOW (1u << 13)
+#define IOAPIC_LEVEL      (1u << 15)
+#define IOAPIC_MASKED     (1u << 16)
+
+// Vectors raised by local APICs rather than IRQ lines
+#define APIC_IPI_VECTOR      APIC_VECTOR_BASE           // Wakes an idle CPU
+#define APIC_SPURIOUS_VECTOR (APIC_VECTOR_BASE + 15)
+
+// Function prototypes
+int apic_init(void);
+void lapic_init(void);
+int apic_enabled(void);
+int ioapic_enabled(void);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_startup(uint32_t apic_id, uint32_t address);
+void ioapic_mask_irq(uint8_t irq);
+void ioapic_unmask_irq(uint8_t irq);
+
+#endif
@@ -0,0 +1,334 @@
+// ata.c - ATA disk driver (PIO and bus-master DMA) for the primary IDE channel
+//
+// Only the primary master is used. Transfers go through bus-master DMA when
+// the IDE controller and drive support it: the PRD table points straight at
+// the caller's buffer (memory is identity mapped), split at 64 KiB
+// boundaries, and completion is signalled by IRQ14 while the CPU halts.
+// PIO with rep insw/outsw remains as the fallback.
+#include "ata.h"
+#include "idt.h"
+#include "io.h"
+#include "pci.h"
+#include "pmm.h"
+#include "timer.h"
+#include "vga.h"
+
+// Physical region descriptor; bit 15 of flags marks the last one
+struct prd_entry {
+    uint32_t address;
+    uint16_t byte_count;    // 0 means 64 KiB
+    uint16_t flags;
+} __attribute__((packed));
+
+#define PRD_END 0x8000
+#define PRD_MAX_ENTRIES 4   // 128 KiB can touch at most three 64 KiB windows
+
+// 32-byte alignment keeps the table from crossing a 64 KiB boundary
+static struct prd_entry prd_table[PRD_MAX_ENTRIES] __attribute__((aligned(32)));
+
+static int disk_present = 0;
+static int dma_enabled = 0;
+static uint16_t bm_base = 0;
+static uint32_t sector_count = 0;
+static char model[41];
+static volatile int irq_fired = 0;
+static struct ata_stats stats;
+
+static void ata_irq_handler(struct interrupt_frame* frame) {
+    (void)frame;
+    // Reading the status register acknowledges the drive's interrupt
+    inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+    irq_fired = 1;
+}
+
+// Read the alternate status register four times: the 400ns settle delay
+static void ata_delay(void) {
+    for (int i = 0; i < 4; i++) {
+        inb(ATA_PRIMARY_CONTROL);
+    }
+}
+
+static int ata_wait_not_busy(void) {
+    uint64_t deadline = timer_uptime_ms() + ATA_TIMEOUT_MS;
+    while (inb(ATA_PRIMARY_IO + ATA_REG_STATUS) & ATA_STATUS_BSY) {
+        if (timer_uptime_ms() > deadline) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Wait until the drive is ready to move a sector of PIO data
+static int ata_wait_drq(void) {
+    uint64_t deadline = timer_uptime_ms() + ATA_TIMEOUT_MS;
+    for (;;) {
+        uint8_t status = inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+        if (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) {
+            return -1;
+        }
+        if (!(status & ATA_STATUS_BSY) && (status & ATA_STATUS_DRQ)) {
+            return 0;
+        }
+        if (timer_uptime_ms() > deadline) {
+            return -1;
+        }
+    }
+}
+
+// Wait for the DMA completion interrupt, sleeping in hlt if interrupts are
+// on and polling the bus-master status otherwise
+static int ata_wait_irq(void) {
+    uint64_t deadline = timer_uptime_ms() + ATA_TIMEOUT_MS;
+    for (;;) {
+        uint32_t flags = irq_save();
+        if (irq_fired || (inb(bm_base + BM_STATUS) & BM_STATUS_IRQ)) {
+            irq_restore(flags);
+            return 0;
+        }
+        if (timer_uptime_ms() > deadline) {
+            irq_restore(flags);
+            return -1;
+        }
+        if (flags & 0x200) {
+            cpu_idle();
+        } else {
+            irq_restore(flags);
+        }
+    }
+}
+
+static void ata_select(uint32_t lba, uint32_t count) {
+    outb(ATA_PRIMARY_IO + ATA_REG_DRIVE, 0xE0 | ((lba >> 24) & 0x0F));
+    ata_delay();
+    outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT, (uint8_t)count);   // 256 is sent as 0
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA0, (uint8_t)lba);
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA1, (uint8_t)(lba >> 8));
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA2, (uint8_t)(lba >> 16));
+}
+
+static int ata_pio_transfer(uint32_t lba, uint32_t count, void* buffer, int write) {
+    uint16_t* words = (uint16_t*)buffer;
+
+    if (ata_wait_not_busy() != 0) {
+        return -1;
+    }
+    ata_select(lba, count);
+    outb(ATA_PRIMARY_IO + ATA_REG_STATUS, write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (ata_wait_drq() != 0) {
+            return -1;
+        }
+        if (write) {
+            outsw(ATA_PRIMARY_IO + ATA_REG_DATA, words, ATA_SECTOR_SIZE / 2);
+        } else {
+            insw(ATA_PRIMARY_IO + ATA_REG_DATA, words, ATA_SECTOR_SIZE / 2);
+        }
+        words += ATA_SECTOR_SIZE / 2;
+    }
+
+    if (ata_wait_not_busy() != 0) {
+        return -1;
+    }
+    stats.pio_commands++;
+    return (inb(ATA_PRIMARY_IO + ATA_REG_STATUS) & (ATA_STATUS_ERR | ATA_STATUS_DF)) ? -1 : 0;
+}
+
+static int ata_dma_transfer(uint32_t lba, uint32_t count, void* buffer, int write) {
+    // Describe the buffer, never letting one entry cross a 64 KiB boundary
+    uint32_t address = (uint32_t)buffer;
+    uint32_t remaining = count * ATA_SECTOR_SIZE;
+    int entries = 0;
+    while (remaining) {
+        uint32_t chunk = 0x10000 - (address & 0xFFFF);
+        if (chunk > remaining) {
+            chunk = remaining;
+        }
+        prd_table[entries].address = address;
+        prd_table[entries].byte_count = (uint16_t)chunk;
+        prd_table[entries].flags = 0;
+        address += chunk;
+        remaining -= chunk;
+        entries++;
+    }
+    prd_table[entries - 1].flags = PRD_END;
+
+    if (ata_wait_not_busy() != 0) {
+        return -1;
+    }
+
+    outb(bm_base + BM_COMMAND, 0);
+    outl(bm_base + BM_PRDT, (uint32_t)prd_table);
+    outb(bm_base + BM_STATUS, inb(bm_base + BM_STATUS) | BM_STATUS_IRQ | BM_STATUS_ERROR);
+    irq_fired = 0;
+
+    ata_select(lba, count);
+    outb(ATA_PRIMARY_IO + ATA_REG_STATUS, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    outb(bm_base + BM_COMMAND, BM_CMD_START | (write ? 0 : BM_CMD_READ));
+
+    int result = ata_wait_irq();
+    outb(bm_base + BM_COMMAND, 0);
+    uint8_t bm_status = inb(bm_base + BM_STATUS);
+    uint8_t status = inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+    outb(bm_base + BM_STATUS, bm_status | BM_STATUS_IRQ | BM_STATUS_ERROR);
+
+    stats.dma_commands++;
+    if (result != 0 || (bm_status & BM_STATUS_ERROR) || (status & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+        return -1;
+    }
+    return 0;
+}
+
+static int ata_transfer(uint32_t lba, uint32_t count, void* buffer, int write) {
+    if (!disk_present || lba + count > sector_count || lba + count < lba) {
+        return -1;
+    }
+
+    uint8_t* data = (uint8_t*)buffer;
+    while (count) {
+        uint32_t chunk = count > ATA_MAX_SECTORS ? ATA_MAX_SECTORS : count;
+
+        // DMA needs a word-aligned buffer inside the identity-mapped range
+        uint32_t address = (uint32_t)data;
+        int use_dma = dma_enabled && !(address & 1) &&
+                      address + chunk * ATA_SECTOR_SIZE <= PMM_MAX_ADDRESS;
+        int result = use_dma ? ata_dma_transfer(lba, chunk, data, write)
+                             : ata_pio_transfer(lba, chunk, data, write);
+        if (result != 0) {
+            stats.errors++;
+            return -1;
+        }
+
+        if (write) {
+            stats.write_commands++;
+            stats.sectors_written += chunk;
+        } else {
+            stats.read_commands++;
+            stats.sectors_read += chunk;
+        }
+        lba += chunk;
+        data += chunk * ATA_SECTOR_SIZE;
+        count -= chunk;
+    }
+    return 0;
+}
+
+int ata_read(uint32_t lba, uint32_t count, void* buffer) {
+    return ata_transfer(lba, count, buffer, 0);
+}
+
+int ata_write(uint32_t lba, uint32_t count, const void* buffer) {
+    return ata_transfer(lba, count, (void*)buffer, 1);
+}
+
+// Make completed writes durable in the drive's cache-backed media
+int ata_flush(void) {
+    if (!disk_present) {
+        return -1;
+    }
+    outb(ATA_PRIMARY_IO + ATA_REG_DRIVE, 0xE0);
+    ata_delay();
+    outb(ATA_PRIMARY_IO + ATA_REG_STATUS, ATA_CMD_FLUSH);
+    stats.flushes++;
+    if (ata_wait_not_busy() != 0 ||
+        (inb(ATA_PRIMARY_IO + ATA_REG_STATUS) & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+        stats.errors++;
+        return -1;
+    }
+    return 0;
+}
+
+// IDENTIFY the primary master; returns 0 and fills identify[] if it is ATA
+static int ata_identify(uint16_t* identify) {
+    uint8_t status = inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+    if (status == 0xFF) {
+        return -1;  // Floating bus: no controller
+    }
+
+    outb(ATA_PRIMARY_IO + ATA_REG_DRIVE, 0xA0);
+    ata_delay();
+    outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT, 0);
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA0, 0);
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA1, 0);
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA2, 0);
+    outb(ATA_PRIMARY_IO + ATA_REG_STATUS, ATA_CMD_IDENTIFY);
+
+    if (inb(ATA_PRIMARY_IO + ATA_REG_STATUS) == 0) {
+        return -1;  // No drive
+    }
+    if (ata_wait_not_busy() != 0) {
+        return -1;
+    }
+    // ATAPI and SATA devices report a signature here and abort IDENTIFY
+    if (inb(ATA_PRIMARY_IO + ATA_REG_LBA1) || inb(ATA_PRIMARY_IO + ATA_REG_LBA2)) {
+        return -1;
+    }
+    if (ata_wait_drq() != 0) {
+        return -1;
+    }
+    insw(ATA_PRIMARY_IO + ATA_REG_DATA, identify, 256);
+    return 0;
+}
+
+int ata_init(void) {
+    uint16_t identify[256];
+    if (ata_identify(identify) != 0) {
+        return -1;
+    }
+
+    // LBA28 capacity, and the model string stored as byte-swapped words
+    sector_count = identify[60] | ((uint32_t)identify[61] << 16);
+    for (int i = 0; i < 20; i++) {
+        model[i * 2] = (char)(identify[27 + i] >> 8);
+        model[i * 2 + 1] = (char)identify[27 + i];
+    }
+    model[40] = '\0';
+    for (int i = 39; i >= 0 && model[i] == ' '; i--) {
+        model[i] = '\0';
+    }
+    if (sector_count == 0) {
+        return -1;
+    }
+
+    // Bus mastering needs the IDE controller's BAR4 and drive DMA support
+    struct pci_device ide;
+    int dma_capable = (identify[49] & 0x0100) != 0;
+    if (dma_capable && pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &ide) == 0) {
+        uint32_t bar4 = pci_read32(ide.bus, ide.slot, ide.function, PCI_BAR4);
+        if ((bar4 & 1) && (bar4 & 0xFFFC)) {
+            bm_base = bar4 & 0xFFFC;
+            uint32_t command = pci_read32(ide.bus, ide.slot, ide.function, PCI_COMMAND);
+            pci_write32(ide.bus, ide.slot, ide.function, PCI_COMMAND,
+                        command | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+            dma_enabled = 1;
+        }
+    }
+
+    irq_install_handler(IRQ_ATA_PRIMARY, ata_irq_handler);
+    outb(ATA_PRIMARY_CONTROL, 0);   // Clear nIEN so the drive raises IRQ14
+    disk_present = 1;
+
+    vga_printf("ATA disk: %s, %u MiB, %s\n", model, sector_count / 2048,
+               dma_enabled ? "bus-master DMA" : "PIO");
+    return 0;
+}
+
+int ata_present(void) {
+    return disk_present;
+}
+
+int ata_dma_enabled(void) {
+    return dma_enabled;
+}
+
+uint32_t ata_sector_count(void) {
+    return sector_count;
+}
+
+const char* ata_model(void) {
+    return model;
+}
+
+void ata_get_stats(struct ata_stats* out) {
+    *out = stats;
+}
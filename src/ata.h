@@ -0,0 +1,69 @@
+// ata.h - ATA disk driver (PIO and bus-master DMA) for the primary IDE channel
+#ifndef ATA_H
+#define ATA_H
+
+#include <stdint.h>
+
+#define ATA_SECTOR_SIZE 512
+
+// Primary channel task-file registers
+#define ATA_PRIMARY_IO      0x1F0
+#define ATA_PRIMARY_CONTROL 0x3F6
+#define ATA_REG_DATA     0
+#define ATA_REG_ERROR    1
+#define ATA_REG_SECCOUNT 2
+#define ATA_REG_LBA0     3
+#define ATA_REG_LBA1     4
+#define ATA_REG_LBA2     5
+#define ATA_REG_DRIVE    6
+#define ATA_REG_STATUS   7   // Command register on write
+
+#define ATA_STATUS_ERR  0x01
+#define ATA_STATUS_DRQ  0x08
+#define ATA_STATUS_DF   0x20
+#define ATA_STATUS_DRDY 0x40
+#define ATA_STATUS_BSY  0x80
+
+#define ATA_CMD_READ_PIO   0x20
+#define ATA_CMD_WRITE_PIO  0x30
+#define ATA_CMD_READ_DMA   0xC8
+#define ATA_CMD_WRITE_DMA  0xCA
+#define ATA_CMD_FLUSH      0xE7
+#define ATA_CMD_IDENTIFY   0xEC
+
+// Bus-master IDE registers, relative to PCI BAR4
+#define BM_COMMAND 0
+#define BM_STATUS  2
+#define BM_PRDT    4
+#define BM_CMD_START 0x01
+#define BM_CMD_READ  0x08   // Device to memory
+#define BM_STATUS_ERROR 0x02
+#define BM_STATUS_IRQ   0x04
+
+// One LBA28 command moves at most 256 sectors
+#define ATA_MAX_SECTORS 256
+#define ATA_TIMEOUT_MS 5000
+
+struct ata_stats {
+    uint32_t read_commands;
+    uint32_t write_commands;
+    uint32_t dma_commands;
+    uint32_t pio_commands;
+    uint32_t flushes;
+    uint32_t errors;
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+};
+
+// Function prototypes
+int ata_init(void);
+int ata_present(void);
+int ata_dma_enabled(void);
+uint32_t ata_sector_count(void);
+const char* ata_model(void);
+int ata_read(uint32_t lba, uint32_t count, void* buffer);
+int ata_write(uint32_t lba, uint32_t count, const void* buffer);
+int ata_flush(void);
+void ata_get_stats(struct ata_stats* stats);
+
+#endif
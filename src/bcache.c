@@ -0,0 +1,358 @@
+// bcache.c - Buffer cache for block devices
+//
+// Cached blocks are found through a chained hash on (device, block) and kept
+// on one LRU list; the victim is the least recently released buffer nobody
+// has pinned. Writes only mark a buffer dirty: it reaches the device when it
+// is evicted or when bcache_sync() writes every dirty block of a device in
+// block order, merging neighbours into one transfer. Held buffers are dirty
+// blocks whose new contents must go through a journal first; they stay in
+// memory until their owner lets go of them. A reader asking for the
+// block after the one it read last is treated as sequential, and each miss
+// then fetches a window of following blocks in the same transfer, doubling
+// the window up to BCACHE_READAHEAD_MAX while the pattern holds.
+#include "bcache.h"
+#include "kheap.h"
+#include "pmm.h"
+#include "klib.h"
+
+#define STAGING_BLOCKS (BCACHE_READAHEAD_MAX + 1 > BCACHE_WRITE_RUN_MAX ? \
+                        BCACHE_READAHEAD_MAX + 1 : BCACHE_WRITE_RUN_MAX)
+
+static struct bcache_buf* buffers;
+static uint32_t buffer_count;
+static struct bcache_buf** hash_table;
+static uint32_t hash_mask;
+static struct bcache_buf lru;           // Sentinel: next is MRU, prev is LRU
+static uint8_t* staging;                // Multi-block transfers go through here
+static struct bcache_buf** sync_list;
+
+// Sequential read detection
+static struct block_device* ra_dev;
+static uint32_t ra_next;
+static uint32_t ra_window;
+
+static struct bcache_stats stats;
+
+static uint32_t hash_slot(struct block_device* dev, uint32_t block) {
+    return (block * 2654435761u ^ ((uintptr_t)dev >> 4)) & hash_mask;
+}
+
+static struct bcache_buf* hash_find(struct block_device* dev, uint32_t block) {
+    if (!hash_table) {
+        return 0;   // bcache_init() failed; every request misses and fails
+    }
+    struct bcache_buf* buf = hash_table[hash_slot(dev, block)];
+    while (buf && (buf->dev != dev || buf->block != block)) {
+        buf = buf->hash_next;
+    }
+    return buf;
+}
+
+static void hash_insert(struct bcache_buf* buf) {
+    uint32_t slot = hash_slot(buf->dev, buf->block);
+    buf->hash_next = hash_table[slot];
+    hash_table[slot] = buf;
+}
+
+static void hash_remove(struct bcache_buf* buf) {
+    struct bcache_buf** link = &hash_table[hash_slot(buf->dev, buf->block)];
+    while (*link != buf) {
+        link = &(*link)->hash_next;
+    }
+    *link = buf->hash_next;
+}
+
+static void lru_unlink(struct bcache_buf* buf) {
+    buf->lru_prev->lru_next = buf->lru_next;
+    buf->lru_next->lru_prev = buf->lru_prev;
+}
+
+static void lru_push_front(struct bcache_buf* buf) {
+    buf->lru_next = lru.lru_next;
+    buf->lru_prev = &lru;
+    lru.lru_next->lru_prev = buf;
+    lru.lru_next = buf;
+}
+
+static void lru_push_back(struct bcache_buf* buf) {
+    buf->lru_prev = lru.lru_prev;
+    buf->lru_next = &lru;
+    lru.lru_prev->lru_next = buf;
+    lru.lru_prev = buf;
+}
+
+// Detach the least recently used unpinned buffer, writing it back first if
+// it is dirty. Returns it pinned and empty, or null if none can be freed.
+static struct bcache_buf* take_victim(void) {
+    struct bcache_buf* buf = lru.lru_prev;
+    while (buf != &lru && (buf->refcount || buf->held)) {
+        buf = buf->lru_prev;
+    }
+    if (buf == &lru) {
+        return 0;
+    }
+
+    if (buf->dev) {
+        if (buf->dirty) {
+            if (blockdev_write(buf->dev, buf->block, 1, buf->data) != 0) {
+                return 0;
+            }
+            stats.writebacks++;
+        }
+        hash_remove(buf);
+        stats.evictions++;
+    }
+    buf->dev = 0;
+    buf->dirty = 0;
+    buf->prefetched = 0;
+    buf->refcount = 1;
+    return buf;
+}
+
+static void attach(struct bcache_buf* buf, struct block_device* dev, uint32_t block) {
+    buf->dev = dev;
+    buf->block = block;
+    hash_insert(buf);
+}
+
+// Give a claimed buffer back without contents
+static void discard(struct bcache_buf* buf) {
+    if (buf->dev) {
+        hash_remove(buf);
+    }
+    buf->dev = 0;
+    buf->dirty = 0;
+    buf->prefetched = 0;
+    buf->held = 0;
+    buf->refcount = 0;
+    lru_unlink(buf);
+    lru_push_back(buf);
+}
+
+int bcache_init(void) {
+    lru.lru_next = &lru;
+    lru.lru_prev = &lru;
+
+    struct pmm_stats memory;
+    pmm_get_stats(&memory);
+
+    // 1/32 of free memory, in blocks
+    uint32_t count = memory.free_frames / 32 * (PAGE_SIZE / BLOCKDEV_BLOCK_SIZE);
+    if (count < BCACHE_MIN_BUFFERS) {
+        count = BCACHE_MIN_BUFFERS;
+    }
+    if (count > BCACHE_MAX_BUFFERS) {
+        count = BCACHE_MAX_BUFFERS;
+    }
+    uint32_t hash_size = 1;
+    while (hash_size < count) {
+        hash_size <<= 1;
+    }
+
+    buffers = kzalloc(count * sizeof(struct bcache_buf));
+    struct bcache_buf** table = kzalloc(hash_size * sizeof(struct bcache_buf*));
+    sync_list = kmalloc(count * sizeof(struct bcache_buf*));
+    staging = kmalloc(STAGING_BLOCKS * BLOCKDEV_BLOCK_SIZE);
+    uint8_t* data = kmalloc(count * BLOCKDEV_BLOCK_SIZE);
+    if (!buffers || !table || !sync_list || !staging || !data) {
+        return -1;
+    }
+    hash_table = table;
+    hash_mask = hash_size - 1;
+    buffer_count = count;
+
+    for (uint32_t i = 0; i < buffer_count; i++) {
+        buffers[i].data = data + i * BLOCKDEV_BLOCK_SIZE;
+        lru_push_back(&buffers[i]);
+    }
+    stats.buffers = buffer_count;
+    return 0;
+}
+
+static struct bcache_buf* lookup_pinned(struct block_device* dev, uint32_t block) {
+    struct bcache_buf* buf = hash_find(dev, block);
+    if (buf) {
+        buf->refcount++;
+        stats.hits++;
+        if (buf->prefetched) {
+            buf->prefetched = 0;
+            stats.readahead_hits++;
+        }
+    }
+    return buf;
+}
+
+// Pin a block with its current contents, reading it (and any read-ahead
+// window) from the device on a miss. Returns null on an I/O error.
+struct bcache_buf* bcache_read(struct block_device* dev, uint32_t block) {
+    if (dev == ra_dev && block == ra_next) {
+        ra_window = ra_window ? ra_window * 2 : 4;
+        if (ra_window > BCACHE_READAHEAD_MAX) {
+            ra_window = BCACHE_READAHEAD_MAX;
+        }
+    } else {
+        ra_window = 0;
+    }
+    ra_dev = dev;
+    ra_next = block + 1;
+
+    struct bcache_buf* buf = lookup_pinned(dev, block);
+    if (buf) {
+        return buf;
+    }
+    stats.misses++;
+
+    // Claim buffers for the block and the uncached blocks that follow it
+    struct bcache_buf* run[BCACHE_READAHEAD_MAX + 1];
+    uint32_t count = 0;
+    while (count <= ra_window && block + count < dev->block_count &&
+           (count == 0 || !hash_find(dev, block + count))) {
+        run[count] = take_victim();
+        if (!run[count]) {
+            break;
+        }
+        attach(run[count], dev, block + count);
+        count++;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    int result = count == 1 ? blockdev_read(dev, block, 1, run[0]->data)
+                            : blockdev_read(dev, block, count, staging);
+    for (uint32_t i = 0; i < count; i++) {
+        if (result != 0) {
+            discard(run[i]);
+            continue;
+        }
+        if (count > 1) {
+            memcpy(run[i]->data, staging + i * BLOCKDEV_BLOCK_SIZE, BLOCKDEV_BLOCK_SIZE);
+        }
+        lru_unlink(run[i]);
+        lru_push_front(run[i]);
+        if (i > 0) {
+            run[i]->refcount = 0;
+            run[i]->prefetched = 1;
+        }
+    }
+    if (result != 0) {
+        return 0;
+    }
+    stats.readahead_blocks += count - 1;
+    ra_next = block + count;
+    return run[0];
+}
+
+// Pin a block the caller will overwrite completely; a block that is not
+// cached is not read first, so its contents are undefined until written
+struct bcache_buf* bcache_get(struct block_device* dev, uint32_t block) {
+    struct bcache_buf* buf = lookup_pinned(dev, block);
+    if (buf) {
+        return buf;
+    }
+    buf = take_victim();
+    if (buf) {
+        attach(buf, dev, block);
+    }
+    return buf;
+}
+
+void bcache_mark_dirty(struct bcache_buf* buf) {
+    buf->dirty = 1;
+}
+
+void bcache_hold(struct bcache_buf* buf) {
+    buf->dirty = 1;
+    buf->held = 1;
+}
+
+// The journal has the buffer's contents; it may now be written back as usual
+void bcache_unhold(struct bcache_buf* buf) {
+    buf->held = 0;
+}
+
+void bcache_release(struct bcache_buf* buf) {
+    if (--buf->refcount == 0) {
+        lru_unlink(buf);
+        lru_push_front(buf);
+    }
+}
+
+// Forget cached copies of blocks whose contents no longer matter, so freed
+// blocks are never written back
+void bcache_invalidate(struct block_device* dev, uint32_t block, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        struct bcache_buf* buf = hash_find(dev, block + i);
+        if (buf && !buf->refcount) {
+            discard(buf);
+        }
+    }
+}
+
+// Write every dirty block of a device in block order, except held ones;
+// returns blocks written
+int bcache_sync(struct block_device* dev) {
+    uint32_t dirty = 0;
+    for (uint32_t i = 0; i < buffer_count; i++) {
+        if (buffers[i].dev == dev && buffers[i].dirty && !buffers[i].held) {
+            sync_list[dirty++] = &buffers[i];
+        }
+    }
+
+    // Shell sort by block number
+    for (uint32_t gap = dirty / 2; gap > 0; gap /= 2) {
+        for (uint32_t i = gap; i < dirty; i++) {
+            struct bcache_buf* buf = sync_list[i];
+            uint32_t j = i;
+            while (j >= gap && sync_list[j - gap]->block > buf->block) {
+                sync_list[j] = sync_list[j - gap];
+                j -= gap;
+            }
+            sync_list[j] = buf;
+        }
+    }
+
+    uint32_t written = 0;
+    uint32_t i = 0;
+    while (i < dirty) {
+        uint32_t run = 1;
+        while (i + run < dirty && run < BCACHE_WRITE_RUN_MAX &&
+               sync_list[i + run]->block == sync_list[i]->block + run) {
+            run++;
+        }
+
+        int result;
+        if (run == 1) {
+            result = blockdev_write(dev, sync_list[i]->block, 1, sync_list[i]->data);
+        } else {
+            for (uint32_t j = 0; j < run; j++) {
+                memcpy(staging + j * BLOCKDEV_BLOCK_SIZE, sync_list[i + j]->data, BLOCKDEV_BLOCK_SIZE);
+            }
+            result = blockdev_write(dev, sync_list[i]->block, run, staging);
+        }
+        if (result != 0) {
+            return -1;
+        }
+        for (uint32_t j = 0; j < run; j++) {
+            sync_list[i + j]->dirty = 0;
+        }
+        written += run;
+        i += run;
+    }
+    stats.writebacks += written;
+    return (int)written;
+}
+
+void bcache_get_stats(struct bcache_stats* out) {
+    stats.cached = 0;
+    stats.dirty = 0;
+    stats.held = 0;
+    for (uint32_t i = 0; i < buffer_count; i++) {
+        if (buffers[i].dev) {
+            stats.cached++;
+            stats.dirty += buffers[i].dirty;
+            stats.held += buffers[i].held;
+        }
+    }
+    *out = stats;
+}
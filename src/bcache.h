@@ -0,0 +1,55 @@
+// bcache.h - Buffer cache for block devices
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include "blockdev.h"
+
+// Cache size is scaled from free memory at boot
+#define BCACHE_MIN_BUFFERS 64
+#define BCACHE_MAX_BUFFERS 2048
+
+// Blocks fetched ahead of a sequential reader, and the largest write-back run
+#define BCACHE_READAHEAD_MAX 32
+#define BCACHE_WRITE_RUN_MAX 64
+
+struct bcache_buf {
+    struct block_device* dev;   // Null while the buffer holds nothing
+    uint32_t block;
+    uint8_t* data;
+    uint16_t refcount;          // Pinned buffers are never evicted
+    uint8_t dirty;
+    uint8_t prefetched;         // Filled by read-ahead and not yet used
+    uint8_t held;               // Dirty, but may only reach the device through
+                                // a journal: never evicted or written back
+    struct bcache_buf* hash_next;
+    struct bcache_buf* lru_prev;    // Most recently released at the head
+    struct bcache_buf* lru_next;
+};
+
+struct bcache_stats {
+    uint32_t buffers;
+    uint32_t cached;
+    uint32_t dirty;
+    uint32_t held;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readahead_blocks;  // Blocks prefetched
+    uint32_t readahead_hits;    // Prefetched blocks later read
+    uint32_t evictions;
+    uint32_t writebacks;        // Blocks written to their device
+};
+
+// Function prototypes
+int bcache_init(void);
+struct bcache_buf* bcache_read(struct block_device* dev, uint32_t block);
+struct bcache_buf* bcache_get(struct block_device* dev, uint32_t block);
+void bcache_mark_dirty(struct bcache_buf* buf);
+void bcache_hold(struct bcache_buf* buf);
+void bcache_unhold(struct bcache_buf* buf);
+void bcache_release(struct bcache_buf* buf);
+void bcache_invalidate(struct block_device* dev, uint32_t block, uint32_t count);
+int bcache_sync(struct block_device* dev);
+void bcache_get_stats(struct bcache_stats* stats);
+
+#endif
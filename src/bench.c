@@ -0,0 +1,454 @@
+// bench.c - Boot timestamps and the benchmark boot mode
+//
+// kmain() stamps the TSC after each subsystem comes up. With "bench" on the
+// kernel command line it then runs a fixed suite of console, memory, file
+// system and multiprocessor workloads instead of the shell, prints one "bench <name> <value> <unit>"
+// line per result on COM1, and leaves through QEMU's isa-debug-exit device.
+// Workloads run with the console mirror off and screen updates batched, so
+// the numbers are not bounded by the serial line.
+#include "bench.h"
+#include "vga.h"
+#include "serial.h"
+#include "io.h"
+#include "timer.h"
+#include "kheap.h"
+#include "kprintf.h"
+#include "math64.h"
+#include "klib.h"
+#include "filesystem.h"
+#include "shell.h"
+#include "smp.h"
+#include "sched.h"
+
+#define CONSOLE_LINES 2000
+#define FS_FILES 500
+#define FS_FILE_SIZE 512
+#define FS_DEPTH 50
+#define FS_BIG_SIZE (1024 * 1024)
+#define FS_CHUNK 4096
+#define KLIB_BYTES (1024 * 1024)    // Moved per memory measurement
+#define KLIB_MAX_SIZE 65536
+#define SMP_BYTES (2 * 1024 * 1024)
+#define SMP_CHUNK (32 * 1024)          // Bytes hashed per task
+#define SMP_ROUNDS 8                    // Passes per chunk, to stay compute-bound
+
+struct memory_impl {
+    const char* name;
+    void (*copy)(void* dest, const void* src, size_t size);
+    void (*fill)(void* ptr, int value, size_t size);
+    size_t (*length)(const char* str);
+    int (*compare)(const char* a, const char* b);
+};
+
+// The last one is only measured when the CPU has SSE2
+static const struct memory_impl memory_impls[] = {
+    {"bytes", memcpy_bytes, memset_bytes, strlen_bytes, strcmp_bytes},
+    {"words", memcpy_words, memset_words, strlen_words, strcmp_words},
+    {"sse2", memcpy_sse2, memset_sse2, strlen_sse2, strcmp_sse2},
+};
+
+static const uint32_t memory_sizes[] = {16, 64, 256, 1024, 4096, KLIB_MAX_SIZE};
+static const uint32_t string_lengths[] = {8, 31, 255};
+
+struct hash_job {
+    const uint32_t* words;
+    uint32_t count;
+    uint32_t hash;
+};
+
+struct stamp {
+    const char* stage;
+    uint64_t tsc;
+};
+
+static int enabled;
+static struct stamp stamps[BENCH_MAX_STAMPS];
+static uint32_t stamp_count;
+static int failures;
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Whether word appears on the command line on its own
+static int has_word(const char* line, const char* word) {
+    while (*line) {
+        while (is_space(*line)) {
+            line++;
+        }
+        const char* w = word;
+        while (*w && *line == *w) {
+            line++;
+            w++;
+        }
+        if (*w == '\0' && (*line == '\0' || is_space(*line))) {
+            return 1;
+        }
+        while (*line && !is_space(*line)) {
+            line++;
+        }
+    }
+    return 0;
+}
+
+void bench_init(uint32_t magic, struct multiboot_info* mbi) {
+    enabled = magic == MULTIBOOT_BOOTLOADER_MAGIC && (mbi->flags & MULTIBOOT_INFO_CMDLINE) &&
+              has_word((const char*)mbi->cmdline, "bench");
+}
+
+int bench_enabled(void) {
+    return enabled;
+}
+
+// Note that stage has just finished; cheap enough to do on every boot
+void bench_stamp(const char* stage) {
+    if (stamp_count < BENCH_MAX_STAMPS) {
+        stamps[stamp_count].stage = stage;
+        stamps[stamp_count].tsc = rdtsc();
+        stamp_count++;
+    }
+}
+
+static void report(const char* name, uint64_t value, const char* unit) {
+    char line[96];
+    int length = ksnprintf(line, sizeof(line), "bench %s %llu %s\n", name, value, unit);
+    serial_write(line, (uint32_t)length);
+}
+
+// Operations per second over elapsed nanoseconds; runs longer than four
+// seconds are divided in microseconds to stay within a 32-bit divisor
+static uint64_t rate(uint64_t count, uint64_t elapsed) {
+    if (elapsed == 0) {
+        return 0;
+    }
+    if (elapsed <= 0xFFFFFFFFu) {
+        return div_u64_rem(count * 1000000000ull, (uint32_t)elapsed, 0);
+    }
+    return div_u64_rem(count * 1000000ull, (uint32_t)div_u64_rem(elapsed, 1000, 0), 0);
+}
+
+static uint64_t to_us(uint64_t ns) {
+    return div_u64_rem(ns, 1000, 0);
+}
+
+static void check(int ok, const char* what) {
+    if (!ok) {
+        failures++;
+        report(what, 0, "failed");
+    }
+}
+
+static void mirror(int on) {
+    vga_set_mirror(on && serial_present() ? serial_write : 0);
+}
+
+static void workload_begin(void) {
+    mirror(0);
+    vga_batch_begin();
+}
+
+static void workload_end(void) {
+    vga_batch_end();
+    mirror(1);
+}
+
+static void report_boot(void) {
+    for (uint32_t i = 0; i < stamp_count; i++) {
+        char name[48];
+        ksnprintf(name, sizeof(name), "boot.%s", stamps[i].stage);
+        report(name, to_us(timer_cycles_to_ns(stamps[i].tsc - boot_tsc)), "us");
+    }
+}
+
+static void bench_console(void) {
+    static const char line[] = "The quick brown fox jumps over the lazy dog 0123456789 ABCDEF\n";
+
+    workload_begin();
+    uint64_t start = timer_now_ns();
+    for (int i = 0; i < CONSOLE_LINES; i++) {
+        vga_puts(line);
+    }
+    uint64_t puts_ns = timer_now_ns() - start;
+
+    start = timer_now_ns();
+    for (int i = 0; i < CONSOLE_LINES; i++) {
+        vga_printf("%5d %08x %s %u/%u\n", i, i * 2654435761u, "printf", i, CONSOLE_LINES);
+    }
+    uint64_t printf_ns = timer_now_ns() - start;
+    workload_end();
+
+    // Unbatched, every line reaches video memory before the next
+    mirror(0);
+    start = timer_now_ns();
+    for (int i = 0; i < CONSOLE_LINES; i++) {
+        vga_puts(line);
+    }
+    uint64_t flush_ns = timer_now_ns() - start;
+    mirror(1);
+
+    report("console.puts", rate(CONSOLE_LINES, puts_ns), "lines/s");
+    report("console.printf", rate(CONSOLE_LINES, printf_ns), "lines/s");
+    report("console.unbatched", rate(CONSOLE_LINES, flush_ns), "lines/s");
+}
+
+// Each klib tier against the others, in MiB/s moved or scanned
+static void bench_memory(void) {
+    uint8_t* src = kmalloc(KLIB_MAX_SIZE);
+    uint8_t* dst = kmalloc(KLIB_MAX_SIZE);
+    if (!src || !dst) {
+        check(0, "klib.memory");
+        kfree(src);
+        kfree(dst);
+        return;
+    }
+    memset(src, 'a', KLIB_MAX_SIZE);
+    uint32_t impls = klib_sse_enabled() ? 3 : 2;
+    char name[48];
+
+    for (uint32_t s = 0; s < sizeof(memory_sizes) / sizeof(memory_sizes[0]); s++) {
+        uint32_t size = memory_sizes[s];
+        for (uint32_t i = 0; i < impls; i++) {
+            const struct memory_impl* impl = &memory_impls[i];
+            uint64_t start = timer_now_ns();
+            for (uint32_t done = 0; done < KLIB_BYTES; done += size) {
+                impl->copy(dst, src, size);
+            }
+            uint64_t copy_ns = timer_now_ns() - start;
+
+            start = timer_now_ns();
+            for (uint32_t done = 0; done < KLIB_BYTES; done += size) {
+                impl->fill(dst, 0, size);
+            }
+            uint64_t fill_ns = timer_now_ns() - start;
+
+            ksnprintf(name, sizeof(name), "klib.memcpy.%s.%u", impl->name, size);
+            report(name, rate(KLIB_BYTES, copy_ns) >> 20, "MiB/s");
+            ksnprintf(name, sizeof(name), "klib.memset.%s.%u", impl->name, size);
+            report(name, rate(KLIB_BYTES, fill_ns) >> 20, "MiB/s");
+        }
+    }
+
+    // Two equal strings, so strcmp has to reach the end
+    for (uint32_t s = 0; s < sizeof(string_lengths) / sizeof(string_lengths[0]); s++) {
+        uint32_t length = string_lengths[s];
+        char* a = (char*)src;
+        char* b = (char*)dst;
+        memset(a, 'a', length);
+        memset(b, 'a', length);
+        a[length] = '\0';
+        b[length] = '\0';
+
+        for (uint32_t i = 0; i < impls; i++) {
+            const struct memory_impl* impl = &memory_impls[i];
+            uint64_t start = timer_now_ns();
+            for (uint32_t done = 0; done < KLIB_BYTES; done += length) {
+                check(impl->length(a) == length, "klib.strlen");
+            }
+            uint64_t length_ns = timer_now_ns() - start;
+            ksnprintf(name, sizeof(name), "klib.strlen.%s.%u", impl->name, length);
+            report(name, rate(KLIB_BYTES, length_ns) >> 20, "MiB/s");
+
+            start = timer_now_ns();
+            for (uint32_t done = 0; done < KLIB_BYTES; done += length) {
+                check(impl->compare(a, b) == 0, "klib.strcmp");
+            }
+            uint64_t compare_ns = timer_now_ns() - start;
+            ksnprintf(name, sizeof(name), "klib.strcmp.%s.%u", impl->name, length);
+            report(name, rate(KLIB_BYTES, compare_ns) >> 20, "MiB/s");
+        }
+    }
+
+    kfree(src);
+    kfree(dst);
+}
+
+// FNV-1a over a chunk, repeated so the work is mostly arithmetic
+static void hash_chunk(void* arg) {
+    struct hash_job* job = (struct hash_job*)arg;
+    uint32_t hash = 2166136261u;
+    for (uint32_t round = 0; round < SMP_ROUNDS; round++) {
+        for (uint32_t i = 0; i < job->count; i++) {
+            hash = (hash ^ job->words[i]) * 16777619u;
+        }
+    }
+    job->hash = hash;
+}
+
+static uint32_t combine_hashes(struct hash_job* jobs, uint32_t count) {
+    uint32_t hash = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        hash = hash * 31 + jobs[i].hash;
+        jobs[i].hash = 0;
+    }
+    return hash;
+}
+
+// The same chunks hashed on this CPU alone, then as tasks on every CPU
+static void bench_smp(void) {
+    uint32_t chunks = SMP_BYTES / SMP_CHUNK;
+    uint32_t* data = kmalloc(SMP_BYTES);
+    struct hash_job* jobs = kmalloc(chunks * sizeof(struct hash_job));
+    if (!data || !jobs) {
+        check(0, "smp.memory");
+        kfree(data);
+        kfree(jobs);
+        return;
+    }
+    for (uint32_t i = 0; i < SMP_BYTES / 4; i++) {
+        data[i] = i * 2654435761u;
+    }
+    for (uint32_t i = 0; i < chunks; i++) {
+        jobs[i].words = data + i * (SMP_CHUNK / 4);
+        jobs[i].count = SMP_CHUNK / 4;
+        jobs[i].hash = 0;
+    }
+
+    uint64_t start = timer_now_ns();
+    for (uint32_t i = 0; i < chunks; i++) {
+        hash_chunk(&jobs[i]);
+    }
+    uint64_t serial_ns = timer_now_ns() - start;
+    uint32_t serial = combine_hashes(jobs, chunks);
+
+    struct task_group group = {0};
+    start = timer_now_ns();
+    for (uint32_t i = 0; i < chunks; i++) {
+        sched_spawn(&group, hash_chunk, &jobs[i]);
+    }
+    sched_wait(&group);
+    uint64_t parallel_ns = timer_now_ns() - start;
+    check(combine_hashes(jobs, chunks) == serial, "smp.hash");
+
+    report("smp.cpus", smp_cpu_count(), "cpus");
+    report("smp.hash.serial", rate((uint64_t)SMP_BYTES * SMP_ROUNDS, serial_ns) >> 20, "MiB/s");
+    report("smp.hash.parallel", rate((uint64_t)SMP_BYTES * SMP_ROUNDS, parallel_ns) >> 20, "MiB/s");
+    kfree(data);
+    kfree(jobs);
+}
+
+static void bench_files(void) {
+    char* data = kmalloc(FS_CHUNK);
+    char* buffer = kmalloc(FS_CHUNK + 1);
+    if (!data || !buffer) {
+        check(0, "fs.memory");
+        kfree(data);
+        kfree(buffer);
+        return;
+    }
+    for (int i = 0; i < FS_CHUNK; i++) {
+        data[i] = (char)('a' + i % 26);
+    }
+
+    char name[MAX_FILENAME_LENGTH];
+    uint64_t elapsed[5];
+    int ok = 1;
+    workload_begin();
+    fs_create_directory("/bench");
+    fs_change_directory("/bench");
+    uint64_t start = timer_now_ns();
+    for (int i = 0; i < FS_FILES; i++) {
+        ksnprintf(name, sizeof(name), "f%d", i);
+        ok &= fs_create_file(name) == 0;
+    }
+    elapsed[0] = timer_now_ns() - start;
+
+    start = timer_now_ns();
+    for (int i = 0; i < FS_FILES; i++) {
+        ksnprintf(name, sizeof(name), "f%d", i);
+        ok &= fs_write_file(name, data, FS_FILE_SIZE) == 0;
+    }
+    elapsed[1] = timer_now_ns() - start;
+
+    start = timer_now_ns();
+    for (int i = 0; i < FS_FILES; i++) {
+        ksnprintf(name, sizeof(name), "f%d", i);
+        ok &= fs_read_file(name, buffer, FS_CHUNK + 1) == FS_FILE_SIZE;
+    }
+    elapsed[2] = timer_now_ns() - start;
+
+    start = timer_now_ns();
+    for (int i = 0; i < FS_FILES; i++) {
+        ksnprintf(name, sizeof(name), "f%d", i);
+        ok &= fs_delete_file(name) == 0;
+    }
+    elapsed[3] = timer_now_ns() - start;
+
+    start = timer_now_ns();
+    for (int i = 0; i < FS_DEPTH; i++) {
+        ok &= fs_create_directory("d") == 0 && fs_change_directory("d") == 0;
+    }
+    for (int i = 0; i < FS_DEPTH; i++) {
+        ok &= fs_change_directory("..") == 0 && fs_remove_directory("d") == 0;
+    }
+    elapsed[4] = timer_now_ns() - start;
+    workload_end();
+    check(ok, "fs.small");
+
+    report("fs.create", rate(FS_FILES, elapsed[0]), "ops/s");
+    report("fs.write", rate(FS_FILES, elapsed[1]), "ops/s");
+    report("fs.read", rate(FS_FILES, elapsed[2]), "ops/s");
+    report("fs.delete", rate(FS_FILES, elapsed[3]), "ops/s");
+    report("fs.mkdir_cd_rmdir", rate(FS_DEPTH * 4, elapsed[4]), "ops/s");
+
+    // One large file written and read back through a descriptor
+    ok = 1;
+    workload_begin();
+    start = timer_now_ns();
+    int fd = fs_open("big", FS_O_WRONLY | FS_O_CREAT | FS_O_TRUNC);
+    ok &= fd >= 0;
+    for (int done = 0; ok && done < FS_BIG_SIZE; done += FS_CHUNK) {
+        ok &= fs_write(fd, data, FS_CHUNK) == FS_CHUNK;
+    }
+    fs_close(fd);
+    uint64_t write_ns = timer_now_ns() - start;
+
+    start = timer_now_ns();
+    ok &= fs_commit() >= 0 && fs_sync() >= 0;
+    uint64_t sync_ns = timer_now_ns() - start;
+
+    start = timer_now_ns();
+    fd = fs_open("big", FS_O_RDONLY);
+    ok &= fd >= 0;
+    for (int done = 0; ok && done < FS_BIG_SIZE; done += FS_CHUNK) {
+        ok &= fs_read(fd, buffer, FS_CHUNK) == FS_CHUNK;
+    }
+    fs_close(fd);
+    uint64_t read_ns = timer_now_ns() - start;
+    ok &= fs_delete_file("big") == 0;
+    fs_change_directory("/");
+    ok &= fs_remove_directory("/bench") == 0;
+    ok &= fs_commit() >= 0 && fs_sync() >= 0;
+    workload_end();
+    check(ok, "fs.big");
+
+    report("fs.big_write", rate(FS_BIG_SIZE / 1024, write_ns), "KiB/s");
+    report("fs.sync", to_us(sync_ns), "us");
+    report("fs.big_read", rate(FS_BIG_SIZE / 1024, read_ns), "KiB/s");
+
+    kfree(data);
+    kfree(buffer);
+}
+
+// Run the suite in place of the shell, report and power off. Does not return.
+void bench_run(void) {
+    // The point where the shell would first wait for input
+    fs_commit();
+    shell_prompt();
+    bench_stamp("prompt");
+
+    report_boot();
+    report("boot.tsc_khz", timer_tsc_khz(), "kHz");
+    bench_console();
+    bench_memory();
+    bench_smp();
+    bench_files();
+    report("done", failures, "failures");
+
+    serial_flush();
+    outl(BENCH_EXIT_PORT, failures ? 1 : 0);
+
+    // No exit device: stay here with the results on screen
+    for (;;) {
+        cpu_idle();
+    }
+}
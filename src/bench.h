@@ -0,0 +1,23 @@
+// bench.h - Boot timestamps and the benchmark boot mode
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include "multiboot.h"
+
+// Most boot stages bench_stamp() records
+#define BENCH_MAX_STAMPS 32
+
+// QEMU's isa-debug-exit device; writing v makes QEMU exit with (v << 1) | 1
+#define BENCH_EXIT_PORT 0xF4
+
+// TSC when _start ran, saved by boot.S
+extern uint64_t boot_tsc;
+
+// Function prototypes
+void bench_init(uint32_t magic, struct multiboot_info* mbi);
+int bench_enabled(void);
+void bench_stamp(const char* stage);
+void bench_run(void);
+
+#endif
@@ -0,0 +1,133 @@
+// blockdev.c - Block device dispatch, ramdisk backend and ATA adapter
+#include "blockdev.h"
+#include "kheap.h"
+#include "ata.h"
+#include "klib.h"
+
+// Bounds are checked once here so backends can trust their arguments
+static int in_range(struct block_device* dev, uint32_t block, uint32_t count) {
+    return block < dev->block_count && count <= dev->block_count - block;
+}
+
+int blockdev_read(struct block_device* dev, uint32_t block, uint32_t count, void* buffer) {
+    if (!in_range(dev, block, count)) {
+        return -1;
+    }
+    return count ? dev->read(dev, block, count, buffer) : 0;
+}
+
+int blockdev_write(struct block_device* dev, uint32_t block, uint32_t count, const void* buffer) {
+    if (!in_range(dev, block, count)) {
+        return -1;
+    }
+    return count ? dev->write(dev, block, count, buffer) : 0;
+}
+
+int blockdev_flush(struct block_device* dev) {
+    return dev->flush ? dev->flush(dev) : 0;
+}
+
+static int ramdisk_read(struct block_device* dev, uint32_t block, uint32_t count, void* buffer) {
+    struct ramdisk* disk = (struct ramdisk*)dev->private_data;
+    uint8_t* out = (uint8_t*)buffer;
+    for (uint32_t i = 0; i < count; i++, out += BLOCKDEV_BLOCK_SIZE) {
+        uint8_t* page = disk->pages[(block + i) / RAMDISK_BLOCKS_PER_PAGE];
+        if (!page) {
+            for (uint32_t j = 0; j < BLOCKDEV_BLOCK_SIZE; j++) {
+                out[j] = 0;
+            }
+            continue;
+        }
+        memcpy(out, page + (block + i) % RAMDISK_BLOCKS_PER_PAGE * BLOCKDEV_BLOCK_SIZE,
+                   BLOCKDEV_BLOCK_SIZE);
+    }
+    return 0;
+}
+
+static int ramdisk_write(struct block_device* dev, uint32_t block, uint32_t count, const void* buffer) {
+    struct ramdisk* disk = (struct ramdisk*)dev->private_data;
+    const uint8_t* in = (const uint8_t*)buffer;
+    for (uint32_t i = 0; i < count; i++, in += BLOCKDEV_BLOCK_SIZE) {
+        uint8_t** page = &disk->pages[(block + i) / RAMDISK_BLOCKS_PER_PAGE];
+        if (!*page) {
+            *page = kzalloc(RAMDISK_BLOCKS_PER_PAGE * BLOCKDEV_BLOCK_SIZE);
+            if (!*page) {
+                return -1;
+            }
+            disk->pages_allocated++;
+        }
+        memcpy(*page + (block + i) % RAMDISK_BLOCKS_PER_PAGE * BLOCKDEV_BLOCK_SIZE, in,
+                   BLOCKDEV_BLOCK_SIZE);
+    }
+    return 0;
+}
+
+struct block_device* ramdisk_create(uint32_t block_count) {
+    struct block_device* dev = kzalloc(sizeof(struct block_device));
+    struct ramdisk* disk = kzalloc(sizeof(struct ramdisk));
+    if (!dev || !disk) {
+        kfree(dev);
+        kfree(disk);
+        return 0;
+    }
+    disk->page_count = (block_count + RAMDISK_BLOCKS_PER_PAGE - 1) / RAMDISK_BLOCKS_PER_PAGE;
+    disk->pages = kzalloc(disk->page_count * sizeof(uint8_t*));
+    if (!disk->pages) {
+        kfree(dev);
+        kfree(disk);
+        return 0;
+    }
+
+    dev->name = "ramdisk";
+    dev->block_count = block_count;
+    dev->read = ramdisk_read;
+    dev->write = ramdisk_write;
+    dev->private_data = disk;
+    return dev;
+}
+
+void ramdisk_destroy(struct block_device* dev) {
+    struct ramdisk* disk = (struct ramdisk*)dev->private_data;
+    for (uint32_t i = 0; i < disk->page_count; i++) {
+        kfree(disk->pages[i]);
+    }
+    kfree(disk->pages);
+    kfree(disk);
+    kfree(dev);
+}
+
+uint32_t ramdisk_memory_used(struct block_device* dev) {
+    struct ramdisk* disk = (struct ramdisk*)dev->private_data;
+    return disk->pages_allocated * RAMDISK_BLOCKS_PER_PAGE * BLOCKDEV_BLOCK_SIZE;
+}
+
+static int ata_dev_read(struct block_device* dev, uint32_t block, uint32_t count, void* buffer) {
+    (void)dev;
+    return ata_read(block, count, buffer);
+}
+
+static int ata_dev_write(struct block_device* dev, uint32_t block, uint32_t count, const void* buffer) {
+    (void)dev;
+    return ata_write(block, count, buffer);
+}
+
+static int ata_dev_flush(struct block_device* dev) {
+    (void)dev;
+    return ata_flush();
+}
+
+static struct block_device ata_device = {
+    .name = "ata0",
+    .read = ata_dev_read,
+    .write = ata_dev_write,
+    .flush = ata_dev_flush,
+};
+
+// The primary ATA disk, or null if none was found
+struct block_device* ata_block_device(void) {
+    if (!ata_present()) {
+        return 0;
+    }
+    ata_device.block_count = ata_sector_count();
+    return &ata_device;
+}
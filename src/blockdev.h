@@ -0,0 +1,39 @@
+// blockdev.h - Block device interface with ramdisk and ATA backends
+#ifndef BLOCKDEV_H
+#define BLOCKDEV_H
+
+#include <stdint.h>
+
+#define BLOCKDEV_BLOCK_SIZE 512
+
+// A backend moves whole blocks; callers go through the buffer cache
+struct block_device {
+    const char* name;
+    uint32_t block_count;
+    int (*read)(struct block_device* dev, uint32_t block, uint32_t count, void* buffer);
+    int (*write)(struct block_device* dev, uint32_t block, uint32_t count, const void* buffer);
+    int (*flush)(struct block_device* dev);
+    void* private_data;
+};
+
+// Ramdisk memory is allocated a page at a time on first write; blocks that
+// were never written read back as zeros
+#define RAMDISK_BLOCKS_PER_PAGE (4096 / BLOCKDEV_BLOCK_SIZE)
+
+struct ramdisk {
+    uint8_t** pages;
+    uint32_t page_count;
+    uint32_t pages_allocated;
+};
+
+// Function prototypes
+struct block_device* ramdisk_create(uint32_t block_count);
+void ramdisk_destroy(struct block_device* dev);
+uint32_t ramdisk_memory_used(struct block_device* dev);
+struct block_device* ata_block_device(void);
+
+int blockdev_read(struct block_device* dev, uint32_t block, uint32_t count, void* buffer);
+int blockdev_write(struct block_device* dev, uint32_t block, uint32_t count, const void* buffer);
+int blockdev_flush(struct block_device* dev);
+
+#endif
@@ -0,0 +1,253 @@
+// extent.c - Free-space allocator for runs of fixed-size blocks
+//
+// Free space is a set of maximal free extents. Each extent is on the list
+// for its size class (floor(log2(length))), and the blocks at both of its
+// ends point back to it, so a freed run merges with free neighbours in O(1).
+// Allocation is first fit within the smallest class that can satisfy the
+// request, falling back to any larger non-empty class via class_mask.
+#include "extent.h"
+#include "kheap.h"
+
+static int length_class(uint32_t length) {
+    return 31 - __builtin_clz(length);
+}
+
+static void class_insert(struct extent_allocator* alloc, int32_t node) {
+    int cls = length_class(alloc->nodes[node].length);
+    alloc->nodes[node].prev = -1;
+    alloc->nodes[node].next = alloc->class_heads[cls];
+    if (alloc->class_heads[cls] >= 0) {
+        alloc->nodes[alloc->class_heads[cls]].prev = node;
+    }
+    alloc->class_heads[cls] = node;
+    alloc->class_mask |= 1u << cls;
+}
+
+static void class_remove(struct extent_allocator* alloc, int32_t node) {
+    int cls = length_class(alloc->nodes[node].length);
+    struct extent_node* n = &alloc->nodes[node];
+    if (n->prev >= 0) {
+        alloc->nodes[n->prev].next = n->next;
+    } else {
+        alloc->class_heads[cls] = n->next;
+        if (n->next < 0) {
+            alloc->class_mask &= ~(1u << cls);
+        }
+    }
+    if (n->next >= 0) {
+        alloc->nodes[n->next].prev = n->prev;
+    }
+}
+
+// Add a free extent that is known not to touch any other free extent
+static void insert_extent(struct extent_allocator* alloc, uint32_t start, uint32_t length) {
+    int32_t node = alloc->free_node;
+    alloc->free_node = alloc->nodes[node].next;
+
+    alloc->nodes[node].start = start;
+    alloc->nodes[node].length = length;
+    alloc->head_of[start] = node;
+    alloc->tail_of[start + length - 1] = node;
+    class_insert(alloc, node);
+    alloc->free_extents++;
+}
+
+static void remove_extent(struct extent_allocator* alloc, int32_t node) {
+    struct extent_node* n = &alloc->nodes[node];
+    class_remove(alloc, node);
+    alloc->head_of[n->start] = -1;
+    alloc->tail_of[n->start + n->length - 1] = -1;
+    n->next = alloc->free_node;
+    alloc->free_node = node;
+    alloc->free_extents--;
+}
+
+int extent_init(struct extent_allocator* alloc, uint32_t total_blocks, int initially_free) {
+    alloc->total_blocks = total_blocks;
+    alloc->free_blocks = 0;
+    alloc->free_extents = 0;
+    alloc->class_mask = 0;
+    for (int i = 0; i < EXTENT_CLASSES; i++) {
+        alloc->class_heads[i] = -1;
+    }
+
+    // Free extents are separated by used blocks, so there are at most
+    // ceil(total / 2) of them
+    uint32_t node_count = total_blocks / 2 + 1;
+    alloc->head_of = kmalloc(total_blocks * sizeof(int32_t));
+    alloc->tail_of = kmalloc(total_blocks * sizeof(int32_t));
+    alloc->nodes = kmalloc(node_count * sizeof(struct extent_node));
+    if (!alloc->head_of || !alloc->tail_of || !alloc->nodes) {
+        extent_destroy(alloc);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < total_blocks; i++) {
+        alloc->head_of[i] = -1;
+        alloc->tail_of[i] = -1;
+    }
+    for (uint32_t i = 0; i < node_count; i++) {
+        alloc->nodes[i].next = (i + 1 < node_count) ? (int32_t)(i + 1) : -1;
+    }
+    alloc->free_node = 0;
+
+    if (initially_free && total_blocks > 0) {
+        insert_extent(alloc, 0, total_blocks);
+        alloc->free_blocks = total_blocks;
+    }
+    return 0;
+}
+
+void extent_destroy(struct extent_allocator* alloc) {
+    kfree(alloc->head_of);
+    kfree(alloc->tail_of);
+    kfree(alloc->nodes);
+    alloc->head_of = 0;
+    alloc->tail_of = 0;
+    alloc->nodes = 0;
+    alloc->total_blocks = 0;
+    alloc->free_blocks = 0;
+}
+
+// Find a free run of count blocks; returns 0 and the first block on success
+int extent_alloc(struct extent_allocator* alloc, uint32_t count, uint32_t* start) {
+    if (count == 0 || count > alloc->free_blocks) {
+        return -1;
+    }
+
+    // Extents in the request's own class may be too short, so scan it
+    int cls = length_class(count);
+    int32_t found = -1;
+    for (int32_t node = alloc->class_heads[cls]; node >= 0; node = alloc->nodes[node].next) {
+        if (alloc->nodes[node].length >= count) {
+            found = node;
+            break;
+        }
+    }
+
+    // Any extent from a larger class fits
+    if (found < 0) {
+        uint32_t larger = (cls + 1 < EXTENT_CLASSES) ? alloc->class_mask & ~((2u << cls) - 1) : 0;
+        if (!larger) {
+            return -1;
+        }
+        found = alloc->class_heads[__builtin_ctz(larger)];
+    }
+
+    uint32_t extent_start = alloc->nodes[found].start;
+    uint32_t extent_length = alloc->nodes[found].length;
+    remove_extent(alloc, found);
+    if (extent_length > count) {
+        insert_extent(alloc, extent_start + count, extent_length - count);
+    }
+
+    alloc->free_blocks -= count;
+    *start = extent_start;
+    return 0;
+}
+
+// Like extent_alloc, but when no run of count blocks is free settle for the
+// largest run there is. Returns the number of blocks obtained (0 if none).
+uint32_t extent_alloc_partial(struct extent_allocator* alloc, uint32_t count, uint32_t* start) {
+    if (extent_alloc(alloc, count, start) == 0) {
+        return count;
+    }
+    if (!alloc->class_mask) {
+        return 0;
+    }
+
+    int cls = 31 - __builtin_clz(alloc->class_mask);
+    int32_t best = alloc->class_heads[cls];
+    for (int32_t node = best; node >= 0; node = alloc->nodes[node].next) {
+        if (alloc->nodes[node].length > alloc->nodes[best].length) {
+            best = node;
+        }
+    }
+
+    uint32_t length = alloc->nodes[best].length;
+    *start = alloc->nodes[best].start;
+    remove_extent(alloc, best);
+    alloc->free_blocks -= length;
+    return length;
+}
+
+void extent_free(struct extent_allocator* alloc, uint32_t start, uint32_t count) {
+    if (count == 0 || start + count > alloc->total_blocks) {
+        return;
+    }
+    alloc->free_blocks += count;
+
+    // Merge with a free extent ending just before us
+    if (start > 0 && alloc->tail_of[start - 1] >= 0) {
+        int32_t left = alloc->tail_of[start - 1];
+        uint32_t left_start = alloc->nodes[left].start;
+        count += alloc->nodes[left].length;
+        remove_extent(alloc, left);
+        start = left_start;
+    }
+
+    // ...and with one starting just after us
+    uint32_t end = start + count;
+    if (end < alloc->total_blocks && alloc->head_of[end] >= 0) {
+        int32_t right = alloc->head_of[end];
+        count += alloc->nodes[right].length;
+        remove_extent(alloc, right);
+    }
+
+    insert_extent(alloc, start, count);
+}
+
+// Grow [start, start + count) in place by extra blocks if they are free
+int extent_try_extend(struct extent_allocator* alloc, uint32_t start, uint32_t count, uint32_t extra) {
+    uint32_t end = start + count;
+    if (extra == 0) {
+        return 0;
+    }
+    if (end >= alloc->total_blocks || alloc->head_of[end] < 0) {
+        return -1;
+    }
+
+    int32_t next = alloc->head_of[end];
+    uint32_t next_length = alloc->nodes[next].length;
+    if (next_length < extra) {
+        return -1;
+    }
+
+    remove_extent(alloc, next);
+    if (next_length > extra) {
+        insert_extent(alloc, end + extra, next_length - extra);
+    }
+    alloc->free_blocks -= extra;
+    return 0;
+}
+
+void extent_get_stats(struct extent_allocator* alloc, struct extent_stats* stats) {
+    stats->total_blocks = alloc->total_blocks;
+    stats->free_blocks = alloc->free_blocks;
+    stats->free_extents = alloc->free_extents;
+    stats->largest_free = 0;
+
+    // The largest extent is in the highest non-empty class
+    if (alloc->class_mask) {
+        int cls = 31 - __builtin_clz(alloc->class_mask);
+        for (int32_t node = alloc->class_heads[cls]; node >= 0; node = alloc->nodes[node].next) {
+            if (alloc->nodes[node].length > stats->largest_free) {
+                stats->largest_free = alloc->nodes[node].length;
+            }
+        }
+    }
+}
+
+// The first free extent starting at or after block, for consistency checks;
+// returns -1 past the last one
+int extent_next_free(struct extent_allocator* alloc, uint32_t block, uint32_t* start, uint32_t* length) {
+    for (; block < alloc->total_blocks; block++) {
+        int32_t node = alloc->head_of[block];
+        if (node >= 0) {
+            *start = alloc->nodes[node].start;
+            *length = alloc->nodes[node].length;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,46 @@
+// extent.h - Free-space allocator for runs of fixed-size blocks
+#ifndef EXTENT_H
+#define EXTENT_H
+
+#include <stdint.h>
+
+// One free list per power-of-two length class
+#define EXTENT_CLASSES 32
+
+struct extent_node {
+    uint32_t start;
+    uint32_t length;
+    int32_t next;   // Links within the node's size-class list
+    int32_t prev;
+};
+
+struct extent_allocator {
+    uint32_t total_blocks;
+    uint32_t free_blocks;
+    uint32_t free_extents;
+    uint32_t class_mask;            // Bit n set = class n list is non-empty
+    int32_t class_heads[EXTENT_CLASSES];
+    int32_t* head_of;               // Block -> free extent starting there, or -1
+    int32_t* tail_of;               // Block -> free extent ending there, or -1
+    struct extent_node* nodes;
+    int32_t free_node;              // Unused nodes, chained through next
+};
+
+struct extent_stats {
+    uint32_t total_blocks;
+    uint32_t free_blocks;
+    uint32_t free_extents;
+    uint32_t largest_free;
+};
+
+// Function prototypes
+int extent_init(struct extent_allocator* alloc, uint32_t total_blocks, int initially_free);
+void extent_destroy(struct extent_allocator* alloc);
+int extent_alloc(struct extent_allocator* alloc, uint32_t count, uint32_t* start);
+uint32_t extent_alloc_partial(struct extent_allocator* alloc, uint32_t count, uint32_t* start);
+void extent_free(struct extent_allocator* alloc, uint32_t start, uint32_t count);
+int extent_try_extend(struct extent_allocator* alloc, uint32_t start, uint32_t count, uint32_t extra);
+void extent_get_stats(struct extent_allocator* alloc, struct extent_stats* stats);
+int extent_next_free(struct extent_allocator* alloc, uint32_t block, uint32_t* start, uint32_t* length);
+
+#endif
@@ -1,527 +1,2400 @@
-// filesystem.c - Simple in-memory file system implementation
+// filesystem.c - Simple file system implementation on a cached block device
 #include "filesystem.h"
 #include "vga.h"
+#include "kheap.h"
+#include "paging.h"
+#include "pmm.h"
+#include "blockdev.h"
+#include "bcache.h"
+#include "initrd.h"
+#include "klib.h"
+#include "perf.h"
 
 // Global file system instance
 static struct filesystem fs;
-static uint8_t filesystem_data[FILESYSTEM_MEMORY_SIZE];
 
-// Simple string functions
-static int strcmp(const char* str1, const char* str2) {
-    while (*str1 && (*str1 == *str2)) {
-        str1++;
-        str2++;
+// Active fs_map_file() mappings; the slot is the fill callback's context
+struct fs_mapping {
+    const void* address;
+    int index;
+    struct fs_cursor cursor;
+};
+static struct fs_mapping mappings[FS_MAX_MAPPINGS];
+
+// Open file table; a descriptor is an index into it
+struct open_file {
+    int index;          // Entry, or -1 if the slot is free
+    uint32_t offset;
+    int flags;
+    struct fs_cursor cursor;
+};
+static struct open_file open_files[FS_MAX_OPEN_FILES];
+
+// Recently resolved path components. Slots are checked against the entry's
+// current name and parent, so a stale slot can only miss, never mislead.
+struct dentry {
+    uint32_t hash;
+    int parent;
+    int index;      // -1 if the slot is empty
+};
+static struct dentry dcache[FS_DCACHE_SIZE];
+static uint32_t dcache_hits;
+static uint32_t dcache_misses;
+
+// Forward declarations for helper functions
+static int dir_lookup(int dir_index, const char* name);
+static void add_child_to_directory(int parent_index, int child_index);
+static void remove_child_from_directory(int parent_index, int child_index);
+static void release_file_entry(int index);
+static void end_operation(void);
+
+// In-order walk over one directory's name index
+struct dir_iter {
+    int stack[FS_INDEX_MAX_DEPTH];
+    int depth;
+};
+static int dir_iter_first(struct dir_iter* it, int dir_index);
+static int dir_iter_next(struct dir_iter* it);
+
+// Entry table blocks changed since the last sync
+static void set_bits(uint32_t* map, uint32_t first, uint32_t count) {
+    for (uint32_t bit = first; bit < first + count; bit++) {
+        map[bit / 32] |= 1u << (bit % 32);
+    }
+}
+
+static void mark_entries_dirty(uint32_t first, uint32_t count) {
+    if (!fs.dirty_table || count == 0) {
+        return;
+    }
+    uint32_t first_block = first * sizeof(struct file_entry) / FS_BLOCK_SIZE;
+    uint32_t last_block = ((first + count) * sizeof(struct file_entry) - 1) / FS_BLOCK_SIZE;
+    set_bits(fs.dirty_table, first_block, last_block - first_block + 1);
+}
+
+static void mark_entry_dirty(int index) {
+    mark_entries_dirty(index, 1);
+}
+
+// The table is kept a whole number of blocks long so it can be written as is
+static uint32_t table_bytes(uint32_t capacity) {
+    return (capacity * sizeof(struct file_entry) + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE * FS_BLOCK_SIZE;
+}
+
+static void clear_file_entries(uint32_t first, uint32_t last) {
+    for (uint32_t i = first; i < last; i++) {
+        fs.files[i].used = 0;
+        fs.files[i].size = 0;
+        fs.files[i].block_count = 0;
+        fs.files[i].extent_count = 0;
+        fs.files[i].indirect_block = 0;
+        fs.files[i].is_directory = 0;
+        fs.files[i].parent_index = -1;
+        fs.files[i].tree_height = 0;
+        fs.files[i].open_count = 0;
+        fs.files[i].flags = 0;
+        fs.files[i].child_root_index = -1;
+        fs.files[i].left_index = -1;
+        fs.files[i].right_index = -1;
+        memset(fs.files[i].name, 0, MAX_FILENAME_LENGTH);
+    }
+}
+
+// Resize the entry table to capacity slots. Indices stay valid across growth.
+static int grow_file_table_to(uint32_t capacity) {
+    struct file_entry* files = krealloc(fs.files, table_bytes(capacity));
+    if (!files) {
+        return -1;
+    }
+    fs.files = files;
+    clear_file_entries(fs.entry_capacity, capacity);
+    mark_entries_dirty(fs.entry_capacity, capacity - fs.entry_capacity);
+    
+    // New slots become allocatable
+    for (uint32_t i = fs.entry_capacity; i < capacity; i++) {
+        fs.entry_map[i / 32] &= ~(1u << (i % 32));
+    }
+    if (fs.entry_hint > fs.entry_capacity / 32) {
+        fs.entry_hint = fs.entry_capacity / 32;
+    }
+    fs.entry_capacity = capacity;
+    return 0;
+}
+
+static int grow_file_table(void) {
+    if (fs.entry_capacity >= fs.entry_limit) {
+        return -1;
+    }
+    uint32_t capacity = fs.entry_capacity * 2;
+    if (capacity > fs.entry_limit) {
+        capacity = fs.entry_limit;
+    }
+    return grow_file_table_to(capacity);
+}
+
+static uint32_t clamp_limit(uint32_t value, uint32_t low, uint32_t high) {
+    return value < low ? low : (value > high ? high : value);
+}
+
+// Scale the limits to the memory we booted with
+static void set_memory_limits(void) {
+    struct pmm_stats memory;
+    pmm_get_stats(&memory);
+    fs.entry_limit = clamp_limit(memory.free_frames / 16 * (PAGE_SIZE / sizeof(struct file_entry)),
+                                 FS_MIN_ENTRIES, FS_MAX_ENTRIES);
+    fs.data_blocks = clamp_limit(memory.free_frames / 4 * (PAGE_SIZE / FS_BLOCK_SIZE),
+                                 FS_MIN_DATA_BLOCKS, FS_MAX_DATA_BLOCKS);
+}
+
+// Largest data area whose extent maps fit the memory we booted with
+static uint32_t disk_data_limit(void) {
+    struct pmm_stats memory;
+    pmm_get_stats(&memory);
+    return clamp_limit(memory.free_frames / 8 * (PAGE_SIZE / FS_EXTENT_MAP_BYTES),
+                       FS_MIN_DATA_BLOCKS, FS_MAX_DISK_DATA_BLOCKS);
+}
+
+static uint32_t blocks_for_size(uint32_t size) {
+    return (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+}
+
+// Pin data block n, reading it unless the caller will overwrite all of it
+static struct bcache_buf* data_block(uint32_t block, int overwrite) {
+    uint32_t lba = fs.super.data_start + block;
+    struct bcache_buf* buf = overwrite ? bcache_get(fs.dev, lba) : bcache_read(fs.dev, lba);
+    if (!buf) {
+        vga_printf("Error: I/O error on %s block %u.\n", fs.dev->name, lba);
+    }
+    return buf;
+}
+
+static int journaling(void) {
+    return fs.super.journal_blocks != 0;
+}
+
+static int defer_free(uint32_t start, uint32_t count) {
+    if (fs.deferred_count == fs.deferred_capacity) {
+        uint32_t capacity = fs.deferred_capacity ? fs.deferred_capacity * 2 : 16;
+        struct fs_extent* list = kmalloc(capacity * sizeof(struct fs_extent));
+        if (!list) {
+            return -1;
+        }
+        memcpy(list, fs.deferred_free, fs.deferred_count * sizeof(struct fs_extent));
+        kfree(fs.deferred_free);
+        fs.deferred_free = list;
+        fs.deferred_capacity = capacity;
+    }
+    fs.deferred_free[fs.deferred_count].start_block = start;
+    fs.deferred_free[fs.deferred_count].block_count = count;
+    fs.deferred_count++;
+    return 0;
+}
+
+static void release_deferred_frees(void) {
+    for (uint32_t i = 0; i < fs.deferred_count; i++) {
+        extent_free(&fs.space, fs.deferred_free[i].start_block, fs.deferred_free[i].block_count);
+    }
+    fs.deferred_count = 0;
+}
+
+// Blocks freed since the last commit are only reusable once it is durable,
+// so rather than fail for want of them, commit now. Everything pending goes
+// with it, so operations call this before they start changing anything.
+static void reclaim_deferred_frees(uint32_t blocks) {
+    if (fs.deferred_count && fs.space.free_blocks < blocks) {
+        fs_commit();
+    }
+}
+
+// Freed blocks are dropped from the cache so they are never written back.
+// With a journal they stay allocated until the change is committed, so new
+// data written over them cannot corrupt a file that replay would restore.
+static void free_data_blocks(uint32_t start, uint32_t count) {
+    bcache_invalidate(fs.dev, fs.super.data_start + start, count);
+    for (uint32_t i = 0; i < fs.held_count; ) {
+        if (fs.held_blocks[i] >= start && fs.held_blocks[i] - start < count) {
+            fs.held_blocks[i] = fs.held_blocks[--fs.held_count];
+        } else {
+            i++;
+        }
+    }
+    if (!journaling() || defer_free(start, count) != 0) {
+        extent_free(&fs.space, start, count);
+    }
+}
+
+// An indirect block changed since the last commit is held in the cache
+// until the journal has it. Past FS_HELD_BLOCKS_MAX it is written back
+// like data, which end_operation() commits early to avoid.
+static void mark_indirect_dirty(struct bcache_buf* buf, uint32_t block) {
+    if (!journaling()) {
+        bcache_mark_dirty(buf);
+        return;
+    }
+    for (uint32_t i = 0; i < fs.held_count; i++) {
+        if (fs.held_blocks[i] == block) {
+            bcache_hold(buf);
+            return;
+        }
+    }
+    if (fs.held_count == FS_HELD_BLOCKS_MAX) {
+        bcache_mark_dirty(buf);
+        return;
+    }
+    fs.held_blocks[fs.held_count++] = block;
+    bcache_hold(buf);
+}
+
+// Extent i of a file; those past FS_DIRECT_EXTENTS are in the indirect
+// block, which is read and written through the cache
+static int get_extent(struct file_entry* entry, uint32_t i, struct fs_extent* extent) {
+    if (i < FS_DIRECT_EXTENTS) {
+        *extent = entry->extents[i];
+        return 0;
+    }
+    struct bcache_buf* buf = data_block(entry->indirect_block, 0);
+    if (!buf) {
+        return -1;
+    }
+    *extent = ((struct fs_extent*)buf->data)[i - FS_DIRECT_EXTENTS];
+    bcache_release(buf);
+    return 0;
+}
+
+static int set_extent(struct file_entry* entry, uint32_t i, const struct fs_extent* extent) {
+    if (i < FS_DIRECT_EXTENTS) {
+        entry->extents[i] = *extent;
+        mark_entry_dirty(entry - fs.files);
+        return 0;
+    }
+    struct bcache_buf* buf = data_block(entry->indirect_block, 0);
+    if (!buf) {
+        return -1;
+    }
+    ((struct fs_extent*)buf->data)[i - FS_DIRECT_EXTENTS] = *extent;
+    mark_indirect_dirty(buf, entry->indirect_block);
+    bcache_release(buf);
+    return 0;
+}
+
+// Return blocks from the end of a file until it owns only blocks. If the
+// indirect block cannot be read, the remaining blocks are leaked rather
+// than risk freeing the wrong ones.
+static void shrink_file_blocks(struct file_entry* entry, uint32_t blocks) {
+    if (entry->block_count > blocks) {
+        fs.layout_generation++;
+        mark_entry_dirty(entry - fs.files);
+    }
+    while (entry->block_count > blocks) {
+        struct fs_extent last;
+        if (get_extent(entry, entry->extent_count - 1, &last) != 0) {
+            return;
+        }
+        uint32_t excess = entry->block_count - blocks;
+        if (excess < last.block_count) {
+            last.block_count -= excess;
+            if (set_extent(entry, entry->extent_count - 1, &last) != 0) {
+                return;
+            }
+            free_data_blocks(last.start_block + last.block_count, excess);
+            entry->block_count = blocks;
+            break;
+        }
+        
+        free_data_blocks(last.start_block, last.block_count);
+        entry->block_count -= last.block_count;
+        entry->extent_count--;
+        if (entry->extent_count == FS_DIRECT_EXTENTS) {
+            free_data_blocks(entry->indirect_block, 1);
+            entry->indirect_block = 0;
+        }
+    }
+}
+
+// Give a file at least blocks data blocks without moving existing data.
+// The last extent grows in place when its neighbour is free; otherwise a new
+// extent is added, sized to double the file so that a growing file needs
+// only O(log n) extents. On failure the file is left as it was.
+static int grow_file_blocks(struct file_entry* entry, uint32_t blocks) {
+    uint32_t old_blocks = entry->block_count;
+    
+    while (entry->block_count < blocks) {
+        uint32_t need = blocks - entry->block_count;
+        
+        if (entry->extent_count > 0) {
+            struct fs_extent last;
+            if (get_extent(entry, entry->extent_count - 1, &last) != 0) {
+                break;
+            }
+            if (extent_try_extend(&fs.space, last.start_block, last.block_count, need) == 0) {
+                last.block_count += need;
+                if (set_extent(entry, entry->extent_count - 1, &last) != 0) {
+                    extent_free(&fs.space, last.start_block + last.block_count - need, need);
+                    break;
+                }
+                entry->block_count += need;
+                continue;
+            }
+        }
+        
+        if (entry->extent_count == FS_MAX_EXTENTS) {
+            break;
+        }
+        if (entry->extent_count == FS_DIRECT_EXTENTS &&
+            extent_alloc_partial(&fs.space, 1, &entry->indirect_block) != 1) {
+            break;
+        }
+        
+        struct fs_extent extent;
+        extent.block_count = extent_alloc_partial(&fs.space, need > entry->block_count ? need : entry->block_count,
+                                                  &extent.start_block);
+        if (!extent.block_count || set_extent(entry, entry->extent_count, &extent) != 0) {
+            if (extent.block_count) {
+                extent_free(&fs.space, extent.start_block, extent.block_count);
+            }
+            if (entry->extent_count == FS_DIRECT_EXTENTS) {
+                free_data_blocks(entry->indirect_block, 1);
+                entry->indirect_block = 0;
+            }
+            break;
+        }
+        entry->extent_count++;
+        entry->block_count += extent.block_count;
+    }
+    
+    if (entry->block_count < blocks) {
+        shrink_file_blocks(entry, old_blocks);
+        return -1;
+    }
+    if (entry->block_count != old_blocks) {
+        mark_entry_dirty(entry - fs.files);
+    }
+    return 0;
+}
+
+// Find the data block holding a file offset below block_count * FS_BLOCK_SIZE
+// and set *contiguous to the bytes from there to the end of its extent.
+// Forward moves continue from the cursor.
+static int file_locate(struct file_entry* entry, uint32_t offset, struct fs_cursor* cursor,
+                       uint32_t* block, uint32_t* contiguous) {
+    if (cursor->generation != fs.layout_generation || offset < cursor->base ||
+        cursor->extent >= entry->extent_count) {
+        cursor->extent = 0;
+        cursor->base = 0;
+        cursor->generation = fs.layout_generation;
+    }
+    
+    for (;;) {
+        struct fs_extent extent;
+        if (get_extent(entry, cursor->extent, &extent) != 0) {
+            return -1;
+        }
+        uint32_t bytes = extent.block_count * FS_BLOCK_SIZE;
+        if (offset - cursor->base < bytes) {
+            uint32_t within = offset - cursor->base;
+            *block = extent.start_block + within / FS_BLOCK_SIZE;
+            *contiguous = bytes - within;
+            return 0;
+        }
+        cursor->base += bytes;
+        cursor->extent++;
+    }
+}
+
+// Copy between a buffer and file data at offset a block at a time through
+// the cache; a null src zero-fills. Blocks written whole are not read first.
+static int file_copy_out(struct file_entry* entry, uint32_t offset, void* dst,
+                         uint32_t count, struct fs_cursor* cursor) {
+    uint8_t* out = (uint8_t*)dst;
+    if (entry->flags & FS_ENTRY_INITRD) {
+        memcpy(out, initrd_data(entry->extents[0].start_block + offset), count);
+        return 0;
+    }
+    while (count) {
+        uint32_t block;
+        uint32_t contiguous;
+        if (file_locate(entry, offset, cursor, &block, &contiguous) != 0) {
+            return -1;
+        }
+        if (contiguous > count) {
+            contiguous = count;
+        }
+        for (; contiguous; block++) {
+            uint32_t within = offset % FS_BLOCK_SIZE;
+            uint32_t chunk = FS_BLOCK_SIZE - within;
+            if (chunk > contiguous) {
+                chunk = contiguous;
+            }
+            struct bcache_buf* buf = data_block(block, 0);
+            if (!buf) {
+                return -1;
+            }
+            memcpy(out, buf->data + within, chunk);
+            bcache_release(buf);
+            out += chunk;
+            offset += chunk;
+            count -= chunk;
+            contiguous -= chunk;
+        }
+    }
+    return 0;
+}
+
+static int file_copy_in(struct file_entry* entry, uint32_t offset, const void* src,
+                        uint32_t count, struct fs_cursor* cursor) {
+    const uint8_t* in = (const uint8_t*)src;
+    while (count) {
+        uint32_t block;
+        uint32_t contiguous;
+        if (file_locate(entry, offset, cursor, &block, &contiguous) != 0) {
+            return -1;
+        }
+        if (contiguous > count) {
+            contiguous = count;
+        }
+        for (; contiguous; block++) {
+            uint32_t within = offset % FS_BLOCK_SIZE;
+            uint32_t chunk = FS_BLOCK_SIZE - within;
+            if (chunk > contiguous) {
+                chunk = contiguous;
+            }
+            struct bcache_buf* buf = data_block(block, chunk == FS_BLOCK_SIZE);
+            if (!buf) {
+                return -1;
+            }
+            if (in) {
+                memcpy(buf->data + within, in, chunk);
+                in += chunk;
+            } else {
+                memset(buf->data + within, 0, chunk);
+            }
+            bcache_mark_dirty(buf);
+            bcache_release(buf);
+            offset += chunk;
+            count -= chunk;
+            contiguous -= chunk;
+        }
+    }
+    return 0;
+}
+
+// Copy-on-write for initrd files: give the file blocks of its own before it
+// changes. Unless keep is set the caller replaces the contents, so nothing
+// is copied.
+static int detach_initrd_file(int index, int keep) {
+    struct file_entry* entry = &fs.files[index];
+    if (!(entry->flags & FS_ENTRY_INITRD)) {
+        return 0;
+    }
+    uint32_t offset = entry->extents[0].start_block;
+    uint32_t old_size = entry->size;
+    uint32_t size = keep ? old_size : 0;
+    
+    reclaim_deferred_frees(blocks_for_size(size));
+    entry->flags &= ~FS_ENTRY_INITRD;
+    entry->extents[0].start_block = 0;
+    entry->size = 0;
+    struct fs_cursor cursor = {0, 0, fs.layout_generation};
+    if (grow_file_blocks(entry, blocks_for_size(size)) != 0 ||
+        file_copy_in(entry, 0, initrd_data(offset), size, &cursor) != 0) {
+        shrink_file_blocks(entry, 0);
+        entry->flags |= FS_ENTRY_INITRD;
+        entry->extents[0].start_block = offset;
+        entry->size = old_size;
+        vga_puts("Error: Not enough space to copy the file out of the initrd.\n");
+        return -1;
+    }
+    entry->size = size;
+    mark_entry_dirty(index);
+    return 0;
+}
+
+// Allocate the in-memory tables for the current limits. Data blocks start
+// out free for a new file system and in use when mounting, where the free
+// space is rebuilt from the files found on disk.
+static int init_tables(int blocks_free) {
+    if (extent_init(&fs.space, fs.data_blocks, blocks_free) != 0) {
+        vga_puts("Error: Not enough memory for the free space map.\n");
+        return -1;
+    }
+    
+    // Every bit starts set; slots become free as the table grows over them
+    uint32_t map_words = (fs.entry_limit + 31) / 32;
+    fs.entry_map = kmalloc(map_words * sizeof(uint32_t));
+    if (!fs.entry_map) {
+        vga_puts("Error: Not enough memory for the file table.\n");
+        return -1;
+    }
+    memset(fs.entry_map, 0xFF, map_words * sizeof(uint32_t));
+    
+    fs.dirty_table = kzalloc((fs.super.table_blocks + 31) / 32 * sizeof(uint32_t));
+    if (!fs.dirty_table) {
+        vga_puts("Error: Not enough memory for the dirty block map.\n");
+        return -1;
+    }
+    
+    // Entries are allocated on demand from the kernel heap
+    if (grow_file_table_to(FS_INITIAL_ENTRIES) != 0) {
+        vga_puts("Error: Not enough memory for the file table.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Undo init_tables() so fs_init() can start over on another device; cached
+// blocks of the abandoned device are dropped unwritten
+static void free_tables(void) {
+    extent_destroy(&fs.space);
+    kfree(fs.entry_map);
+    kfree(fs.files);
+    kfree(fs.dirty_table);
+    kfree(fs.deferred_free);
+    journal_close(&fs.journal);
+    if (fs.dev) {
+        bcache_invalidate(fs.dev, 0, fs.dev->block_count);
+    }
+    memset(&fs, 0, sizeof(struct filesystem));
+}
+
+static void create_root(void) {
+    fs.entry_map[0] |= 1;
+    fs.used_entries = 1;
+    fs.files[0].used = 1;
+    fs.files[0].is_directory = 1;
+    fs.files[0].parent_index = -1;
+    fs.files[0].child_root_index = -1;
+    strcpy(fs.files[0].name, "/");
+    fs.files[0].size = 0;
+    mark_entry_dirty(0);
+}
+
+// Returns 1 for a usable superblock, 0 for a blank or foreign device and -1
+// if it could not be read. Read around the cache, since journal replay and
+// write_superblock() write block 0 directly.
+static int read_superblock(void) {
+    uint8_t block[FS_BLOCK_SIZE];
+    if (blockdev_read(fs.dev, 0, 1, block) != 0) {
+        return -1;
+    }
+    memcpy(&fs.super, block, sizeof(struct fs_superblock));
+    
+    struct fs_superblock* super = &fs.super;
+    uint32_t blocks = fs.dev->block_count;
+    if (super->magic != FS_MAGIC || (super->version != 1 && super->version != FS_VERSION) ||
+        super->block_size != FS_BLOCK_SIZE || super->entry_size != sizeof(struct file_entry)) {
+        return 0;
+    }
+    if (super->journal_blocks && (super->journal_start == 0 || super->journal_start > blocks ||
+                                  super->journal_blocks > blocks - super->journal_start)) {
+        return 0;
+    }
+    
+    // Transactions the journal committed supersede the blocks at home,
+    // this one included
+    if (super->journal_blocks && !fs.journal.dev) {
+        int replayed = journal_open(&fs.journal, fs.dev, super->journal_start, super->journal_blocks);
+        if (replayed < 0) {
+            vga_printf("Error: Could not read the journal on %s.\n", fs.dev->name);
+            return -1;
+        }
+        if (replayed > 0) {
+            vga_printf("Replayed %d journal transactions on %s.\n", replayed, fs.dev->name);
+            bcache_invalidate(fs.dev, 0, blocks);
+            return read_superblock();
+        }
+    }
+    
+    if (super->entry_limit < FS_MIN_ENTRIES || super->entry_limit > FS_MAX_ENTRIES ||
+        super->entry_capacity < FS_INITIAL_ENTRIES || super->entry_capacity > super->entry_limit ||
+        super->table_blocks * FS_BLOCK_SIZE < super->entry_limit * sizeof(struct file_entry) ||
+        super->data_blocks > FS_MAX_DISK_DATA_BLOCKS || super->data_start > blocks ||
+        super->data_blocks > blocks - super->data_start) {
+        return 0;
+    }
+    if (super->journal_blocks && super->journal_start < super->data_start + super->data_blocks) {
+        return 0;
+    }
+    return 1;
+}
+
+// Only used to set up the journal; after that the superblock changes
+// through the journal like the rest of the metadata
+static int write_superblock(void) {
+    uint8_t block[FS_BLOCK_SIZE];
+    memset(block, 0, FS_BLOCK_SIZE);
+    memcpy(block, &fs.super, sizeof(struct fs_superblock));
+    if (blockdev_write(fs.dev, 0, 1, block) != 0 || blockdev_flush(fs.dev) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Start a journal in the blocks after the data area, for a new file system
+// or one made before there was a journal. A ramdisk does not outlive a
+// crash, so it has none.
+static void add_journal(void) {
+    if (fs.dev != ata_block_device()) {
+        return;
+    }
+    uint32_t start = fs.super.data_start + fs.super.data_blocks;
+    uint32_t blocks = fs.dev->block_count - start;
+    if (blocks > FS_JOURNAL_BLOCKS) {
+        blocks = FS_JOURNAL_BLOCKS;
+    }
+    journal_close(&fs.journal);
+    if (blocks < JOURNAL_MIN_BLOCKS || journal_format(&fs.journal, fs.dev, start, blocks) != 0) {
+        vga_printf("Warning: No room for a journal on %s.\n", fs.dev->name);
+        return;
+    }
+    fs.super.version = FS_VERSION;
+    fs.super.journal_start = start;
+    fs.super.journal_blocks = blocks;
+    if (write_superblock() != 0) {
+        journal_close(&fs.journal);
+        fs.super.journal_blocks = 0;
+    }
+}
+
+// Load the entry table and give every data block no file owns to the
+// free-space allocator. File data stays on the device until it is read.
+static int mount_device(void) {
+    if (grow_file_table_to(fs.super.entry_capacity) != 0 ||
+        blockdev_read(fs.dev, fs.super.table_start, table_bytes(fs.entry_capacity) / FS_BLOCK_SIZE,
+                      fs.files) != 0) {
+        vga_puts("Error: Could not read the file table.\n");
+        return -1;
+    }
+    
+    // Everything in memory now matches the disk
+    memset(fs.dirty_table, 0, (fs.super.table_blocks + 31) / 32 * sizeof(uint32_t));
+    
+    // Rebuild the entry bitmap and drop state that only lives in memory
+    fs.used_entries = 0;
+    fs.entry_hint = 0;
+    for (uint32_t i = 0; i < fs.entry_capacity; i++) {
+        fs.files[i].open_count = 0;
+        if (fs.files[i].used) {
+            fs.entry_map[i / 32] |= 1u << (i % 32);
+            fs.used_entries++;
+        } else {
+            fs.entry_map[i / 32] &= ~(1u << (i % 32));
+        }
+    }
+    if (!fs.files[0].used || !fs.files[0].is_directory) {
+        vga_puts("Error: Root directory missing on disk.\n");
+        return -1;
+    }
+    
+    // Initrd entries from the last boot point into a module that is gone;
+    // files changed since then have blocks of their own and are kept
+    for (uint32_t i = 0; i < fs.entry_capacity; i++) {
+        struct file_entry* entry = &fs.files[i];
+        if (!entry->used || !entry->flags) {
+            continue;
+        }
+        if ((entry->flags & FS_ENTRY_INITRD) && entry->parent_index >= 0 &&
+            (uint32_t)entry->parent_index < fs.entry_capacity) {
+            remove_child_from_directory(entry->parent_index, i);
+            release_file_entry(i);
+            continue;
+        }
+        entry->flags = 0;
+        mark_entry_dirty(i);
+    }
+    
+    uint32_t* in_use = kzalloc((fs.data_blocks + 31) / 32 * sizeof(uint32_t));
+    if (!in_use) {
+        return -1;
+    }
+    
+    int result = 0;
+    for (uint32_t i = 0; i < fs.entry_capacity && result == 0; i++) {
+        struct file_entry* entry = &fs.files[i];
+        if (!entry->used || entry->is_directory || entry->extent_count == 0) {
+            continue;
+        }
+        if (entry->extent_count > FS_MAX_EXTENTS ||
+            (entry->extent_count > FS_DIRECT_EXTENTS && entry->indirect_block >= fs.data_blocks)) {
+            result = -1;
+            break;
+        }
+        if (entry->extent_count > FS_DIRECT_EXTENTS) {
+            set_bits(in_use, entry->indirect_block, 1);
+        }
+        
+        for (uint32_t e = 0; e < entry->extent_count; e++) {
+            struct fs_extent extent;
+            if (get_extent(entry, e, &extent) != 0 || extent.start_block >= fs.data_blocks ||
+                extent.block_count > fs.data_blocks - extent.start_block) {
+                result = -1;
+                break;
+            }
+            set_bits(in_use, extent.start_block, extent.block_count);
+        }
+    }
+    
+    // Free each run of unused blocks
+    uint32_t block = 0;
+    while (result == 0 && block < fs.data_blocks) {
+        int used = (in_use[block / 32] >> (block % 32)) & 1;
+        uint32_t run = 1;
+        while (block + run < fs.data_blocks &&
+               (int)((in_use[(block + run) / 32] >> ((block + run) % 32)) & 1) == used) {
+            run++;
+        }
+        if (!used) {
+            extent_free(&fs.space, block, run);
+        }
+        block += run;
+    }
+    kfree(in_use);
+    
+    if (result != 0) {
+        vga_puts("Error: File data on disk is unreadable or corrupt.\n");
+    }
+    return result;
+}
+
+// Lay out a new file system on a blank device. Data lives on the device and
+// is only cached in memory, so a disk's data area is bounded by the extent
+// maps rather than by the data itself; a ramdisk is sized to fs.data_blocks
+// by its creator.
+static int format_device(void) {
+    uint32_t blocks = fs.dev->block_count;
+    uint32_t table_blocks = table_bytes(fs.entry_limit) / FS_BLOCK_SIZE;
+    if (blocks < 1 + table_blocks + FS_MIN_DATA_BLOCKS) {
+        vga_puts("Error: Disk too small for a file system.\n");
+        return -1;
+    }
+    
+    // Leave room for a journal after the data area if the disk has it
+    uint32_t journal_blocks = fs.dev == ata_block_device() ? FS_JOURNAL_BLOCKS : 0;
+    if (blocks - 1 - table_blocks < FS_MIN_DATA_BLOCKS + journal_blocks) {
+        journal_blocks = 0;
+    }
+    fs.data_blocks = clamp_limit(blocks - 1 - table_blocks - journal_blocks,
+                                 FS_MIN_DATA_BLOCKS, disk_data_limit());
+    
+    memset(&fs.super, 0, sizeof(struct fs_superblock));
+    fs.super.magic = FS_MAGIC;
+    fs.super.version = FS_VERSION;
+    fs.super.block_size = FS_BLOCK_SIZE;
+    fs.super.entry_size = sizeof(struct file_entry);
+    fs.super.entry_limit = fs.entry_limit;
+    fs.super.table_start = 1;
+    fs.super.table_blocks = table_blocks;
+    fs.super.data_start = 1 + table_blocks;
+    fs.super.data_blocks = fs.data_blocks;
+    return 0;
+}
+
+// Mount the file system on dev, or format dev if it does not hold one
+static int attach_device(struct block_device* dev, int announce) {
+    fs.dev = dev;
+    int status = read_superblock();
+    if (status < 0) {
+        return -1;
+    }
+    
+    if (status > 0) {
+        fs.entry_limit = fs.super.entry_limit;
+        fs.data_blocks = fs.super.data_blocks;
+        if (init_tables(0) != 0 || mount_device() != 0) {
+            return -1;
+        }
+        fs.committed_capacity = fs.super.entry_capacity;
+        if (!fs.super.journal_blocks) {
+            add_journal();
+        }
+        vga_printf("Mounted file system from %s (%u entries, %u data blocks).\n",
+                   dev->name, fs.used_entries, fs.data_blocks);
+        return 0;
+    }
+    
+    if (announce) {
+        vga_printf("No file system found on %s, formatting.\n", dev->name);
+    }
+    set_memory_limits();
+    if (format_device() != 0 || init_tables(1) != 0) {
+        return -1;
+    }
+    add_journal();
+    create_root();
+    return fs_sync() < 0 ? -1 : 0;
+}
+
+int fs_init(void) {
+    PERF_FUNCTION();
+    // Initialize file system structure
+    memset(&fs, 0, sizeof(struct filesystem));
+    for (int i = 0; i < FS_DCACHE_SIZE; i++) {
+        dcache[i].index = -1;
+    }
+    for (int i = 0; i < FS_MAX_OPEN_FILES; i++) {
+        open_files[i].index = -1;
+    }
+    dcache_hits = 0;
+    dcache_misses = 0;
+    
+    // Mount the disk if it holds our file system, or format it if it is blank
+    struct block_device* disk = ata_block_device();
+    if (disk && attach_device(disk, 1) != 0) {
+        free_tables();
+        vga_puts("Error: Disk unusable, keeping files in memory only.\n");
+    }
+    
+    // Without a disk the same layout goes on a ramdisk sized from memory
+    if (!fs.dev) {
+        set_memory_limits();
+        struct block_device* ramdisk = ramdisk_create(1 + table_bytes(fs.entry_limit) / FS_BLOCK_SIZE +
+                                                      fs.data_blocks);
+        if (!ramdisk || attach_device(ramdisk, 0) != 0) {
+            vga_puts("Error: Not enough memory for the file system.\n");
+            return -1;
+        }
+    }
+    
+    // The initrd appears under / as directories are first looked into
+    if (initrd_present()) {
+        fs.files[0].flags |= FS_ENTRY_LAZY;
+        fs.files[0].extents[0].start_block = FS_INITRD_ROOT;
+        mark_entry_dirty(0);
+    }
+    
+    fs.root_directory = 0;
+    fs.current_directory = 0;
+    fs.cwd_path[0] = '/';
+    fs.cwd_path[1] = '\0';
+    fs.cwd_length = 1;
+    
+    vga_puts("File system with directory support initialized successfully.\n");
+    return 0;
+}
+
+// Claim a free entry: scan the bitmap a word at a time from the hint,
+// growing the table when every slot is taken
+static int find_free_file_entry(void) {
+    for (;;) {
+        uint32_t words = (fs.entry_capacity + 31) / 32;
+        for (uint32_t w = fs.entry_hint; w < words; w++) {
+            uint32_t bits = fs.entry_map[w];
+            if (bits != 0xFFFFFFFF) {
+                uint32_t index = w * 32 + __builtin_ctz(~bits);
+                fs.entry_map[w] = bits | (1u << (index % 32));
+                fs.entry_hint = w;
+                fs.used_entries++;
+                return index;
+            }
+        }
+        fs.entry_hint = words;
+        
+        if (grow_file_table() != 0) {
+            return -1; // No free entries
+        }
+    }
+}
+
+static void release_file_entry(int index) {
+    fs.files[index].used = 0;
+    fs.files[index].flags = 0;
+    mark_entry_dirty(index);
+    fs.entry_map[index / 32] &= ~(1u << (index % 32));
+    if ((uint32_t)index / 32 < fs.entry_hint) {
+        fs.entry_hint = index / 32;
+    }
+    fs.used_entries--;
+}
+
+// FNV-1a over the parent index and the name
+static uint32_t dentry_hash(int parent, const char* name) {
+    uint32_t hash = 2166136261u ^ (uint32_t)parent;
+    hash *= 16777619u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Look up name in a directory, trying the cache before the name index
+static int dcache_lookup(int dir_index, const char* name) {
+    uint32_t hash = dentry_hash(dir_index, name);
+    struct dentry* slot = &dcache[hash % FS_DCACHE_SIZE];
+    
+    if (slot->index >= 0 && slot->hash == hash && slot->parent == dir_index &&
+        fs.files[slot->index].used && fs.files[slot->index].parent_index == dir_index &&
+        strcmp(fs.files[slot->index].name, name) == 0) {
+        dcache_hits++;
+        return slot->index;
+    }
+    
+    dcache_misses++;
+    int index = dir_lookup(dir_index, name);
+    if (index >= 0) {
+        slot->hash = hash;
+        slot->parent = dir_index;
+        slot->index = index;
+    }
+    return index;
+}
+
+static void dcache_invalidate(int dir_index, const char* name) {
+    uint32_t hash = dentry_hash(dir_index, name);
+    struct dentry* slot = &dcache[hash % FS_DCACHE_SIZE];
+    if (slot->hash == hash && slot->parent == dir_index) {
+        slot->index = -1;
+    }
+}
+
+// Copy the next component of *path into name and advance past it.
+// Returns 1 for a component, 0 at the end of the path, -1 if it is too long.
+static int next_component(const char** path, char* name) {
+    const char* p = *path;
+    while (*p == '/') {
+        p++;
+    }
+    if (!*p) {
+        *path = p;
+        return 0;
+    }
+    
+    int len = 0;
+    while (p[len] && p[len] != '/') {
+        len++;
+    }
+    if (len >= MAX_FILENAME_LENGTH) {
+        return -1;
+    }
+    memcpy(name, p, len);
+    name[len] = '\0';
+    *path = p + len;
+    return 1;
+}
+
+// Follow one component from a directory
+static int step_component(int dir_index, const char* name) {
+    if (strcmp(name, ".") == 0) {
+        return dir_index;
+    }
+    if (strcmp(name, "..") == 0) {
+        int parent = fs.files[dir_index].parent_index;
+        return (parent == -1) ? fs.root_directory : parent;
+    }
+    return dcache_lookup(dir_index, name);
+}
+
+// Resolve a path to an entry index; an empty path is the current directory
+static int lookup_path(const char* path) {
+    int index = (path[0] == '/') ? fs.root_directory : fs.current_directory;
+    char name[MAX_FILENAME_LENGTH];
+    int result;
+    
+    while ((result = next_component(&path, name)) > 0) {
+        if (!fs.files[index].is_directory) {
+            return -1;
+        }
+        index = step_component(index, name);
+        if (index < 0) {
+            return -1;
+        }
+    }
+    return (result == 0) ? index : -1;
+}
+
+// Resolve everything but the last component of path to a directory and
+// copy that component to leaf. Returns the directory, -1 if it does not
+// exist, or -2 if the leaf is not a valid new entry name.
+static int lookup_parent(const char* path, char* leaf) {
+    int dir_index = (path[0] == '/') ? fs.root_directory : fs.current_directory;
+    char name[MAX_FILENAME_LENGTH];
+    int have_leaf = 0;
+    int result;
+    
+    while ((result = next_component(&path, name)) > 0) {
+        if (have_leaf) {
+            dir_index = step_component(dir_index, leaf);
+            if (dir_index < 0 || !fs.files[dir_index].is_directory) {
+                return -1;
+            }
+        }
+        strcpy(leaf, name);
+        have_leaf = 1;
+    }
+    
+    if (result < 0 || !have_leaf || strcmp(leaf, ".") == 0 || strcmp(leaf, "..") == 0) {
+        return -2;
+    }
+    return dir_index;
+}
+
+static int find_file_entry(const char* filename) {
+    int index = lookup_path(filename);
+    if (index >= 0 && !fs.files[index].is_directory) {
+        return index;
+    }
+    return -1; // File not found
+}
+
+// Claim an entry for an empty file or directory and link it into parent
+static int add_entry(int parent, const char* name, int is_directory) {
+    int index = find_free_file_entry();
+    if (index < 0) {
+        return -1;
+    }
+    
+    strcpy(fs.files[index].name, name);
+    fs.files[index].used = 1;
+    fs.files[index].is_directory = (uint8_t)is_directory;
+    fs.files[index].flags = 0;
+    fs.files[index].size = 0;
+    fs.files[index].block_count = 0;
+    fs.files[index].extent_count = 0;
+    fs.files[index].indirect_block = 0;
+    fs.files[index].open_count = 0;
+    fs.files[index].child_root_index = -1;
+    mark_entry_dirty(index);
+    
+    add_child_to_directory(parent, index);
+    return index;
+}
+
+// Create an empty file or directory at path; returns its index or -1
+static int create_entry(const char* path, int is_directory) {
+    char name[MAX_FILENAME_LENGTH];
+    int parent = lookup_parent(path, name);
+    if (parent == -2) {
+        vga_printf("Error: Invalid or too long %s name.\n", is_directory ? "directory" : "file");
+        return -1;
+    }
+    if (parent < 0) {
+        vga_printf("Error: Directory for '%s' not found.\n", path);
+        return -1;
+    }
+    
+    // Check if a file or directory with that name already exists
+    int existing = dcache_lookup(parent, name);
+    if (existing >= 0) {
+        if (fs.files[existing].is_directory) {
+            vga_printf("Error: Directory '%s' already exists.\n", path);
+        } else {
+            vga_printf("Error: File '%s' already exists.\n", path);
+        }
+        return -1;
+    }
+    
+    int index = add_entry(parent, name, is_directory);
+    if (index < 0) {
+        vga_puts("Error: No free file entries available.\n");
+    }
+    return index;
+}
+
+int fs_create_file(const char* filename) {
+    PERF_FUNCTION();
+    if (create_entry(filename, 0) < 0) {
+        return -1;
+    }
+    end_operation();
+    vga_printf("File '%s' created successfully.\n", filename);
+    return 0;
+}
+
+int fs_write_file(const char* filename, const char* data, uint32_t size) {
+    PERF_FUNCTION();
+    int index = find_file_entry(filename);
+    if (index < 0) {
+        vga_printf("Error: File '%s' not found.\n", filename);
+        return -1;
+    }
+    
+    if (size > MAX_FILE_SIZE) {
+        vga_printf("Error: File size too large (max %d bytes).\n", MAX_FILE_SIZE);
+        return -1;
+    }
+    
+    // The old contents are replaced, so give up blocks beyond the new size
+    // before growing to it
+    reclaim_deferred_frees(blocks_for_size(size));
+    detach_initrd_file(index, 0);
+    struct file_entry* entry = &fs.files[index];
+    uint32_t blocks = blocks_for_size(size);
+    shrink_file_blocks(entry, blocks);
+    if (grow_file_blocks(entry, blocks) != 0) {
+        vga_puts("Error: Not enough space in file system.\n");
+        return -1;
+    }
+    shrink_file_blocks(entry, blocks);
+    
+    // Write data
+    struct fs_cursor cursor = {0, 0, fs.layout_generation};
+    if (file_copy_in(entry, 0, data, size, &cursor) != 0) {
+        return -1;
+    }
+    entry->size = size;
+    mark_entry_dirty(index);
+    end_operation();
+    
+    vga_printf("Data written to file '%s' (%u bytes).\n", filename, size);
+    return 0;
+}
+
+int fs_read_file(const char* filename, char* buffer, uint32_t buffer_size) {
+    PERF_FUNCTION();
+    int index = find_file_entry(filename);
+    if (index < 0) {
+        vga_printf("Error: File '%s' not found.\n", filename);
+        return -1;
+    }
+    
+    if (fs.files[index].size == 0) {
+        vga_printf("File '%s' is empty.\n", filename);
+        return 0;
+    }
+    
+    uint32_t copy_size = fs.files[index].size;
+    if (copy_size > buffer_size - 1) {
+        copy_size = buffer_size - 1;
+    }
+    
+    struct fs_cursor cursor = {0, 0, fs.layout_generation};
+    if (file_copy_out(&fs.files[index], 0, buffer, copy_size, &cursor) != 0) {
+        return -1;
+    }
+    buffer[copy_size] = '\0'; // Null-terminate for text files
+    
+    return copy_size;
+}
+
+int fs_delete_file(const char* filename) {
+    PERF_FUNCTION();
+    int index = find_file_entry(filename);
+    if (index < 0) {
+        vga_printf("Error: File '%s' not found.\n", filename);
+        return -1;
+    }
+    
+    if (fs.files[index].open_count) {
+        vga_printf("Error: File '%s' is open.\n", filename);
+        return -1;
+    }
+    
+    // Remove from parent directory
+    int parent = fs.files[index].parent_index;
+    dcache_invalidate(parent, fs.files[index].name);
+    remove_child_from_directory(parent, index);
+    
+    // Return the file's blocks and mark the entry as unused
+    shrink_file_blocks(&fs.files[index], 0);
+    release_file_entry(index);
+    fs.files[index].size = 0;
+    memset(fs.files[index].name, 0, MAX_FILENAME_LENGTH);
+    end_operation();
+    
+    vga_printf("File '%s' deleted successfully.\n", filename);
+    return 0;
+}
+
+int fs_list_files(void) {
+    PERF_FUNCTION();
+    return fs_list_directory("");
+}
+
+int fs_list_directory(const char* path) {
+    PERF_FUNCTION();
+    int dir_index = lookup_path(path);
+    if (dir_index < 0 || !fs.files[dir_index].is_directory) {
+        vga_printf("Error: Directory '%s' not found.\n", path);
+        return -1;
+    }
+    
+    vga_batch_begin();
+    vga_printf("Contents of %s:\n", path[0] ? path : fs.cwd_path);
+    vga_puts("Type Name                    Size (bytes)\n");
+    vga_puts("----------------------------------------\n");
+    
+    // The name index yields entries already sorted
+    int count = 0;
+    struct dir_iter it;
+    int child = dir_iter_first(&it, dir_index);
+    
+    while (child != -1) {
+        if (fs.files[child].is_directory) {
+            vga_set_color(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
+            vga_printf("DIR  %-20s <DIR>\n", fs.files[child].name);
+            vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+        } else {
+            vga_printf("FILE %-20s %u\n", fs.files[child].name, fs.files[child].size);
+        }
+        count++;
+        child = dir_iter_next(&it);
+    }
+    
+    if (count == 0) {
+        vga_puts("Directory is empty.\n");
+    } else {
+        vga_printf("\nTotal: %d items\n", count);
     }
-    return *(unsigned char*)str1 - *(unsigned char*)str2;
+    vga_batch_end();
+    
+    return count;
 }
 
-static void strcpy(char* dest, const char* src) {
-    while ((*dest++ = *src++));
+int fs_file_exists(const char* filename) {
+    PERF_FUNCTION();
+    return find_file_entry(filename) >= 0;
 }
 
-static int strlen(const char* str) {
-    int len = 0;
-    while (str[len]) len++;
-    return len;
+uint32_t fs_get_file_size(const char* filename) {
+    PERF_FUNCTION();
+    int index = find_file_entry(filename);
+    if (index >= 0) {
+        return fs.files[index].size;
+    }
+    return 0;
+}
+
+static struct open_file* get_open_file(int fd) {
+    if (fd < 0 || fd >= FS_MAX_OPEN_FILES || open_files[fd].index < 0) {
+        vga_printf("Error: Bad file descriptor %d.\n", fd);
+        return 0;
+    }
+    return &open_files[fd];
+}
+
+int fs_open(const char* path, int flags) {
+    PERF_FUNCTION();
+    int slot = -1;
+    for (int i = 0; i < FS_MAX_OPEN_FILES; i++) {
+        if (open_files[i].index < 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        vga_puts("Error: Too many open files.\n");
+        return -1;
+    }
+    
+    int index = lookup_path(path);
+    if (index >= 0 && fs.files[index].is_directory) {
+        vga_printf("Error: '%s' is a directory.\n", path);
+        return -1;
+    }
+    if (index < 0) {
+        if (!(flags & FS_O_CREAT)) {
+            vga_printf("Error: File '%s' not found.\n", path);
+            return -1;
+        }
+        index = create_entry(path, 0);
+        if (index < 0) {
+            return -1;
+        }
+        end_operation();
+    }
+    
+    if ((flags & FS_O_TRUNC) && (flags & FS_O_ACCMODE) != FS_O_RDONLY) {
+        detach_initrd_file(index, 0);
+        shrink_file_blocks(&fs.files[index], 0);
+        fs.files[index].size = 0;
+        mark_entry_dirty(index);
+        end_operation();
+    }
+    
+    fs.files[index].open_count++;
+    open_files[slot].index = index;
+    open_files[slot].offset = 0;
+    open_files[slot].flags = flags;
+    open_files[slot].cursor.generation = fs.layout_generation - 1;
+    return slot;
+}
+
+int fs_read(int fd, void* buffer, uint32_t count) {
+    PERF_FUNCTION();
+    struct open_file* file = get_open_file(fd);
+    if (!file) {
+        return -1;
+    }
+    if ((file->flags & FS_O_ACCMODE) == FS_O_WRONLY) {
+        vga_puts("Error: File not open for reading.\n");
+        return -1;
+    }
+    
+    struct file_entry* entry = &fs.files[file->index];
+    if (file->offset >= entry->size) {
+        return 0;
+    }
+    if (count > entry->size - file->offset) {
+        count = entry->size - file->offset;
+    }
+    if (file_copy_out(entry, file->offset, buffer, count, &file->cursor) != 0) {
+        return -1;
+    }
+    file->offset += count;
+    return count;
+}
+
+// Write at the descriptor's offset (or at EOF with FS_O_APPEND). Writes
+// past the end zero-fill the gap; a write reaching the size limit is cut
+// short and the bytes actually written are returned.
+int fs_write(int fd, const void* data, uint32_t count) {
+    PERF_FUNCTION();
+    struct open_file* file = get_open_file(fd);
+    if (!file) {
+        return -1;
+    }
+    if ((file->flags & FS_O_ACCMODE) == FS_O_RDONLY) {
+        vga_puts("Error: File not open for writing.\n");
+        return -1;
+    }
+    
+    if (detach_initrd_file(file->index, 1) != 0) {
+        return -1;
+    }
+    struct file_entry* entry = &fs.files[file->index];
+    if (file->flags & FS_O_APPEND) {
+        file->offset = entry->size;
+    }
+    if (file->offset >= MAX_FILE_SIZE) {
+        if (count) {
+            vga_printf("Error: File size limit reached (max %d bytes).\n", MAX_FILE_SIZE);
+            return -1;
+        }
+        return 0;
+    }
+    if (count > MAX_FILE_SIZE - file->offset) {
+        count = MAX_FILE_SIZE - file->offset;
+    }
+    
+    uint32_t end = file->offset + count;
+    if (blocks_for_size(end) > entry->block_count) {
+        reclaim_deferred_frees(blocks_for_size(end) - entry->block_count);
+    }
+    if (grow_file_blocks(entry, blocks_for_size(end)) != 0) {
+        vga_puts("Error: Not enough space in file system.\n");
+        return -1;
+    }
+    
+    if ((file->offset > entry->size &&
+         file_copy_in(entry, entry->size, 0, file->offset - entry->size, &file->cursor) != 0) ||
+        file_copy_in(entry, file->offset, data, count, &file->cursor) != 0) {
+        return -1;
+    }
+    file->offset = end;
+    if (end > entry->size) {
+        entry->size = end;
+        mark_entry_dirty(file->index);
+    }
+    end_operation();
+    return count;
+}
+
+int fs_seek(int fd, int32_t offset, int whence) {
+    PERF_FUNCTION();
+    struct open_file* file = get_open_file(fd);
+    if (!file) {
+        return -1;
+    }
+    
+    int64_t base;
+    if (whence == FS_SEEK_SET) {
+        base = 0;
+    } else if (whence == FS_SEEK_CUR) {
+        base = file->offset;
+    } else if (whence == FS_SEEK_END) {
+        base = fs.files[file->index].size;
+    } else {
+        vga_puts("Error: Invalid seek origin.\n");
+        return -1;
+    }
+    
+    // Summed in 64 bits so no offset can overflow the check
+    int64_t position = base + offset;
+    if (position < 0) {
+        vga_puts("Error: Seek before start of file.\n");
+        return -1;
+    }
+    if (position > MAX_FILE_SIZE) {
+        vga_printf("Error: Seek past the file size limit (max %d bytes).\n", MAX_FILE_SIZE);
+        return -1;
+    }
+    
+    file->offset = (uint32_t)position;
+    return (int)file->offset;
+}
+
+int fs_close(int fd) {
+    PERF_FUNCTION();
+    struct open_file* file = get_open_file(fd);
+    if (!file) {
+        return -1;
+    }
+    fs.files[file->index].open_count--;
+    file->index = -1;
+    return 0;
+}
+
+// Start a view over a file; returns the file size or -1
+int fs_view_open(const char* path, struct fs_view* view) {
+    PERF_FUNCTION();
+    int index = find_file_entry(path);
+    if (index < 0) {
+        vga_printf("Error: File '%s' not found.\n", path);
+        return -1;
+    }
+    view->index = index;
+    view->offset = 0;
+    view->cursor.generation = fs.layout_generation - 1;
+    view->buffer = 0;
+    return (int)fs.files[index].size;
+}
+
+// Return the next span of the file, one cached block at a time; 0 once it
+// is exhausted and -1 on an I/O error
+int fs_view_next(struct fs_view* view, const char** data, uint32_t* length) {
+    PERF_FUNCTION();
+    fs_view_close(view);
+    struct file_entry* entry = &fs.files[view->index];
+    if (!entry->used || view->offset >= entry->size) {
+        return 0;
+    }
+    
+    // Initrd data is already in memory: the rest of the file is one span
+    if (entry->flags & FS_ENTRY_INITRD) {
+        *data = (const char*)initrd_data(entry->extents[0].start_block + view->offset);
+        *length = entry->size - view->offset;
+        view->offset = entry->size;
+        return 1;
+    }
+    
+    uint32_t block;
+    uint32_t contiguous;
+    if (file_locate(entry, view->offset, &view->cursor, &block, &contiguous) != 0) {
+        return -1;
+    }
+    view->buffer = data_block(block, 0);
+    if (!view->buffer) {
+        return -1;
+    }
+    
+    // Cut off at the end of the block and of the file
+    uint32_t within = view->offset % FS_BLOCK_SIZE;
+    *data = (const char*)view->buffer->data + within;
+    *length = FS_BLOCK_SIZE - within;
+    if (*length > entry->size - view->offset) {
+        *length = entry->size - view->offset;
+    }
+    view->offset += *length;
+    return 1;
+}
+
+// Unpin the current span; needed only when stopping before the end
+void fs_view_close(struct fs_view* view) {
+    PERF_FUNCTION();
+    if (view->buffer) {
+        bcache_release(view->buffer);
+        view->buffer = 0;
+    }
+}
+
+// Page fault callback: copy one page of the file, zero-filling past EOF
+static void fs_map_fill(void* context, uint32_t offset, uint8_t* page) {
+    struct fs_mapping* mapping = (struct fs_mapping*)context;
+    struct file_entry* entry = &fs.files[mapping->index];
+    uint32_t copy = 0;
+    
+    if (entry->used && offset < entry->size) {
+        copy = entry->size - offset;
+        if (copy > PAGE_SIZE) {
+            copy = PAGE_SIZE;
+        }
+        if (file_copy_out(entry, offset, page, copy, &mapping->cursor) != 0) {
+            copy = 0;
+        }
+    }
+    memset(page + copy, 0, PAGE_SIZE - copy);
+}
+
+const void* fs_map_file(const char* filename, uint32_t* size) {
+    PERF_FUNCTION();
+    int index = find_file_entry(filename);
+    if (index < 0) {
+        vga_printf("Error: File '%s' not found.\n", filename);
+        return 0;
+    }
+    if (fs.files[index].size == 0) {
+        vga_printf("File '%s' is empty.\n", filename);
+        return 0;
+    }
+    
+    int slot = -1;
+    for (int i = 0; i < FS_MAX_MAPPINGS; i++) {
+        if (!mappings[i].address) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        vga_puts("Error: Too many mapped files.\n");
+        return 0;
+    }
+    
+    mappings[slot].index = index;
+    mappings[slot].cursor.generation = fs.layout_generation - 1;
+    mappings[slot].address = paging_map_lazy(fs.files[index].size, fs_map_fill, &mappings[slot]);
+    if (!mappings[slot].address) {
+        vga_puts("Error: Could not reserve address space for mapping.\n");
+        return 0;
+    }
+    
+    *size = fs.files[index].size;
+    return mappings[slot].address;
+}
+
+int fs_unmap_file(const void* address) {
+    PERF_FUNCTION();
+    for (int i = 0; i < FS_MAX_MAPPINGS; i++) {
+        if (mappings[i].address && mappings[i].address == address) {
+            paging_unmap_lazy((void*)address);
+            mappings[i].address = 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Each directory keeps its children in an AVL tree ordered by name, linked
+// through left_index/right_index, so lookup, insert and remove are
+// O(log n) and listing is an in-order walk.
+static int tree_height(int node) {
+    return node < 0 ? 0 : fs.files[node].tree_height;
+}
+
+static void tree_update(int node) {
+    int left = tree_height(fs.files[node].left_index);
+    int right = tree_height(fs.files[node].right_index);
+    fs.files[node].tree_height = (uint8_t)((left > right ? left : right) + 1);
+    mark_entry_dirty(node);
+}
+
+static int tree_rotate_right(int node) {
+    int pivot = fs.files[node].left_index;
+    fs.files[node].left_index = fs.files[pivot].right_index;
+    fs.files[pivot].right_index = node;
+    tree_update(node);
+    tree_update(pivot);
+    return pivot;
+}
+
+static int tree_rotate_left(int node) {
+    int pivot = fs.files[node].right_index;
+    fs.files[node].right_index = fs.files[pivot].left_index;
+    fs.files[pivot].left_index = node;
+    tree_update(node);
+    tree_update(pivot);
+    return pivot;
+}
+
+// Restore the AVL invariant at node; returns the subtree's new root
+static int tree_balance(int node) {
+    tree_update(node);
+    int balance = tree_height(fs.files[node].left_index) - tree_height(fs.files[node].right_index);
+    
+    if (balance > 1) {
+        int left = fs.files[node].left_index;
+        if (tree_height(fs.files[left].left_index) < tree_height(fs.files[left].right_index)) {
+            fs.files[node].left_index = tree_rotate_left(left);
+        }
+        return tree_rotate_right(node);
+    }
+    if (balance < -1) {
+        int right = fs.files[node].right_index;
+        if (tree_height(fs.files[right].right_index) < tree_height(fs.files[right].left_index)) {
+            fs.files[node].right_index = tree_rotate_right(right);
+        }
+        return tree_rotate_left(node);
+    }
+    return node;
+}
+
+static int tree_insert(int root, int node) {
+    if (root < 0) {
+        fs.files[node].left_index = -1;
+        fs.files[node].right_index = -1;
+        fs.files[node].tree_height = 1;
+        return node;
+    }
+    if (strcmp(fs.files[node].name, fs.files[root].name) < 0) {
+        fs.files[root].left_index = tree_insert(fs.files[root].left_index, node);
+    } else {
+        fs.files[root].right_index = tree_insert(fs.files[root].right_index, node);
+    }
+    return tree_balance(root);
+}
+
+// Detach the leftmost node of a subtree; returns the subtree's new root
+static int tree_remove_min(int root, int* min) {
+    if (fs.files[root].left_index < 0) {
+        *min = root;
+        return fs.files[root].right_index;
+    }
+    fs.files[root].left_index = tree_remove_min(fs.files[root].left_index, min);
+    return tree_balance(root);
+}
+
+static int tree_remove(int root, int node) {
+    if (root < 0) {
+        return -1;
+    }
+    if (root == node) {
+        int left = fs.files[root].left_index;
+        int right = fs.files[root].right_index;
+        if (right < 0) {
+            return left;
+        }
+        int successor;
+        right = tree_remove_min(right, &successor);
+        fs.files[successor].left_index = left;
+        fs.files[successor].right_index = right;
+        return tree_balance(successor);
+    }
+    if (strcmp(fs.files[node].name, fs.files[root].name) < 0) {
+        fs.files[root].left_index = tree_remove(fs.files[root].left_index, node);
+    } else {
+        fs.files[root].right_index = tree_remove(fs.files[root].right_index, node);
+    }
+    return tree_balance(root);
+}
+
+// Create the entries an initrd directory holds the first time anything
+// looks inside it. The archive stores each directory's subtree right after
+// its own header, so only that range is walked, stepping over the subtrees
+// of subdirectories, and file data is never touched: files point at the
+// module until they are first written. Names already present (from the
+// disk) win over the archive, which also lets a walk cut short by a full
+// table run again later. The flag is cleared first because each lookup
+// below comes back here.
+static void load_initrd_directory(int dir) {
+    if (!(fs.files[dir].flags & FS_ENTRY_LAZY)) {
+        return;
+    }
+    fs.files[dir].flags &= ~FS_ENTRY_LAZY;
+    mark_entry_dirty(dir);
+    
+    // The directory's own header gives the prefix its members share
+    struct initrd_entry self;
+    struct initrd_entry member;
+    uint32_t offset = 0;
+    self.path_length = 0;
+    if (fs.files[dir].extents[0].start_block != FS_INITRD_ROOT) {
+        if (initrd_read_entry(fs.files[dir].extents[0].start_block, &self) <= 0) {
+            return;
+        }
+        offset = self.next;
+    }
+    
+    for (;;) {
+        uint32_t header = offset;
+        int status = initrd_read_entry(offset, &member);
+        if (status <= 0) {
+            if (status < 0) {
+                vga_puts("Error: Damaged header in the initrd.\n");
+            }
+            return;
+        }
+        offset = member.end;
+        
+        // Members outside the prefix end the subtree
+        uint32_t prefix = self.path_length;
+        if (prefix && (member.path_length <= prefix || member.path[prefix] != '/' ||
+                       strncmp(member.path, self.path, prefix) != 0)) {
+            return;
+        }
+        const char* name = member.path + (prefix ? prefix + 1 : 0);
+        int length = strlen(name);
+        if (length == 0 || length >= MAX_FILENAME_LENGTH || strchr(name, '/') ||
+            (!member.is_directory && !member.is_file)) {
+            continue;   // The root itself, a deeper member, or unsupported
+        }
+        
+        int index = dir_lookup(dir, name);
+        if (index >= 0) {
+            // Merge an archive directory into one that is already there
+            if (fs.files[index].is_directory && member.is_directory) {
+                fs.files[index].flags |= FS_ENTRY_LAZY;
+                fs.files[index].extents[0].start_block = header;
+                mark_entry_dirty(index);
+            }
+            continue;
+        }
+        
+        index = add_entry(dir, name, member.is_directory);
+        if (index < 0) {
+            vga_puts("Error: No free file entries for the initrd.\n");
+            fs.files[dir].flags |= FS_ENTRY_LAZY;
+            return;
+        }
+        if (member.is_directory) {
+            fs.files[index].flags = FS_ENTRY_LAZY;
+            fs.files[index].extents[0].start_block = header;
+        } else {
+            fs.files[index].flags = FS_ENTRY_INITRD;
+            fs.files[index].extents[0].start_block = member.data_offset;
+            fs.files[index].size = member.size;
+        }
+    }
+}
+
+// Find a file or directory by name within one directory
+static int dir_lookup(int dir_index, const char* name) {
+    load_initrd_directory(dir_index);
+    int node = fs.files[dir_index].child_root_index;
+    while (node != -1) {
+        int cmp = strcmp(name, fs.files[node].name);
+        if (cmp == 0) {
+            return node;
+        }
+        node = cmp < 0 ? fs.files[node].left_index : fs.files[node].right_index;
+    }
+    return -1;
+}
+
+static void dir_iter_push_left(struct dir_iter* it, int node) {
+    while (node != -1) {
+        it->stack[it->depth++] = node;
+        node = fs.files[node].left_index;
+    }
+}
+
+static int dir_iter_first(struct dir_iter* it, int dir_index) {
+    load_initrd_directory(dir_index);
+    it->depth = 0;
+    dir_iter_push_left(it, fs.files[dir_index].child_root_index);
+    return dir_iter_next(it);
+}
+
+static int dir_iter_next(struct dir_iter* it) {
+    if (it->depth == 0) {
+        return -1;
+    }
+    int node = it->stack[--it->depth];
+    dir_iter_push_left(it, fs.files[node].right_index);
+    return node;
+}
+
+static void add_child_to_directory(int parent_index, int child_index) {
+    fs.files[parent_index].child_root_index = tree_insert(fs.files[parent_index].child_root_index, child_index);
+    fs.files[child_index].parent_index = parent_index;
+    mark_entry_dirty(parent_index);
+    mark_entry_dirty(child_index);
+}
+
+static void remove_child_from_directory(int parent_index, int child_index) {
+    fs.files[parent_index].child_root_index = tree_remove(fs.files[parent_index].child_root_index, child_index);
+    fs.files[child_index].left_index = -1;
+    fs.files[child_index].right_index = -1;
+    fs.files[child_index].tree_height = 0;
+    mark_entry_dirty(parent_index);
+    mark_entry_dirty(child_index);
+}
+
+int fs_create_directory(const char* dirname) {
+    PERF_FUNCTION();
+    if (create_entry(dirname, 1) < 0) {
+        return -1;
+    }
+    end_operation();
+    vga_printf("Directory '%s' created successfully.\n", dirname);
+    return 0;
+}
+
+int fs_resolve_path(const char* path) {
+    PERF_FUNCTION();
+    int index = lookup_path(path);
+    if (index >= 0 && fs.files[index].is_directory) {
+        return index;
+    }
+    return -1; // Not found
+}
+
+// Walk path from the current directory, editing a copy of the cwd string
+// component by component, so the prompt never has to rebuild it
+int fs_change_directory(const char* path) {
+    PERF_FUNCTION();
+    char new_path[MAX_PATH_LENGTH];
+    uint32_t length;
+    int dir_index;
+    
+    if (path[0] == '/') {
+        dir_index = fs.root_directory;
+        length = 1;
+    } else {
+        dir_index = fs.current_directory;
+        length = fs.cwd_length;
+    }
+    memcpy(new_path, fs.cwd_path, length);
+    new_path[0] = '/';
+    
+    const char* cursor = path;
+    char name[MAX_FILENAME_LENGTH];
+    int result;
+    while ((result = next_component(&cursor, name)) > 0) {
+        if (strcmp(name, ".") == 0) {
+            continue;
+        }
+        if (strcmp(name, "..") == 0) {
+            if (dir_index != fs.root_directory) {
+                dir_index = fs.files[dir_index].parent_index;
+                while (length > 1 && new_path[length - 1] != '/') {
+                    length--;
+                }
+                if (length > 1) {
+                    length--;   // Drop the separator too, except the root's
+                }
+            }
+            continue;
+        }
+        
+        dir_index = dcache_lookup(dir_index, name);
+        if (dir_index < 0 || !fs.files[dir_index].is_directory) {
+            result = -1;
+            break;
+        }
+        uint32_t name_len = strlen(name);
+        uint32_t separator = (length > 1) ? 1 : 0;
+        if (length + separator + name_len >= MAX_PATH_LENGTH) {
+            vga_puts("Error: Path too long.\n");
+            return -1;
+        }
+        if (separator) {
+            new_path[length++] = '/';
+        }
+        memcpy(new_path + length, name, name_len);
+        length += name_len;
+    }
+    
+    if (result < 0) {
+        vga_printf("Error: Directory '%s' not found.\n", path);
+        return -1;
+    }
+    
+    fs.current_directory = dir_index;
+    memcpy(fs.cwd_path, new_path, length);
+    fs.cwd_path[length] = '\0';
+    fs.cwd_length = length;
+    return 0;
 }
 
-static void memcpy(void* dest, const void* src, uint32_t size) {
-    uint8_t* d = (uint8_t*)dest;
-    const uint8_t* s = (const uint8_t*)src;
-    for (uint32_t i = 0; i < size; i++) {
-        *d++ = *s++;
+int fs_remove_directory(const char* dirname) {
+    PERF_FUNCTION();
+    // Validate directory name
+    if (!dirname || strlen(dirname) == 0) {
+        vga_puts("Error: Invalid directory name.\n");
+        return -1;
     }
-}
-
-// Simple integer to string conversion
-static void itoa(int value, char* buffer, int base) {
-    char* p = buffer;
-    char* p1, *p2;
-    int digits = 0;
     
-    if (value < 0 && base == 10) {
-        *p++ = '-';
-        value = -value;
+    int child = lookup_path(dirname);
+    if (child < 0) {
+        vga_printf("Error: Directory '%s' not found.\n", dirname);
+        return -1;
     }
     
-    do {
-        int remainder = value % base;
-        *p++ = (remainder < 10) ? remainder + '0' : remainder + 'a' - 10;
-        digits++;
-    } while (value /= base);
-    
-    *p = 0;
-    
-    // Reverse string (excluding sign)
-    p1 = (buffer[0] == '-') ? buffer + 1 : buffer;
-    p2 = p - 1;
-    while (p1 < p2) {
-        char tmp = *p1;
-        *p1 = *p2;
-        *p2 = tmp;
-        p1++;
-        p2--;
+    // Check if it's actually a directory
+    if (!fs.files[child].is_directory) {
+        vga_printf("Error: '%s' is not a directory.\n", dirname);
+        return -1;
     }
-}
-
-static void memset(void* ptr, int value, uint32_t size) {
-    uint8_t* p = (uint8_t*)ptr;
-    for (uint32_t i = 0; i < size; i++) {
-        p[i] = (uint8_t)value;
+    
+    // Refuse to pull the current directory out from under us
+    for (int dir = fs.current_directory; dir != -1; dir = fs.files[dir].parent_index) {
+        if (dir == child) {
+            vga_puts("Error: Cannot remove the current directory or one of its parents.\n");
+            return -1;
+        }
     }
-}
-
-// Forward declarations for helper functions
-static void add_child_to_directory(int parent_index, int child_index);
-static void remove_child_from_directory(int parent_index, int child_index);
-
-int fs_init(void) {
-    // Initialize file system structure
-    memset(&fs, 0, sizeof(struct filesystem));
-    fs.data_area = filesystem_data;
-    fs.next_data_offset = 0;
     
-    // Clear all file entries
-    for (int i = 0; i < MAX_FILES; i++) {
-        fs.files[i].used = 0;
-        fs.files[i].size = 0;
-        fs.files[i].data_offset = 0;
-        fs.files[i].is_directory = 0;
-        fs.files[i].parent_index = -1;
-        fs.files[i].first_child_index = -1;
-        fs.files[i].next_sibling_index = -1;
-        memset(fs.files[i].name, 0, MAX_FILENAME_LENGTH);
+    // Check if directory is empty
+    load_initrd_directory(child);
+    if (fs.files[child].child_root_index != -1) {
+        vga_printf("Error: Directory '%s' is not empty.\n", dirname);
+        return -1;
     }
     
-    // Create root directory
-    fs.files[0].used = 1;
-    fs.files[0].is_directory = 1;
-    fs.files[0].parent_index = -1;
-    fs.files[0].first_child_index = -1;
-    fs.files[0].next_sibling_index = -1;
-    strcpy(fs.files[0].name, "/");
-    fs.files[0].size = 0;
-    fs.files[0].data_offset = 0;
+    // Remove from parent
+    int parent = fs.files[child].parent_index;
+    dcache_invalidate(parent, fs.files[child].name);
+    remove_child_from_directory(parent, child);
     
-    fs.root_directory = 0;
-    fs.current_directory = 0;
+    // Mark as unused
+    release_file_entry(child);
+    fs.files[child].is_directory = 0;
+    fs.files[child].child_root_index = -1;
+    memset(fs.files[child].name, 0, MAX_FILENAME_LENGTH);
+    end_operation();
     
-    vga_puts("File system with directory support initialized successfully.\n");
+    vga_printf("Directory '%s' removed successfully.\n", dirname);
     return 0;
 }
 
-static int find_free_file_entry(void) {
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (!fs.files[i].used) {
-            return i;
-        }
+void fs_get_current_path(char* buffer, int buffer_size) {
+    PERF_FUNCTION();
+    uint32_t length = fs.cwd_length;
+    if (buffer_size <= 0) {
+        return;
+    }
+    if (length > (uint32_t)buffer_size - 1) {
+        length = buffer_size - 1;
     }
-    return -1; // No free entries
+    memcpy(buffer, fs.cwd_path, length);
+    buffer[length] = '\0';
 }
 
-static int find_file_entry(const char* filename) {
-    // Look in current directory only
-    int child = fs.files[fs.current_directory].first_child_index;
-    while (child != -1) {
-        if (strcmp(fs.files[child].name, filename) == 0 && !fs.files[child].is_directory) {
-            return child;
+const char* fs_current_path(void) {
+    PERF_FUNCTION();
+    return fs.cwd_path;
+}
+
+// Write each run of set bits in map between first and last as one transfer
+// and clear it
+static int write_dirty_runs(uint32_t* map, uint32_t first, uint32_t last, const uint8_t* source, uint32_t lba) {
+    int written = 0;
+    uint32_t block = first;
+    while (block < last) {
+        if (map[block / 32] == 0) {
+            block = (block / 32 + 1) * 32;
+            continue;
+        }
+        if (!(map[block / 32] & (1u << (block % 32)))) {
+            block++;
+            continue;
+        }
+        uint32_t run = 1;
+        while (block + run < last && (map[(block + run) / 32] & (1u << ((block + run) % 32)))) {
+            run++;
         }
-        child = fs.files[child].next_sibling_index;
+        if (blockdev_write(fs.dev, lba + block, run, source + block * FS_BLOCK_SIZE) != 0) {
+            return -1;
+        }
+        for (uint32_t i = block; i < block + run; i++) {
+            map[i / 32] &= ~(1u << (i % 32));
+        }
+        written += run;
+        block += run;
     }
-    return -1; // File not found
+    return written;
 }
 
-int fs_create_file(const char* filename) {
-    // Check if file already exists in current directory
-    if (find_file_entry(filename) >= 0) {
-        vga_printf("Error: File '%s' already exists.\n", filename);
-        return -1;
+static uint32_t count_bits(const uint32_t* map, uint32_t first, uint32_t last) {
+    uint32_t count = 0;
+    for (uint32_t bit = first; bit < last; bit++) {
+        count += (map[bit / 32] >> (bit % 32)) & 1;
     }
-    
-    // Check if directory with same name exists
-    int child = fs.files[fs.current_directory].first_child_index;
-    while (child != -1) {
-        if (strcmp(fs.files[child].name, filename) == 0 && fs.files[child].is_directory) {
-            vga_printf("Error: Directory '%s' already exists with that name.\n", filename);
+    return count;
+}
+
+// Pin each held indirect block for the commit; -1 if one cannot be read
+static int pin_held_blocks(struct bcache_buf** held) {
+    for (uint32_t i = 0; i < fs.held_count; i++) {
+        held[i] = data_block(fs.held_blocks[i], 0);
+        if (!held[i]) {
+            while (i > 0) {
+                bcache_release(held[--i]);
+            }
             return -1;
         }
-        child = fs.files[child].next_sibling_index;
     }
-    
-    // Check filename length
-    if (strlen(filename) >= MAX_FILENAME_LENGTH) {
-        vga_puts("Error: Filename too long.\n");
+    return 0;
+}
+
+// The transaction is durable: held blocks may be written back normally and
+// blocks freed by it may be reused
+static void end_transaction(struct bcache_buf** held) {
+    for (uint32_t i = 0; i < fs.held_count; i++) {
+        bcache_unhold(held[i]);
+        bcache_release(held[i]);
+    }
+    fs.held_count = 0;
+    fs.super.entry_capacity = fs.entry_capacity;
+    fs.committed_capacity = fs.entry_capacity;
+    fs.pending_operations = 0;
+    release_deferred_frees();
+}
+
+// A transaction too big for the log is written straight home, after the
+// log has been emptied so replay cannot later undo it. Not crash-safe.
+static int write_in_place(uint32_t table_blocks, struct bcache_buf** held) {
+    if (journal_checkpoint(&fs.journal) != 0) {
         return -1;
     }
-    
-    // Find free file entry
-    int index = find_free_file_entry();
-    if (index < 0) {
-        vga_puts("Error: No free file entries available.\n");
+    vga_printf("Warning: Change too large for the journal, writing it in place.\n");
+    for (uint32_t i = 0; i < fs.held_count; i++) {
+        bcache_unhold(held[i]);
+    }
+    int table = write_dirty_runs(fs.dirty_table, 0, table_blocks, (const uint8_t*)fs.files, fs.super.table_start);
+    int cached = bcache_sync(fs.dev);
+    int super = -1;
+    if (table >= 0 && cached >= 0 && blockdev_flush(fs.dev) == 0) {
+        uint32_t capacity = fs.super.entry_capacity;
+        fs.super.entry_capacity = fs.entry_capacity;
+        super = write_superblock();
+        fs.super.entry_capacity = capacity;
+    }
+    if (super != 0) {
+        for (uint32_t i = 0; i < fs.held_count; i++) {
+            bcache_release(held[i]);
+        }
         return -1;
     }
-    
-    // Create the file entry
-    strcpy(fs.files[index].name, filename);
-    fs.files[index].used = 1;
-    fs.files[index].size = 0;
-    fs.files[index].data_offset = fs.next_data_offset;
-    fs.files[index].is_directory = 0;
-    fs.files[index].first_child_index = -1;
-    fs.files[index].next_sibling_index = -1;
-    
-    // Add to current directory
-    add_child_to_directory(fs.current_directory, index);
-    
-    vga_printf("File '%s' created successfully.\n", filename);
-    return 0;
+    end_transaction(held);
+    return 1 + table + cached;
 }
 
-int fs_write_file(const char* filename, const char* data, uint32_t size) {
-    int index = find_file_entry(filename);
-    if (index < 0) {
-        vga_printf("Error: File '%s' not found.\n", filename);
+// Make every change since the last commit durable. Data, and table blocks
+// beyond the table on disk, go to their home blocks first so committed
+// metadata never refers to anything not yet written; then the superblock,
+// changed table blocks and held indirect blocks are logged as one journal
+// transaction. Returns blocks written.
+static int commit_transaction(void) {
+    uint32_t table_blocks = table_bytes(fs.entry_capacity) / FS_BLOCK_SIZE;
+    uint32_t home_blocks = table_bytes(fs.committed_capacity) / FS_BLOCK_SIZE;
+    
+    journal_begin(&fs.journal);
+    int fresh = write_dirty_runs(fs.dirty_table, home_blocks, table_blocks,
+                                 (const uint8_t*)fs.files, fs.super.table_start);
+    int cached = bcache_sync(fs.dev);
+    if (fresh < 0 || cached < 0 || ((fresh || cached) && blockdev_flush(fs.dev) != 0)) {
         return -1;
     }
     
-    if (size > MAX_FILE_SIZE) {
-        vga_printf("Error: File size too large (max %d bytes).\n", MAX_FILE_SIZE);
+    int super_changed = fs.super.entry_capacity != fs.entry_capacity;
+    uint32_t count = count_bits(fs.dirty_table, 0, home_blocks) + super_changed + fs.held_count;
+    struct bcache_buf* held[FS_HELD_BLOCKS_MAX];
+    if (pin_held_blocks(held) != 0) {
         return -1;
     }
+    if (count == 0) {
+        end_transaction(held);
+        return fresh + cached;
+    }
+    if (count > journal_capacity(&fs.journal)) {
+        int written = write_in_place(home_blocks, held);
+        return written < 0 ? -1 : fresh + cached + written;
+    }
     
-    // Check if we have enough space in data area
-    if (fs.next_data_offset + size > FILESYSTEM_MEMORY_SIZE) {
-        vga_puts("Error: Not enough space in file system.\n");
+    int result = journal_reserve(&fs.journal, count);
+    if (result == 0 && super_changed) {
+        uint8_t block[FS_BLOCK_SIZE];
+        struct fs_superblock* super = (struct fs_superblock*)block;
+        memset(block, 0, FS_BLOCK_SIZE);
+        memcpy(super, &fs.super, sizeof(struct fs_superblock));
+        super->entry_capacity = fs.entry_capacity;
+        result = journal_add(&fs.journal, 0, block);
+    }
+    for (uint32_t b = 0; b < home_blocks && result == 0; b++) {
+        if (fs.dirty_table[b / 32] & (1u << (b % 32))) {
+            result = journal_add(&fs.journal, fs.super.table_start + b, (const uint8_t*)fs.files + b * FS_BLOCK_SIZE);
+        }
+    }
+    for (uint32_t i = 0; i < fs.held_count && result == 0; i++) {
+        result = journal_add(&fs.journal, fs.super.data_start + fs.held_blocks[i], held[i]->data);
+    }
+    if (result != 0 || journal_commit(&fs.journal, fs.pending_operations) < 0) {
+        for (uint32_t i = 0; i < fs.held_count; i++) {
+            bcache_release(held[i]);
+        }
         return -1;
     }
     
-    // If file already has data, we'll overwrite it (simple implementation)
-    if (fs.files[index].size == 0) {
-        fs.files[index].data_offset = fs.next_data_offset;
-        fs.next_data_offset += size;
+    for (uint32_t b = 0; b < home_blocks; b++) {
+        fs.dirty_table[b / 32] &= ~(1u << (b % 32));
     }
-    
-    // Write data
-    memcpy(fs.data_area + fs.files[index].data_offset, data, size);
-    fs.files[index].size = size;
-    
-    vga_printf("Data written to file '%s' (%d bytes).\n", filename, size);
-    return 0;
+    end_transaction(held);
+    return fresh + cached + (int)count;
 }
 
-int fs_read_file(const char* filename, char* buffer, uint32_t buffer_size) {
-    int index = find_file_entry(filename);
-    if (index < 0) {
-        vga_printf("Error: File '%s' not found.\n", filename);
-        return -1;
+// Called as each operation that changes metadata finishes; changes are
+// committed in batches so one journal write covers many operations
+static void end_operation(void) {
+    if (!journaling()) {
+        return;
     }
-    
-    if (fs.files[index].size == 0) {
-        vga_printf("File '%s' is empty.\n", filename);
+    fs.pending_operations++;
+    if (fs.pending_operations >= FS_COMMIT_BATCH || fs.held_count > FS_HELD_BLOCKS_MAX / 2) {
+        fs_commit();
+    }
+}
+
+int fs_commit(void) {
+    PERF_FUNCTION();
+    if (!journaling()) {
         return 0;
     }
-    
-    uint32_t copy_size = fs.files[index].size;
-    if (copy_size > buffer_size - 1) {
-        copy_size = buffer_size - 1;
+    int result = commit_transaction();
+    if (result < 0) {
+        vga_printf("Error: Journal commit on %s failed.\n", fs.dev->name);
     }
-    
-    memcpy(buffer, fs.data_area + fs.files[index].data_offset, copy_size);
-    buffer[copy_size] = '\0'; // Null-terminate for text files
-    
-    return copy_size;
+    return result;
 }
 
-int fs_delete_file(const char* filename) {
-    int index = find_file_entry(filename);
-    if (index < 0) {
-        vga_printf("Error: File '%s' not found.\n", filename);
+int fs_get_journal_stats(struct journal_stats* stats) {
+    PERF_FUNCTION();
+    if (!journaling()) {
         return -1;
     }
-    
-    // Remove from parent directory
-    remove_child_from_directory(fs.current_directory, index);
-    
-    // Mark file entry as unused
-    fs.files[index].used = 0;
-    fs.files[index].size = 0;
-    memset(fs.files[index].name, 0, MAX_FILENAME_LENGTH);
-    
-    vga_printf("File '%s' deleted successfully.\n", filename);
+    journal_get_stats(&fs.journal, stats);
     return 0;
 }
 
-int fs_list_files(void) {
-    char current_path[MAX_PATH_LENGTH];
-    char count_str[16];
-    fs_get_current_path(current_path, MAX_PATH_LENGTH);
-    
-    vga_puts("Contents of ");
-    vga_puts(current_path);
-    vga_puts(":\n");
-    vga_puts("Type Name                    Size (bytes)\n");
-    vga_puts("----------------------------------------\n");
-    
-    int count = 0;
-    int child = fs.files[fs.current_directory].first_child_index;
-    
-    while (child != -1) {
-        if (fs.files[child].is_directory) {
-            vga_set_color(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
-            vga_puts("DIR  ");
-            vga_puts(fs.files[child].name);
-            
-            // Pad to 20 characters
-            int name_len = strlen(fs.files[child].name);
-            for (int i = name_len; i < 20; i++) {
-                vga_putchar(' ');
-            }
-            vga_puts(" <DIR>\n");
-            vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
-        } else {
-            vga_puts("FILE ");
-            vga_puts(fs.files[child].name);
-            
-            // Pad to 20 characters
-            int name_len = strlen(fs.files[child].name);
-            for (int i = name_len; i < 20; i++) {
-                vga_putchar(' ');
-            }
-            vga_putchar(' ');
-            
-            // Convert size to string
-            itoa(fs.files[child].size, count_str, 10);
-            vga_puts(count_str);
-            vga_putchar('\n');
-        }
-        count++;
-        child = fs.files[child].next_sibling_index;
+// With a journal, sync is a commit. Otherwise the entry table is written
+// straight from memory, and the superblock, indirect blocks and file data
+// are written back from the buffer cache.
+int fs_sync(void) {
+    PERF_FUNCTION();
+    if (journaling()) {
+        return fs_commit();
     }
     
-    if (count == 0) {
-        vga_puts("Directory is empty.\n");
-    } else {
-        vga_puts("\nTotal: ");
-        itoa(count, count_str, 10);
-        vga_puts(count_str);
-        vga_puts(" items\n");
+    struct bcache_buf* buf = bcache_get(fs.dev, 0);
+    if (!buf) {
+        return -1;
     }
+    fs.super.entry_capacity = fs.entry_capacity;
+    memset(buf->data, 0, FS_BLOCK_SIZE);
+    memcpy(buf->data, &fs.super, sizeof(struct fs_superblock));
+    bcache_mark_dirty(buf);
+    bcache_release(buf);
     
-    return count;
+    int table = write_dirty_runs(fs.dirty_table, 0, table_bytes(fs.entry_capacity) / FS_BLOCK_SIZE,
+                                 (const uint8_t*)fs.files, fs.super.table_start);
+    int cached = bcache_sync(fs.dev);
+    if (table < 0 || cached < 0 || blockdev_flush(fs.dev) != 0) {
+        vga_printf("Error: Write to %s failed during sync.\n", fs.dev->name);
+        return -1;
+    }
+    return table + cached;
 }
 
-int fs_file_exists(const char* filename) {
-    return find_file_entry(filename) >= 0;
+// Consistency checking. Every violation is reported with the entry it was
+// found at; the walk reads the tables but never changes them, so lazy
+// initrd directories are checked as they are and not loaded.
+static int check_failed(const char* problem, int index) {
+    vga_printf("Error: Check failed at entry %d: %s.\n", index, problem);
+    return -1;
 }
 
-uint32_t fs_get_file_size(const char* filename) {
-    int index = find_file_entry(filename);
-    if (index >= 0) {
-        return fs.files[index].size;
-    }
-    return 0;
+static int test_bit(const uint32_t* map, uint32_t bit) {
+    return (map[bit / 32] >> (bit % 32)) & 1;
 }
 
-// Helper function to add child to parent directory
-static void add_child_to_directory(int parent_index, int child_index) {
-    if (fs.files[parent_index].first_child_index == -1) {
-        // First child
-        fs.files[parent_index].first_child_index = child_index;
-    } else {
-        // Find last sibling and add new child
-        int sibling = fs.files[parent_index].first_child_index;
-        while (fs.files[sibling].next_sibling_index != -1) {
-            sibling = fs.files[sibling].next_sibling_index;
+// Mark data blocks as owned by index; each block may have one owner
+static int claim_blocks(uint32_t* owned, uint32_t start, uint32_t count, int index) {
+    if (start >= fs.data_blocks || count > fs.data_blocks - start) {
+        return check_failed("extent outside the data area", index);
+    }
+    for (uint32_t block = start; block < start + count; block++) {
+        if (test_bit(owned, block)) {
+            return check_failed("data block owned twice", index);
         }
-        fs.files[sibling].next_sibling_index = child_index;
+        set_bits(owned, block, 1);
     }
-    fs.files[child_index].parent_index = parent_index;
+    return 0;
 }
 
-// Helper function to remove child from parent directory
-static void remove_child_from_directory(int parent_index, int child_index) {
-    if (fs.files[parent_index].first_child_index == child_index) {
-        // Removing first child
-        fs.files[parent_index].first_child_index = fs.files[child_index].next_sibling_index;
-    } else {
-        // Find previous sibling
-        int sibling = fs.files[parent_index].first_child_index;
-        while (sibling != -1 && fs.files[sibling].next_sibling_index != child_index) {
-            sibling = fs.files[sibling].next_sibling_index;
+static int check_file(int index, uint32_t* owned) {
+    struct file_entry* entry = &fs.files[index];
+    if (entry->child_root_index != -1) {
+        return check_failed("file with children", index);
+    }
+    if (entry->size > MAX_FILE_SIZE) {
+        return check_failed("size over the limit", index);
+    }
+    if (entry->flags & FS_ENTRY_INITRD) {
+        return 0;   // Data is in the module, not the data area
+    }
+    if (entry->extent_count > FS_MAX_EXTENTS || blocks_for_size(entry->size) > entry->block_count) {
+        return check_failed("size beyond the file's blocks", index);
+    }
+    if (entry->extent_count > FS_DIRECT_EXTENTS && claim_blocks(owned, entry->indirect_block, 1, index) != 0) {
+        return -1;
+    }
+    
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < entry->extent_count; i++) {
+        struct fs_extent extent;
+        if (get_extent(entry, i, &extent) != 0) {
+            return check_failed("indirect block unreadable", index);
         }
-        if (sibling != -1) {
-            fs.files[sibling].next_sibling_index = fs.files[child_index].next_sibling_index;
+        if (extent.block_count == 0) {
+            return check_failed("empty extent", index);
         }
+        if (claim_blocks(owned, extent.start_block, extent.block_count, index) != 0) {
+            return -1;
+        }
+        total += extent.block_count;
     }
+    if (total != entry->block_count) {
+        return check_failed("extents disagree with block count", index);
+    }
+    return 0;
 }
 
-int fs_create_directory(const char* dirname) {
-    // Check if directory already exists
-    int child = fs.files[fs.current_directory].first_child_index;
-    while (child != -1) {
-        if (strcmp(fs.files[child].name, dirname) == 0) {
-            vga_printf("Error: Directory '%s' already exists.\n", dirname);
-            return -1;
+// Check one directory's name index below node: names in strict order
+// between low and high, every node used, linked once and pointing back at
+// dir, stored heights right and AVL-balanced. Returns the height or -1.
+static int check_subtree(int dir, int node, const char* low, const char* high, uint32_t* seen, int depth) {
+    if (node < 0) {
+        return 0;
+    }
+    if ((uint32_t)node >= fs.entry_capacity || depth > FS_INDEX_MAX_DEPTH) {
+        return check_failed("bad index link", dir);
+    }
+    struct file_entry* entry = &fs.files[node];
+    if (!entry->used) {
+        return check_failed("free entry linked into a directory", node);
+    }
+    if (test_bit(seen, node)) {
+        return check_failed("entry linked twice", node);
+    }
+    set_bits(seen, node, 1);
+    if (entry->parent_index != dir) {
+        return check_failed("parent pointer disagrees with the directory", node);
+    }
+    
+    int length = 0;
+    while (length < MAX_FILENAME_LENGTH && entry->name[length]) {
+        if (entry->name[length] == '/') {
+            return check_failed("name contains '/'", node);
         }
-        child = fs.files[child].next_sibling_index;
+        length++;
+    }
+    if (length == 0 || length == MAX_FILENAME_LENGTH) {
+        return check_failed("empty or unterminated name", node);
+    }
+    if ((low && strcmp(entry->name, low) <= 0) || (high && strcmp(entry->name, high) >= 0)) {
+        return check_failed("name out of order in the directory index", node);
     }
     
-    // Check dirname length
-    if (strlen(dirname) >= MAX_FILENAME_LENGTH) {
-        vga_puts("Error: Directory name too long.\n");
+    int left = check_subtree(dir, entry->left_index, low, entry->name, seen, depth + 1);
+    if (left < 0) {
         return -1;
     }
-    
-    // Find free file entry
-    int index = find_free_file_entry();
-    if (index < 0) {
-        vga_puts("Error: No free file entries available.\n");
+    int right = check_subtree(dir, entry->right_index, entry->name, high, seen, depth + 1);
+    if (right < 0) {
         return -1;
     }
-    
-    // Create the directory entry
-    strcpy(fs.files[index].name, dirname);
-    fs.files[index].used = 1;
-    fs.files[index].is_directory = 1;
-    fs.files[index].size = 0;
-    fs.files[index].data_offset = 0;
-    fs.files[index].first_child_index = -1;
-    fs.files[index].next_sibling_index = -1;
-    
-    // Add to current directory
-    add_child_to_directory(fs.current_directory, index);
-    
-    vga_printf("Directory '%s' created successfully.\n", dirname);
-    return 0;
-}
-
-int fs_resolve_path(const char* path) {
-    if (path[0] == '/') {
-        // Absolute path - start from root
-        return fs.root_directory;
-    } else if (strcmp(path, ".") == 0) {
-        // Current directory
-        return fs.current_directory;
-    } else if (strcmp(path, "..") == 0) {
-        // Parent directory
-        int parent = fs.files[fs.current_directory].parent_index;
-        return (parent == -1) ? fs.root_directory : parent;
-    } else {
-        // Relative path - look in current directory
-        int child = fs.files[fs.current_directory].first_child_index;
-        while (child != -1) {
-            if (strcmp(fs.files[child].name, path) == 0 && fs.files[child].is_directory) {
-                return child;
-            }
-            child = fs.files[child].next_sibling_index;
-        }
+    int height = (left > right ? left : right) + 1;
+    if (entry->tree_height != height) {
+        return check_failed("stored index height is wrong", node);
     }
-    return -1; // Not found
+    if (left - right > 1 || right - left > 1) {
+        return check_failed("directory index unbalanced", node);
+    }
+    return height;
 }
 
-int fs_change_directory(const char* path) {
-    int target_dir = fs_resolve_path(path);
-    if (target_dir == -1) {
-        vga_printf("Error: Directory '%s' not found.\n", path);
+// Verify every structural invariant: the entry bitmap and count, each
+// directory's index and parent links, that every entry is reachable from
+// the root, file extents, and that owned, free and deferred blocks exactly
+// cover the data area. Returns the entries checked or -1.
+int fs_check(void) {
+    PERF_FUNCTION();
+    uint32_t* seen = kzalloc((fs.entry_capacity + 31) / 32 * sizeof(uint32_t));
+    uint32_t* owned = kzalloc((fs.data_blocks + 31) / 32 * sizeof(uint32_t));
+    if (!seen || !owned) {
+        kfree(seen);
+        kfree(owned);
+        vga_puts("Error: Not enough memory to check the file system.\n");
         return -1;
     }
     
-    fs.current_directory = target_dir;
-    return 0;
-}
-
-int fs_remove_directory(const char* dirname) {
-    // Validate directory name
-    if (!dirname || strlen(dirname) == 0) {
-        vga_puts("Error: Invalid directory name.\n");
-        return -1;
+    int result = 0;
+    struct file_entry* root = &fs.files[0];
+    if (!root->used || !root->is_directory || root->parent_index != -1) {
+        result = check_failed("root is not a directory", 0);
     }
+    set_bits(seen, 0, 1);
     
-    // Find directory in current directory
-    int child = fs.files[fs.current_directory].first_child_index;
-    while (child != -1) {
-        if (strcmp(fs.files[child].name, dirname) == 0) {
-            // Check if it's actually a directory
-            if (!fs.files[child].is_directory) {
-                vga_printf("Error: '%s' is not a directory.\n", dirname);
-                return -1;
-            }
-            
-            // Check if directory is empty
-            if (fs.files[child].first_child_index != -1) {
-                vga_printf("Error: Directory '%s' is not empty.\n", dirname);
-                return -1;
-            }
-            
-            // Remove from parent
-            remove_child_from_directory(fs.current_directory, child);
-            
-            // Mark as unused
-            fs.files[child].used = 0;
-            fs.files[child].is_directory = 0;
-            fs.files[child].first_child_index = -1;
-            fs.files[child].next_sibling_index = -1;
-            memset(fs.files[child].name, 0, MAX_FILENAME_LENGTH);
-            
-            vga_printf("Directory '%s' removed successfully.\n", dirname);
-            return 0;
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < fs.entry_capacity && result == 0; i++) {
+        struct file_entry* entry = &fs.files[i];
+        if (test_bit(fs.entry_map, i) != (entry->used != 0)) {
+            result = check_failed("entry bitmap disagrees with the table", i);
+            break;
+        }
+        if (!entry->used) {
+            continue;
+        }
+        used++;
+        
+        int open = 0;
+        for (int fd = 0; fd < FS_MAX_OPEN_FILES; fd++) {
+            open += open_files[fd].index == (int)i;
+        }
+        if (entry->open_count != open) {
+            result = check_failed("open count disagrees with descriptors", i);
+        } else if (!entry->is_directory) {
+            result = check_file(i, owned);
+        } else if (entry->extent_count || entry->block_count || entry->size) {
+            result = check_failed("directory owns data", i);
+        } else if (check_subtree(i, entry->child_root_index, 0, 0, seen, 0) < 0) {
+            result = -1;
         }
-        child = fs.files[child].next_sibling_index;
     }
-    
-    vga_printf("Error: Directory '%s' not found.\n", dirname);
-    return -1;
-}
-
-void fs_get_current_path(char* buffer, int buffer_size) {
-    if (fs.current_directory == fs.root_directory) {
-        if (buffer_size > 1) {
-            buffer[0] = '/';
-            buffer[1] = '\0';
+    if (result == 0 && used != fs.used_entries) {
+        result = check_failed("used entry count is wrong", -1);
+    }
+    for (uint32_t i = 0; i < fs.entry_capacity && result == 0; i++) {
+        if (fs.files[i].used && !test_bit(seen, i)) {
+            result = check_failed("entry not reachable from the root", i);
         }
-        return;
     }
     
-    // Build path recursively
-    int path_components[MAX_FILES];
-    int component_count = 0;
-    
-    int current = fs.current_directory;
-    while (current != fs.root_directory && current != -1) {
-        path_components[component_count++] = current;
-        current = fs.files[current].parent_index;
+    // Owned, free and not yet released blocks must tile the data area
+    for (uint32_t i = 0; i < fs.deferred_count && result == 0; i++) {
+        result = claim_blocks(owned, fs.deferred_free[i].start_block, fs.deferred_free[i].block_count, -1);
     }
-    
-    // Build path string
-    int pos = 0;
-    buffer[pos++] = '/';
-    
-    for (int i = component_count - 1; i >= 0 && pos < buffer_size - 1; i--) {
-        int name_len = strlen(fs.files[path_components[i]].name);
-        if (pos + name_len + 1 < buffer_size) {
-            for (int j = 0; j < name_len; j++) {
-                buffer[pos++] = fs.files[path_components[i]].name[j];
-            }
-            if (i > 0) {
-                buffer[pos++] = '/';
+    uint32_t owned_blocks = 0;
+    for (uint32_t block = 0; block < fs.data_blocks && result == 0; block++) {
+        owned_blocks += test_bit(owned, block);
+    }
+    uint32_t free_blocks = 0;
+    uint32_t start = 0;
+    uint32_t length = 0;
+    for (uint32_t block = 0; result == 0 && extent_next_free(&fs.space, block, &start, &length) == 0;
+         block = start + length) {
+        for (uint32_t b = start; b < start + length && result == 0; b++) {
+            if (test_bit(owned, b)) {
+                result = check_failed("owned block on the free list", -1);
             }
         }
+        free_blocks += length;
+    }
+    if (result == 0 && (free_blocks != fs.space.free_blocks || owned_blocks + free_blocks != fs.data_blocks)) {
+        result = check_failed("data blocks leaked or double counted", -1);
     }
     
-    buffer[pos] = '\0';
+    kfree(seen);
+    kfree(owned);
+    return result < 0 ? -1 : (int)used;
 }
 
 void fs_print_info(void) {
+    PERF_FUNCTION();
     int used_entries = 0;
     int directories = 0;
     int files = 0;
     uint32_t total_size = 0;
+    int initrd_files = 0;
+    uint32_t initrd_bytes = 0;
     
-    for (int i = 0; i < MAX_FILES; i++) {
+    for (uint32_t i = 0; i < fs.entry_capacity; i++) {
         if (fs.files[i].used) {
             used_entries++;
             if (fs.files[i].is_directory) {
                 directories++;
+            } else if (fs.files[i].flags & FS_ENTRY_INITRD) {
+                files++;
+                initrd_files++;
+                initrd_bytes += fs.files[i].size;
             } else {
                 files++;
                 total_size += fs.files[i].size;
@@ -529,13 +2402,36 @@ void fs_print_info(void) {
         }
     }
     
-    char current_path[MAX_PATH_LENGTH];
-    fs_get_current_path(current_path, MAX_PATH_LENGTH);
-    
     vga_puts("\nFile System Information:\n");
-    vga_printf("Current Directory: %s\n", current_path);
-    vga_printf("Total entries: %d/%d\n", used_entries, MAX_FILES);
+    vga_printf("Current Directory: %s\n", fs.cwd_path);
+    vga_printf("Total entries: %d/%u (table holds %u)\n", used_entries, fs.entry_limit, fs.entry_capacity);
     vga_printf("Directories: %d, Files: %d\n", directories, files);
-    vga_printf("Data used: %d/%d bytes\n", total_size, FILESYSTEM_MEMORY_SIZE);
-    vga_printf("Free space: %d bytes\n", FILESYSTEM_MEMORY_SIZE - total_size);
+    struct extent_stats space;
+    extent_get_stats(&fs.space, &space);
+    uint32_t used_blocks = space.total_blocks - space.free_blocks;
+    
+    vga_printf("Data used: %u bytes in %u blocks of %u bytes\n", total_size, used_blocks, FS_BLOCK_SIZE);
+    vga_printf("Free space: %u/%u bytes in %u extents (largest %u bytes)\n",
+               space.free_blocks * FS_BLOCK_SIZE, fs.data_blocks * FS_BLOCK_SIZE,
+               space.free_extents, space.largest_free * FS_BLOCK_SIZE);
+    if (space.free_blocks) {
+        // Share of free space unusable for a single allocation of that size
+        uint32_t fragmentation = 100 - space.largest_free * 100 / space.free_blocks;
+        vga_printf("Fragmentation: %u%%\n", fragmentation);
+    }
+    vga_printf("Slack and extent blocks: %u bytes\n", used_blocks * FS_BLOCK_SIZE - total_size);
+    vga_printf("Storage: %s, %u blocks, data from block %u\n",
+               fs.dev->name, fs.dev->block_count, fs.super.data_start);
+    if (fs.dev != ata_block_device()) {
+        vga_printf("Ramdisk memory: %u bytes\n", ramdisk_memory_used(fs.dev));
+    }
+    if (journaling()) {
+        vga_printf("Journal: %u blocks from block %u, %u operations not yet committed\n",
+                   fs.super.journal_blocks, fs.super.journal_start, fs.pending_operations);
+    }
+    if (initrd_present()) {
+        vga_printf("Initrd: %d files (%u bytes) served from the %u KiB module\n",
+                   initrd_files, initrd_bytes, initrd_size() / 1024);
+    }
+    vga_printf("Lookup cache: %u hits, %u misses\n", dcache_hits, dcache_misses);
 }
\ No newline at end of file
@@ -1,35 +1,154 @@
-// filesystem.h - Simple in-memory file system
+// filesystem.h - Simple file system on a cached block device
 #ifndef FILESYSTEM_H
 #define FILESYSTEM_H
 
 #include <stdint.h>
+#include "extent.h"
+#include "bcache.h"
+#include "journal.h"
 
-#define MAX_FILES 64
 #define MAX_FILENAME_LENGTH 32
-#define MAX_FILE_SIZE 1024
+#define MAX_FILE_SIZE (4 * 1024 * 1024)
 #define MAX_PATH_LENGTH 256
-#define FILESYSTEM_MEMORY_SIZE (MAX_FILES * MAX_FILE_SIZE + MAX_FILES * sizeof(struct file_entry))
+
+// File data lives in FS_BLOCK_SIZE blocks handed out by the extent allocator
+#define FS_BLOCK_SIZE 512
+
+// A file is a list of extents: the first few live in its entry, the rest in
+// one indirect block of the data area
+#define FS_DIRECT_EXTENTS 4
+#define FS_INDIRECT_EXTENTS (FS_BLOCK_SIZE / sizeof(struct fs_extent))
+#define FS_MAX_EXTENTS (FS_DIRECT_EXTENTS + FS_INDIRECT_EXTENTS)
+
+// Entry and data limits are chosen at fs_init() from free memory: the entry
+// table may use 1/16 of it and a ramdisk's data area 1/4, within these
+// bounds. The upper bounds keep each table inside one 4 MiB buddy block.
+#define FS_MIN_ENTRIES 64
+#define FS_MAX_ENTRIES 32768
+#define FS_MIN_DATA_BLOCKS 128
+#define FS_MAX_DATA_BLOCKS 8184
+
+// A disk's data area only costs memory for the extent allocator's maps,
+// FS_EXTENT_MAP_BYTES per block. They may use 1/8 of free memory, and the
+// bound (256 MiB of data) keeps the largest inside one buddy block.
+#define FS_MAX_DISK_DATA_BLOCKS 524280
+#define FS_EXTENT_MAP_BYTES 16
+
+// The entry table and data area start small and grow on demand
+#define FS_INITIAL_ENTRIES 8
+#define FS_INITIAL_DATA_SIZE 4096
+
+// Deepest possible AVL name index (far beyond any reachable entry count)
+#define FS_INDEX_MAX_DEPTH 48
+
+// Open file table size and fs_open() flags
+#define FS_MAX_OPEN_FILES 32
+#define FS_O_RDONLY 0x00
+#define FS_O_WRONLY 0x01
+#define FS_O_RDWR   0x02
+#define FS_O_ACCMODE 0x03
+#define FS_O_CREAT  0x04
+#define FS_O_TRUNC  0x08
+#define FS_O_APPEND 0x10
+
+// fs_seek() origins
+#define FS_SEEK_SET 0
+#define FS_SEEK_CUR 1
+#define FS_SEEK_END 2
+
+// On-disk layout in FS_BLOCK_SIZE sectors: superblock, entry table, data,
+// metadata journal. Version 1 had no journal; one is added when mounted.
+#define FS_MAGIC 0x31534F4D   // "MOS1"
+#define FS_VERSION 2
+#define FS_JOURNAL_BLOCKS 1024
+
+// Group commit: metadata changes are committed to the journal together
+// after this many operations, or sooner by fs_commit()
+#define FS_COMMIT_BATCH 32
+
+// Indirect blocks one transaction can hold back from write-back
+#define FS_HELD_BLOCKS_MAX 64
+
+struct fs_superblock {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t entry_size;        // sizeof(struct file_entry) when formatted
+    uint32_t entry_limit;
+    uint32_t entry_capacity;    // Entries stored in the table as of the last sync
+    uint32_t table_start;       // First block of the entry table
+    uint32_t table_blocks;      // Room reserved for entry_limit entries
+    uint32_t data_start;        // Disk block of data block 0
+    uint32_t data_blocks;
+    uint32_t journal_start;     // 0 if there is no journal
+    uint32_t journal_blocks;
+};
+
+// Slots in the direct-mapped (parent, name) -> entry lookup cache
+#define FS_DCACHE_SIZE 256
+
+// Files that can be mapped with fs_map_file() at the same time
+#define FS_MAX_MAPPINGS 16
+
+// Entries backed by the boot initrd. Neither survives a reboot: mounting
+// drops initrd files and lazy marks, and the archive is attached afresh.
+#define FS_ENTRY_INITRD 0x01    // File data is in the module at extents[0].start_block
+#define FS_ENTRY_LAZY   0x02    // Directory whose archive members are not loaded yet;
+                                // extents[0].start_block is its own header offset
+#define FS_INITRD_ROOT  0xFFFFFFFF  // Header offset standing for the archive root
+
+struct fs_extent {
+    uint32_t start_block;
+    uint32_t block_count;
+};
 
 struct file_entry {
     char name[MAX_FILENAME_LENGTH];
     uint32_t size;
-    uint32_t data_offset;
+    uint32_t block_count;    // Data blocks owned by the file, over all extents
+    struct fs_extent extents[FS_DIRECT_EXTENTS];  // First extents, in file order
+    uint32_t indirect_block; // Further extents (if extent_count > FS_DIRECT_EXTENTS)
+    uint8_t extent_count;
     uint8_t used;
     uint8_t is_directory;
+    uint8_t tree_height;     // Height of this node's subtree in the parent's index
+    uint8_t open_count;      // Open descriptors referring to this file
+    uint8_t flags;           // FS_ENTRY_* (fits in padding; entry size unchanged)
     int parent_index;        // Index of parent directory (-1 for root)
-    int first_child_index;   // Index of first child (-1 if no children)
-    int next_sibling_index;  // Index of next sibling (-1 if last sibling)
+    int child_root_index;    // Root of this directory's name index (-1 if empty)
+    int left_index;          // Index siblings that sort before this name
+    int right_index;         // ...and after it
 };
 
 struct filesystem {
-    struct file_entry files[MAX_FILES];
-    uint8_t* data_area;
-    uint32_t next_data_offset;
+    struct file_entry* files;   // Heap-allocated, entry_capacity entries
+    uint32_t entry_capacity;
+    uint32_t entry_limit;       // Most entries the table may grow to
+    uint32_t* entry_map;        // One bit per entry up to entry_limit, set = in use
+    uint32_t entry_hint;        // No free entry in map words below this one
+    uint32_t used_entries;
+    uint32_t data_blocks;
+    uint32_t layout_generation; // Bumped whenever a file gives up blocks
+    struct block_device* dev;   // ATA disk, or a ramdisk when there is none
+    struct fs_superblock super;
+    uint32_t* dirty_table;      // Entry table blocks changed since the last sync
+    struct journal journal;     // Used when super.journal_blocks is set
+    uint32_t committed_capacity;    // Entries the on-disk table holds
+    uint32_t pending_operations;    // Since the last commit
+    uint32_t held_blocks[FS_HELD_BLOCKS_MAX];   // Changed indirect blocks
+    uint32_t held_count;
+    struct fs_extent* deferred_free;    // Freed since the last commit
+    uint32_t deferred_count;
+    uint32_t deferred_capacity;
+    struct extent_allocator space;  // Free data blocks
     int current_directory;   // Index of current working directory
+    char cwd_path[MAX_PATH_LENGTH];  // Absolute path of current_directory
+    uint32_t cwd_length;
     int root_directory;      // Index of root directory
 };
 
-// File system operations
+// File system operations; every name argument may be a relative or
+// absolute path with any number of components
 int fs_init(void);
 int fs_create_file(const char* filename);
 int fs_write_file(const char* filename, const char* data, uint32_t size);
@@ -39,19 +158,60 @@ int fs_list_files(void);
 int fs_file_exists(const char* filename);
 uint32_t fs_get_file_size(const char* filename);
 
+// Descriptor-based I/O. A descriptor holds the resolved entry, so reads
+// and writes through it never repeat the path lookup.
+int fs_open(const char* path, int flags);
+int fs_read(int fd, void* buffer, uint32_t count);
+int fs_write(int fd, const void* data, uint32_t count);
+int fs_seek(int fd, int32_t offset, int whence);
+int fs_close(int fd);
+
+// Zero-copy reads: walk a file as spans pointing straight into the buffer
+// cache. A span stays valid until the next fs_view_next() or fs_view_close().
+// Remembers where the last offset lookup landed so sequential access
+// translates offsets to blocks in O(1)
+struct fs_cursor {
+    uint32_t extent;        // Extent index
+    uint32_t base;          // File offset where that extent starts
+    uint32_t generation;    // layout_generation the position was taken at
+};
+
+struct fs_view {
+    int index;
+    uint32_t offset;
+    struct fs_cursor cursor;
+    struct bcache_buf* buffer;  // Pinned while its span is in use
+};
+int fs_view_open(const char* path, struct fs_view* view);
+int fs_view_next(struct fs_view* view, const char** data, uint32_t* length);
+void fs_view_close(struct fs_view* view);
+
+// Memory-mapped access: pages are filled from the file on first touch
+const void* fs_map_file(const char* filename, uint32_t* size);
+int fs_unmap_file(const void* address);
+
 // Directory operations
 int fs_create_directory(const char* dirname);
 int fs_change_directory(const char* path);
 int fs_remove_directory(const char* dirname);
 int fs_list_directory(const char* path);
 void fs_get_current_path(char* buffer, int buffer_size);
+const char* fs_current_path(void);
 
 // Path operations
 int fs_resolve_path(const char* path);
 int fs_get_parent_directory(int dir_index);
 void fs_get_full_path(int file_index, char* buffer, int buffer_size);
 
+// Write changed metadata and data back to disk; returns blocks written
+int fs_sync(void);
+
+// Commit pending metadata changes to the journal as one transaction
+int fs_commit(void);
+int fs_get_journal_stats(struct journal_stats* stats);
+
 // Helper functions
 void fs_print_info(void);
+int fs_check(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,51 @@
+// gdt.c - Global descriptor table setup
+#include "gdt.h"
+
+// GRUB leaves us with a GDT of unknown location, so install our own flat one
+static struct gdt_entry gdt[GDT_ENTRIES];
+static struct gdt_pointer gdt_ptr;
+
+static void gdt_set_entry(int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t granularity) {
+    gdt[index].base_low = base & 0xFFFF;
+    gdt[index].base_middle = (base >> 16) & 0xFF;
+    gdt[index].base_high = (base >> 24) & 0xFF;
+    gdt[index].limit_low = limit & 0xFFFF;
+    gdt[index].granularity = ((limit >> 16) & 0x0F) | (granularity & 0xF0);
+    gdt[index].access = access;
+}
+
+void gdt_init(void) {
+    gdt_set_entry(0, 0, 0, 0, 0);                 // Null descriptor
+    gdt_set_entry(1, 0, 0xFFFFFFFF, 0x9A, 0xCF);  // Kernel code: ring 0, 4 GiB, 32-bit
+    gdt_set_entry(2, 0, 0xFFFFFFFF, 0x92, 0xCF);  // Kernel data: ring 0, 4 GiB, 32-bit
+
+    // Per-CPU data: byte-granular segments just covering each struct cpu
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        cpus[i].self = &cpus[i];
+        cpus[i].index = i;
+        gdt_set_entry(GDT_CPU_FIRST + i, (uint32_t)&cpus[i], sizeof(struct cpu) - 1, 0x92, 0x40);
+    }
+
+    gdt_ptr.limit = sizeof(gdt) - 1;
+    gdt_ptr.base = (uint32_t)&gdt;
+    gdt_load(0);
+}
+
+// Load the table on the calling CPU, then reload every segment register
+// from it, with %gs selecting the CPU's own data
+void gdt_load(uint32_t cpu) {
+    __asm__ volatile(
+        "lgdt %0\n"
+        "ljmp %1, $1f\n"
+        "1:\n"
+        "mov %2, %%ax\n"
+        "mov %%ax, %%ds\n"
+        "mov %%ax, %%es\n"
+        "mov %%ax, %%fs\n"
+        "mov %%ax, %%ss\n"
+        "mov %w3, %%ax\n"
+        "mov %%ax, %%gs\n"
+        :
+        : "m"(gdt_ptr), "i"(GDT_KERNEL_CODE), "i"(GDT_KERNEL_DATA), "r"(GDT_CPU_DATA(cpu))
+        : "eax", "memory");
+}
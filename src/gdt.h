@@ -0,0 +1,36 @@
+// gdt.h - Global descriptor table setup
+#ifndef GDT_H
+#define GDT_H
+
+#include <stdint.h>
+#include "smp.h"
+
+// Segment selectors used by the kernel
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+
+// Then one data segment per CPU, based at its struct cpu, for %gs
+#define GDT_CPU_FIRST 3
+#define GDT_CPU_DATA(cpu) ((GDT_CPU_FIRST + (cpu)) * 8)
+
+#define GDT_ENTRIES (GDT_CPU_FIRST + SMP_MAX_CPUS)
+
+struct gdt_entry {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_middle;
+    uint8_t access;
+    uint8_t granularity;
+    uint8_t base_high;
+} __attribute__((packed));
+
+struct gdt_pointer {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+
+// Function prototypes
+void gdt_init(void);
+void gdt_load(uint32_t cpu);
+
+#endif
@@ -0,0 +1,112 @@
+// idt.c - Interrupt descriptor table and interrupt dispatch
+#include "idt.h"
+#include "gdt.h"
+#include "pic.h"
+#include "apic.h"
+#include "vga.h"
+
+#define IDT_INTERRUPT_GATE 0x8E  // Present, ring 0, 32-bit interrupt gate
+
+static struct idt_entry idt[IDT_ENTRIES];
+static struct idt_pointer idt_ptr;
+static interrupt_handler_t handlers[IDT_ENTRIES];
+
+extern uint32_t isr_stub_table[IDT_STUB_COUNT];
+
+static const char* exception_names[32] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow", "Bound range exceeded",
+    "Invalid opcode", "Device not available", "Double fault", "Coprocessor segment overrun",
+    "Invalid TSS", "Segment not present", "Stack-segment fault", "General protection fault",
+    "Page fault", "Reserved", "x87 floating-point error", "Alignment check", "Machine check",
+    "SIMD floating-point error", "Virtualization exception", "Control protection exception",
+    "Reserved", "Reserved", "Reserved", "Reserved", "Reserved", "Reserved", "Reserved",
+    "Reserved", "Security exception", "Reserved"
+};
+
+static void idt_set_gate(int vector, uint32_t offset) {
+    idt[vector].offset_low = offset & 0xFFFF;
+    idt[vector].offset_high = (offset >> 16) & 0xFFFF;
+    idt[vector].selector = GDT_KERNEL_CODE;
+    idt[vector].zero = 0;
+    idt[vector].type_attr = IDT_INTERRUPT_GATE;
+}
+
+void idt_init(void) {
+    for (int i = 0; i < IDT_ENTRIES; i++) {
+        handlers[i] = 0;
+    }
+
+    for (int i = 0; i < IDT_STUB_COUNT; i++) {
+        idt_set_gate(i, isr_stub_table[i]);
+    }
+
+    idt_ptr.limit = sizeof(idt) - 1;
+    idt_ptr.base = (uint32_t)&idt;
+    idt_load();
+}
+
+// Every CPU shares the one table
+void idt_load(void) {
+    __asm__ volatile("lidt %0" : : "m"(idt_ptr));
+}
+
+void idt_set_handler(uint8_t vector, interrupt_handler_t handler) {
+    handlers[vector] = handler;
+}
+
+void irq_install_handler(uint8_t irq, interrupt_handler_t handler) {
+    idt_set_handler(IRQ_BASE_VECTOR + irq, handler);
+    if (ioapic_enabled()) {
+        ioapic_unmask_irq(irq);
+    } else {
+        pic_unmask_irq(irq);
+    }
+}
+
+static void unhandled_exception(struct interrupt_frame* frame) {
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
+    vga_printf("\nKernel panic: %s (vector %d, error %x)\n",
+               exception_names[frame->vector], frame->vector, frame->error_code);
+    vga_printf("EIP=%08x EFLAGS=%08x EAX=%08x EBX=%08x ECX=%08x EDX=%08x\n",
+               frame->eip, frame->eflags, frame->eax, frame->ebx, frame->ecx, frame->edx);
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+
+    for (;;) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
+void interrupt_dispatch(struct interrupt_frame* frame) {
+    uint32_t vector = frame->vector;
+    struct cpu* cpu = this_cpu();
+    cpu->interrupt_depth++;
+
+    if (vector >= IRQ_BASE_VECTOR && vector < IRQ_BASE_VECTOR + IRQ_COUNT) {
+        uint8_t irq = vector - IRQ_BASE_VECTOR;
+        if (ioapic_enabled()) {
+            if (handlers[vector]) {
+                handlers[vector](frame);
+            }
+            lapic_eoi();
+        } else if (!pic_is_spurious(irq)) {
+            if (handlers[vector]) {
+                handlers[vector](frame);
+            }
+            pic_send_eoi(irq);
+        }
+    } else if (vector >= APIC_VECTOR_BASE && vector < IDT_STUB_COUNT) {
+        // A spurious interrupt was never put in service and takes no EOI
+        if (vector != APIC_SPURIOUS_VECTOR) {
+            if (handlers[vector]) {
+                handlers[vector](frame);
+            }
+            lapic_eoi();
+        }
+    } else if (handlers[vector]) {
+        handlers[vector](frame);
+    } else if (vector < 32) {
+        unhandled_exception(frame);
+    }
+
+    cpu->interrupt_depth--;
+}
@@ -0,0 +1,85 @@
+// idt.h - Interrupt descriptor table and interrupt dispatch
+#ifndef IDT_H
+#define IDT_H
+
+#include <stdint.h>
+#include "smp.h"
+
+#define IDT_ENTRIES 256
+#define IDT_STUB_COUNT 64
+
+#define IRQ_BASE_VECTOR 32
+#define IRQ_COUNT 16
+
+// Vectors 48-63 are for the local APIC (see apic.h)
+#define APIC_VECTOR_BASE 48
+
+// Legacy ISA IRQ lines
+#define IRQ_TIMER    0
+#define IRQ_KEYBOARD 1
+#define IRQ_CASCADE  2
+#define IRQ_COM1     4
+#define IRQ_ATA_PRIMARY 14
+
+struct idt_entry {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t type_attr;
+    uint16_t offset_high;
+} __attribute__((packed));
+
+struct idt_pointer {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+
+// Register state saved by the entry stubs in isr.S (lowest address first)
+struct interrupt_frame {
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, esp_dummy, ebx, edx, ecx, eax;
+    uint32_t vector;
+    uint32_t error_code;
+    uint32_t eip, cs, eflags;
+};
+
+typedef void (*interrupt_handler_t)(struct interrupt_frame* frame);
+
+// Function prototypes
+void idt_init(void);
+void idt_load(void);
+void idt_set_handler(uint8_t vector, interrupt_handler_t handler);
+void irq_install_handler(uint8_t irq, interrupt_handler_t handler);
+void interrupt_dispatch(struct interrupt_frame* frame);
+
+static inline void interrupts_enable(void) {
+    __asm__ volatile("sti");
+}
+
+static inline void interrupts_disable(void) {
+    __asm__ volatile("cli");
+}
+
+// Whether an interrupt or exception handler is running on this CPU
+static inline int in_interrupt(void) {
+    return this_cpu()->interrupt_depth != 0;
+}
+
+static inline int interrupts_enabled(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0" : "=r"(flags));
+    return (flags & 0x200) != 0;
+}
+
+// Disable interrupts and return the previous EFLAGS for irq_restore()
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+#endif
@@ -0,0 +1,226 @@
+// initrd.c - Read-only access to a ustar archive loaded as a multiboot module
+//
+// Nothing is unpacked: the file system asks for the header at an offset when
+// it needs it and points file data straight at module memory, which the
+// page-frame allocator keeps reserved. The first time a directory is read,
+// one walk over the archive indexes where each directory's subtree ends, so
+// listings can step over subdirectories; boot itself reads one header.
+#include "initrd.h"
+#include "kheap.h"
+#include "klib.h"
+#include "vga.h"
+
+static const uint8_t* module_start;
+static uint32_t module_size;
+
+// Directory headers in archive order, with the offset of the first header
+// that is not inside them
+struct initrd_directory {
+    uint32_t header;
+    uint32_t end;
+};
+static struct initrd_directory* directories;
+static uint32_t directory_count;
+static int indexed;
+
+// Header field offsets
+#define TAR_NAME      0
+#define TAR_SIZE      124
+#define TAR_CHECKSUM  148
+#define TAR_TYPE      156
+#define TAR_MAGIC     257
+#define TAR_PREFIX    345
+
+static uint32_t parse_octal(const uint8_t* field, uint32_t length) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < length && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+// The checksum is the byte sum of the header with its own field as spaces
+static int checksum_ok(const uint8_t* header) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < INITRD_BLOCK_SIZE; i++) {
+        sum += (i >= TAR_CHECKSUM && i < TAR_CHECKSUM + 8) ? ' ' : header[i];
+    }
+    return sum == parse_octal(header + TAR_CHECKSUM, 8);
+}
+
+// Append up to max bytes of a NUL-padded field
+static uint32_t append_field(char* path, uint32_t length, const uint8_t* field, uint32_t max) {
+    for (uint32_t i = 0; i < max && field[i] && length < INITRD_MAX_PATH - 1; i++) {
+        path[length++] = (char)field[i];
+    }
+    return length;
+}
+
+// Decode the header at offset. Returns 1 for a member, 0 at the end of the
+// archive and -1 if the header is damaged or runs past the module.
+static int read_header(uint32_t offset, struct initrd_entry* entry) {
+    if (offset > module_size || module_size - offset < INITRD_BLOCK_SIZE) {
+        return 0;
+    }
+    const uint8_t* header = module_start + offset;
+    if (header[TAR_NAME] == 0) {
+        return 0;   // Zero block: end of archive
+    }
+    if (!checksum_ok(header)) {
+        return -1;
+    }
+
+    entry->size = parse_octal(header + TAR_SIZE, 12);
+    entry->data_offset = offset + INITRD_BLOCK_SIZE;
+    uint32_t padded = (entry->size + INITRD_BLOCK_SIZE - 1) / INITRD_BLOCK_SIZE * INITRD_BLOCK_SIZE;
+    if (padded < entry->size || padded > module_size - entry->data_offset) {
+        return -1;
+    }
+    entry->next = entry->data_offset + padded;
+
+    uint8_t type = header[TAR_TYPE];
+    entry->is_directory = type == '5';
+    entry->is_file = type == '0' || type == 0;
+
+    // ustar splits long paths into prefix '/' name
+    uint32_t length = 0;
+    if (header[TAR_PREFIX]) {
+        length = append_field(entry->path, 0, header + TAR_PREFIX, 155);
+        entry->path[length++] = '/';
+    }
+    length = append_field(entry->path, length, header + TAR_NAME, 100);
+    entry->path[length] = '\0';
+
+    // Normalise "./a/b/" to "a/b"
+    uint32_t skip = 0;
+    while (entry->path[skip] == '.' && entry->path[skip + 1] == '/') {
+        skip += 2;
+    }
+    if (entry->path[skip] == '.' && entry->path[skip + 1] == '\0') {
+        skip++;
+    }
+    for (uint32_t i = 0; i + skip <= length; i++) {
+        entry->path[i] = entry->path[i + skip];
+    }
+    length -= skip;
+    while (length && entry->path[length - 1] == '/') {
+        entry->path[--length] = '\0';
+    }
+    entry->path_length = length;
+    entry->end = entry->next;
+    return 1;
+}
+
+// A member is inside a directory when the directory's path and a '/' start it
+static int inside(const struct initrd_entry* member, const char* path, uint32_t length) {
+    return member->path_length > length && member->path[length] == '/' &&
+           memcmp(member->path, path, length) == 0;
+}
+
+// Walk the archive once, keeping the directories the walk is inside on a
+// stack. Each is a prefix of the innermost one, so only that path is kept.
+// The first member outside a directory ends it, and the end of the archive
+// (or a damaged header) ends the rest.
+static void index_directories(void) {
+    static char path[INITRD_MAX_PATH];
+    static uint32_t open[INITRD_MAX_PATH / 2];
+    static uint32_t open_length[INITRD_MAX_PATH / 2];
+    struct initrd_entry entry;
+    uint32_t capacity = 0;
+    uint32_t depth = 0;
+    uint32_t offset = 0;
+    indexed = 1;
+    while (read_header(offset, &entry) > 0) {
+        while (depth && !inside(&entry, path, open_length[depth - 1])) {
+            directories[open[--depth]].end = offset;
+        }
+        if (entry.is_directory) {
+            if (directory_count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                struct initrd_directory* grown = krealloc(directories, capacity * sizeof(struct initrd_directory));
+                if (!grown) {
+                    kfree(directories);
+                    directories = 0;
+                    directory_count = 0;
+                    return;     // Listings fall back to reading every header
+                }
+                directories = grown;
+            }
+            directories[directory_count].header = offset;
+            directories[directory_count].end = entry.next;
+            if (depth < INITRD_MAX_PATH / 2) {
+                memcpy(path, entry.path, entry.path_length + 1);
+                open[depth] = directory_count;
+                open_length[depth++] = entry.path_length;
+            }
+            directory_count++;
+        }
+        offset = entry.next;
+    }
+    while (depth) {
+        directories[open[--depth]].end = offset;
+    }
+}
+
+// Where the member at offset and everything under it ends
+static uint32_t subtree_end(uint32_t offset, uint32_t next) {
+    uint32_t low = 0;
+    uint32_t high = directory_count;
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        if (directories[middle].header < offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < directory_count && directories[low].header == offset ? directories[low].end : next;
+}
+
+int initrd_init(uint32_t magic, struct multiboot_info* mbi) {
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !(mbi->flags & MULTIBOOT_INFO_MODS) ||
+        mbi->mods_count == 0) {
+        return -1;
+    }
+
+    // The first module is the archive
+    struct multiboot_module* module = (struct multiboot_module*)mbi->mods_addr;
+    if (module->mod_end - module->mod_start < INITRD_BLOCK_SIZE) {
+        return -1;
+    }
+    const uint8_t* header = (const uint8_t*)module->mod_start;
+    if (header[TAR_MAGIC] != 'u' || header[TAR_MAGIC + 1] != 's' || header[TAR_MAGIC + 2] != 't' ||
+        header[TAR_MAGIC + 3] != 'a' || header[TAR_MAGIC + 4] != 'r' || !checksum_ok(header)) {
+        vga_puts("Error: Boot module is not a ustar archive.\n");
+        return -1;
+    }
+
+    module_start = header;
+    module_size = module->mod_end - module->mod_start;
+    vga_printf("Initrd: %u KiB archive at 0x%x.\n", module_size / 1024, module->mod_start);
+    return 0;
+}
+
+int initrd_present(void) {
+    return module_start != 0;
+}
+
+uint32_t initrd_size(void) {
+    return module_size;
+}
+
+const uint8_t* initrd_data(uint32_t offset) {
+    return module_start + offset;
+}
+
+// read_header(), with a directory's end looked up in the index
+int initrd_read_entry(uint32_t offset, struct initrd_entry* entry) {
+    int status = read_header(offset, entry);
+    if (status > 0 && entry->is_directory) {
+        if (!indexed) {
+            index_directories();
+        }
+        entry->end = subtree_end(offset, entry->next);
+    }
+    return status;
+}
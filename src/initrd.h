@@ -0,0 +1,30 @@
+// initrd.h - Read-only access to a ustar archive loaded as a multiboot module
+#ifndef INITRD_H
+#define INITRD_H
+
+#include <stdint.h>
+#include "multiboot.h"
+
+#define INITRD_BLOCK_SIZE 512
+#define INITRD_MAX_PATH 256
+
+// One archive member, decoded from its header
+struct initrd_entry {
+    char path[INITRD_MAX_PATH];     // No leading "./" or trailing '/'
+    uint32_t path_length;
+    uint8_t is_directory;
+    uint8_t is_file;                // Regular file; other types are skipped
+    uint32_t size;
+    uint32_t data_offset;           // Module offset of the file contents
+    uint32_t next;                  // Module offset of the following header
+    uint32_t end;                   // Past a directory's subtree, or next
+};
+
+// Function prototypes
+int initrd_init(uint32_t magic, struct multiboot_info* mbi);
+int initrd_present(void);
+uint32_t initrd_size(void);
+const uint8_t* initrd_data(uint32_t offset);
+int initrd_read_entry(uint32_t offset, struct initrd_entry* entry);
+
+#endif
@@ -0,0 +1,319 @@
+// journal.c - Write-ahead block journal for file system metadata
+//
+// The journal is a header block followed by a log. A transaction is one or
+// more descriptors, each followed by copies of the blocks it names, and a
+// commit record carrying a checksum over all of them. The whole transaction
+// goes out as sequential writes and one flush; its home blocks are only
+// written when the log is checkpointed or replayed. Replay walks the log from
+// the start, applying transactions while each carries the next sequence
+// number and a matching checksum, so a torn or stale tail is simply ignored.
+// When the log fills, its transactions are replayed to their home blocks and
+// the header is moved past them.
+#include "journal.h"
+#include "kheap.h"
+#include "timer.h"
+#include "klib.h"
+
+#define CHECKSUM_INIT 2166136261u
+#define STAGING_BLOCKS (JOURNAL_TAGS + 2)
+
+// FNV-1a over 32-bit words
+static uint32_t checksum_words(uint32_t sum, const uint32_t* words, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        sum = (sum ^ words[i]) * 16777619u;
+    }
+    return sum;
+}
+
+static int setup(struct journal* j, struct block_device* dev, uint32_t start, uint32_t blocks) {
+    memset(j, 0, sizeof(struct journal));
+    j->dev = dev;
+    j->start = start;
+    j->blocks = blocks;
+    j->head = 1;
+    j->staging = kmalloc(STAGING_BLOCKS * BLOCKDEV_BLOCK_SIZE);
+    if (!j->staging || blocks < JOURNAL_MIN_BLOCKS || start >= dev->block_count ||
+        blocks > dev->block_count - start) {
+        journal_close(j);
+        return -1;
+    }
+    return 0;
+}
+
+static struct journal_record* record_at(struct journal* j, uint32_t block) {
+    return (struct journal_record*)(j->staging + block * BLOCKDEV_BLOCK_SIZE);
+}
+
+// Point the header at sequence as the first transaction to replay, making
+// everything already in the log stale
+static int write_header(struct journal* j, uint32_t sequence) {
+    struct journal_record* header = record_at(j, 0);
+    memset(header, 0, BLOCKDEV_BLOCK_SIZE);
+    header->magic = JOURNAL_MAGIC;
+    header->type = JOURNAL_HEADER;
+    header->sequence = sequence;
+    if (blockdev_write(j->dev, j->start, 1, header) != 0 || blockdev_flush(j->dev) != 0) {
+        return -1;
+    }
+    j->first_sequence = sequence;
+    j->sequence = sequence;
+    j->head = 1;
+    return 0;
+}
+
+// Write each run of consecutive home blocks named by a descriptor at once
+static int apply_copies(struct journal* j, struct journal_record* descriptor, const uint8_t* copies) {
+    uint32_t i = 0;
+    while (i < descriptor->count) {
+        uint32_t run = 1;
+        while (i + run < descriptor->count && descriptor->tags[i + run] == descriptor->tags[i] + run) {
+            run++;
+        }
+        if (blockdev_write(j->dev, descriptor->tags[i], run, copies + i * BLOCKDEV_BLOCK_SIZE) != 0) {
+            return -1;
+        }
+        i += run;
+    }
+    return 0;
+}
+
+// Write the complete transactions from the start of the log to their home
+// blocks. Leaves head and sequence after the last one and returns how many
+// there were, or -1 on an I/O error.
+static int replay_log(struct journal* j) {
+    struct journal_record* record = record_at(j, 0);
+    uint8_t* copies = j->staging + BLOCKDEV_BLOCK_SIZE;
+    uint32_t position = 1;
+    uint32_t sequence = j->first_sequence;
+    int found = 0;
+
+    while (position < j->blocks) {
+        uint32_t block = position;
+        uint32_t sum = CHECKSUM_INIT;
+        uint32_t logged = 0;
+        int complete = 0;
+        while (block < j->blocks) {
+            if (blockdev_read(j->dev, j->start + block, 1, record) != 0) {
+                return -1;
+            }
+            if (record->magic != JOURNAL_MAGIC || record->sequence != sequence) {
+                break;
+            }
+            if (record->type == JOURNAL_COMMIT) {
+                complete = record->count == logged && record->checksum == sum;
+                block++;
+                break;
+            }
+            uint32_t count = record->count;
+            if (record->type != JOURNAL_DESCRIPTOR || count == 0 || count > JOURNAL_TAGS ||
+                count >= j->blocks - block) {
+                break;
+            }
+            if (blockdev_read(j->dev, j->start + block + 1, count, copies) != 0) {
+                return -1;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                sum = checksum_words(sum, &record->tags[i], 1);
+                sum = checksum_words(sum, (const uint32_t*)(copies + i * BLOCKDEV_BLOCK_SIZE),
+                                     BLOCKDEV_BLOCK_SIZE / sizeof(uint32_t));
+            }
+            logged += count;
+            block += 1 + count;
+        }
+        if (!complete) {
+            break;
+        }
+
+        // Verified; now copy it home, descriptor by descriptor
+        for (uint32_t b = position; b < block - 1; ) {
+            if (blockdev_read(j->dev, j->start + b, 1, record) != 0 ||
+                blockdev_read(j->dev, j->start + b + 1, record->count, copies) != 0 ||
+                apply_copies(j, record, copies) != 0) {
+                return -1;
+            }
+            b += 1 + record->count;
+        }
+        found++;
+        sequence++;
+        position = block;
+    }
+
+    j->head = position;
+    j->sequence = sequence;
+    return found;
+}
+
+// Start an empty journal in blocks [start, start + blocks) of dev
+int journal_format(struct journal* j, struct block_device* dev, uint32_t start, uint32_t blocks) {
+    if (setup(j, dev, start, blocks) != 0) {
+        return -1;
+    }
+    // Nothing left over from an earlier journal may look like transaction 1
+    memset(j->staging, 0, BLOCKDEV_BLOCK_SIZE);
+    if (blockdev_write(dev, start + 1, 1, j->staging) != 0 || write_header(j, 1) != 0) {
+        journal_close(j);
+        return -1;
+    }
+    return 0;
+}
+
+// Attach to an existing journal and replay what was committed but never
+// checkpointed. Returns the transactions replayed, or -1; a journal with a
+// damaged header is started afresh.
+int journal_open(struct journal* j, struct block_device* dev, uint32_t start, uint32_t blocks) {
+    if (setup(j, dev, start, blocks) != 0) {
+        return -1;
+    }
+    struct journal_record* header = record_at(j, 0);
+    if (blockdev_read(dev, start, 1, header) != 0) {
+        journal_close(j);
+        return -1;
+    }
+    if (header->magic != JOURNAL_MAGIC || header->type != JOURNAL_HEADER) {
+        return journal_format(j, dev, start, blocks);
+    }
+    j->first_sequence = header->sequence;
+
+    int found = replay_log(j);
+    if (found < 0 || (found > 0 && (blockdev_flush(dev) != 0 || write_header(j, j->sequence) != 0))) {
+        journal_close(j);
+        return -1;
+    }
+    j->stats.replayed = found;
+    return found;
+}
+
+void journal_close(struct journal* j) {
+    kfree(j->staging);
+    j->staging = 0;
+    j->dev = 0;
+}
+
+// Most blocks one transaction can log
+uint32_t journal_capacity(struct journal* j) {
+    uint32_t room = j->blocks - 2;     // Less the header and a commit record
+    return room - (room + JOURNAL_TAGS) / (JOURNAL_TAGS + 1);
+}
+
+uint32_t journal_used(struct journal* j) {
+    return j->head - 1;
+}
+
+void journal_begin(struct journal* j) {
+    j->begin_ns = timer_now_ns();
+    j->transaction_head = j->head;
+    j->checksum = CHECKSUM_INIT;
+    j->logged = 0;
+    j->pending = 0;
+}
+
+// Make room in the log for a transaction of count blocks, checkpointing if
+// it is full. Call before the first journal_add(). Returns -1 if count can
+// never fit or the checkpoint failed.
+int journal_reserve(struct journal* j, uint32_t count) {
+    uint32_t need = count + (count + JOURNAL_TAGS - 1) / JOURNAL_TAGS + 1;
+    if (count > journal_capacity(j)) {
+        return -1;
+    }
+    if (j->head + need > j->blocks && journal_checkpoint(j) != 0) {
+        return -1;
+    }
+    j->transaction_head = j->head;
+    return 0;
+}
+
+// Write the open descriptor and the copies behind it
+static int write_staged(struct journal* j, uint32_t extra) {
+    uint32_t count = 1 + j->pending + extra;
+    if (blockdev_write(j->dev, j->start + j->head, count, j->staging) != 0) {
+        return -1;
+    }
+    j->head += count;
+    j->pending = 0;
+    return 0;
+}
+
+// Log a copy of data as the new contents of block
+int journal_add(struct journal* j, uint32_t block, const void* data) {
+    if (j->pending == JOURNAL_TAGS && write_staged(j, 0) != 0) {
+        j->head = j->transaction_head;
+        return -1;
+    }
+
+    struct journal_record* descriptor = record_at(j, 0);
+    if (j->pending == 0) {
+        memset(descriptor, 0, BLOCKDEV_BLOCK_SIZE);
+        descriptor->magic = JOURNAL_MAGIC;
+        descriptor->type = JOURNAL_DESCRIPTOR;
+        descriptor->sequence = j->sequence;
+    }
+    uint8_t* copy = j->staging + (1 + j->pending) * BLOCKDEV_BLOCK_SIZE;
+    memcpy(copy, data, BLOCKDEV_BLOCK_SIZE);
+    descriptor->tags[j->pending] = block;
+    descriptor->count = ++j->pending;
+
+    j->checksum = checksum_words(j->checksum, &block, 1);
+    j->checksum = checksum_words(j->checksum, (const uint32_t*)copy, BLOCKDEV_BLOCK_SIZE / sizeof(uint32_t));
+    j->logged++;
+    return 0;
+}
+
+// Append the commit record and make the transaction durable. operations is
+// how many file system operations it covers, for the statistics. Returns
+// the blocks logged, or -1 with the transaction discarded.
+int journal_commit(struct journal* j, uint32_t operations) {
+    if (j->logged == 0) {
+        return 0;
+    }
+
+    struct journal_record* commit = record_at(j, 1 + j->pending);
+    memset(commit, 0, BLOCKDEV_BLOCK_SIZE);
+    commit->magic = JOURNAL_MAGIC;
+    commit->type = JOURNAL_COMMIT;
+    commit->sequence = j->sequence;
+    commit->count = j->logged;
+    commit->checksum = j->checksum;
+    if (write_staged(j, 1) != 0 || blockdev_flush(j->dev) != 0) {
+        j->head = j->transaction_head;
+        j->logged = 0;
+        j->pending = 0;
+        return -1;
+    }
+    j->sequence++;
+
+    uint64_t elapsed = timer_now_ns() - j->begin_ns;
+    j->stats.commits++;
+    j->stats.operations += operations;
+    j->stats.blocks += j->logged;
+    j->stats.commit_ns += elapsed;
+    if (elapsed > j->stats.slowest_commit_ns) {
+        j->stats.slowest_commit_ns = elapsed;
+    }
+    if (operations > j->stats.largest_batch) {
+        j->stats.largest_batch = operations;
+    }
+    if (j->logged > j->stats.largest_commit) {
+        j->stats.largest_commit = j->logged;
+    }
+
+    int logged = (int)j->logged;
+    j->logged = 0;
+    return logged;
+}
+
+// Copy every committed transaction to its home blocks and empty the log.
+// Must not be called with blocks added to an open transaction.
+int journal_checkpoint(struct journal* j) {
+    j->head = 1;
+    if (replay_log(j) < 0 || blockdev_flush(j->dev) != 0 || write_header(j, j->sequence) != 0) {
+        return -1;
+    }
+    j->stats.checkpoints++;
+    return 0;
+}
+
+void journal_get_stats(struct journal* j, struct journal_stats* stats) {
+    j->stats.log_blocks = j->blocks - 1;
+    j->stats.log_used = journal_used(j);
+    *stats = j->stats;
+}
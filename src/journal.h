@@ -0,0 +1,73 @@
+// journal.h - Write-ahead block journal for file system metadata
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include "blockdev.h"
+
+#define JOURNAL_MAGIC 0x4C4E524A   // "JRNL"
+
+// Record types; every journal block that is not a logged copy starts with one
+#define JOURNAL_HEADER     1       // Block 0 of the journal area
+#define JOURNAL_DESCRIPTOR 2       // Home blocks of the copies that follow it
+#define JOURNAL_COMMIT     3       // Ends a transaction
+
+// Home block numbers one descriptor can carry
+#define JOURNAL_TAGS ((BLOCKDEV_BLOCK_SIZE - 5 * sizeof(uint32_t)) / sizeof(uint32_t))
+
+// Smallest journal worth having: header plus a few small transactions
+#define JOURNAL_MIN_BLOCKS 32
+
+struct journal_record {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t sequence;      // Header: first transaction to replay
+    uint32_t count;         // Descriptor: tags used; commit: blocks logged
+    uint32_t checksum;      // Commit: over every tag and logged block
+    uint32_t tags[JOURNAL_TAGS];
+};
+
+struct journal_stats {
+    uint32_t commits;
+    uint32_t operations;        // File system operations in all commits
+    uint32_t blocks;            // Metadata blocks logged
+    uint32_t largest_batch;     // Most operations in one commit
+    uint32_t largest_commit;    // Most blocks in one commit
+    uint64_t commit_ns;         // Total time from journal_begin() to durable
+    uint64_t slowest_commit_ns;
+    uint32_t checkpoints;       // Times the log was full and written home
+    uint32_t replayed;          // Transactions recovered at mount
+    uint32_t log_blocks;
+    uint32_t log_used;
+};
+
+struct journal {
+    struct block_device* dev;
+    uint32_t start;             // Header block; the log follows it
+    uint32_t blocks;            // Header plus log
+    uint32_t head;              // Next free log block, from start
+    uint32_t transaction_head;  // Where the open transaction began
+    uint32_t sequence;          // Number of the open transaction
+    uint32_t first_sequence;    // Oldest transaction still in the log
+    uint32_t checksum;
+    uint32_t logged;            // Blocks added to the open transaction
+    uint32_t pending;           // Copies staged behind the open descriptor
+    uint8_t* staging;           // Descriptor, copies and commit for one write
+    uint64_t begin_ns;
+    struct journal_stats stats;
+};
+
+// Function prototypes
+int journal_format(struct journal* j, struct block_device* dev, uint32_t start, uint32_t blocks);
+int journal_open(struct journal* j, struct block_device* dev, uint32_t start, uint32_t blocks);
+void journal_close(struct journal* j);
+uint32_t journal_capacity(struct journal* j);
+uint32_t journal_used(struct journal* j);
+void journal_begin(struct journal* j);
+int journal_reserve(struct journal* j, uint32_t count);
+int journal_add(struct journal* j, uint32_t block, const void* data);
+int journal_commit(struct journal* j, uint32_t operations);
+int journal_checkpoint(struct journal* j);
+void journal_get_stats(struct journal* j, struct journal_stats* stats);
+
+#endif
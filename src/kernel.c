@@ -1,26 +1,116 @@
 // src/kernel.c - Main kernel with file system
 #include <stdint.h>
 #include "vga.h"
+#include "gdt.h"
+#include "idt.h"
+#include "pic.h"
+#include "serial.h"
+#include "multiboot.h"
+#include "pmm.h"
+#include "kheap.h"
+#include "paging.h"
+#include "timer.h"
 #include "keyboard.h"
+#include "ata.h"
+#include "bcache.h"
+#include "initrd.h"
 #include "filesystem.h"
 #include "shell.h"
+#include "bench.h"
+#include "klib.h"
+#include "acpi.h"
+#include "apic.h"
+#include "smp.h"
 
-void kmain(void) {
+void kmain(uint32_t magic, struct multiboot_info* mbi) {
+    // "bench" on the command line runs the benchmark suite instead of the shell
+    bench_init(magic, mbi);
+    bench_stamp("kmain");
+    
     // Initialize VGA display
     vga_init();
+    bench_stamp("vga");
+    
+    // Install our own segments and interrupt table
+    gdt_init();
+    idt_init();
+    pic_init();
+    bench_stamp("gdt_idt_pic");
+    
+    // Turn on SSE for the 16-byte copy and string loops if the CPU has it
+    klib_init();
+    bench_stamp("klib");
+    
+    // Mirror console output to COM1 for headless runs
+    if (serial_init() == 0) {
+        vga_set_mirror(serial_write);
+    }
+    bench_stamp("serial");
+    
+    // Calibrate the TSC and start the periodic tick
+    timer_init();
+    bench_stamp("timer");
+    
+    // Hand the RAM described by the bootloader to the page-frame allocator
+    pmm_init(magic, mbi);
+    bench_stamp("pmm");
+    
+    // Read the CPU and interrupt controller layout while tables are reachable
+    // by physical address
+    acpi_init();
+    bench_stamp("acpi");
+    
+    // Set up the kernel heap on top of it
+    if (kheap_init() != 0) {
+        vga_puts("Error: Kernel heap unavailable.\n");
+    }
+    bench_stamp("kheap");
+    
+    // Turn on paging with large-page identity mappings
+    paging_init();
+    bench_stamp("paging");
     
     // Initialize keyboard
     keyboard_init();
+    bench_stamp("keyboard");
+    
+    // Move device IRQs to the IO APIC, then start the other CPUs
+    apic_init();
+    bench_stamp("apic");
+    smp_init();
+    bench_stamp("smp");
+    
+    // Start taking interrupts now that handlers are in place
+    interrupts_enable();
+    
+    // Probe the disk; the file system mounts from it when one is attached
+    ata_init();
+    bench_stamp("ata");
+    
+    // Buffer cache between the file system and its block device
+    if (bcache_init() != 0) {
+        vga_puts("Error: Not enough memory for the buffer cache.\n");
+    }
+    bench_stamp("bcache");
+    
+    // Find the initrd archive GRUB loaded next to the kernel
+    initrd_init(magic, mbi);
+    bench_stamp("initrd");
     
     // Initialize file system
     fs_init();
+    bench_stamp("fs");
     
     // Initialize and run shell
     shell_init();
+    bench_stamp("shell");
+    if (bench_enabled()) {
+        bench_run();
+    }
     shell_run();
     
     // This should never be reached, but just in case
     for (;;) {
-        __asm__ volatile("hlt");
+        cpu_idle();
     }
 }
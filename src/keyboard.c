@@ -1,39 +1,142 @@
-// keyboard.c - Keyboard driver implementation
+// keyboard.c - Interrupt-driven keyboard driver implementation
 #include "keyboard.h"
+#include "idt.h"
+#include "io.h"
+#include "timer.h"
 
 // US QWERTY keyboard layout
-static char keymap[128] = {
+static const char keymap[128] = {
     0,  27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
     '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
     0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`', 0,
-    '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0, '*', 0, ' ',
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+    '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0, '*', 0, ' '
 };
 
 // Shifted characters
-static char shift_keymap[128] = {
+static const char shift_keymap[128] = {
     0,  27, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', '\b',
     '\t', 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n',
     0, 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~', 0,
-    '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0, '*', 0, ' ',
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+    '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0, '*', 0, ' '
 };
 
+// Keys that follow an 0xE0 prefix
+static const uint8_t extended_keymap[128] = {
+    [0x1C] = '\n', [0x35] = '/',
+    [0x47] = KEYCODE_HOME, [0x48] = KEYCODE_UP, [0x49] = KEYCODE_PAGEUP,
+    [0x4B] = KEYCODE_LEFT, [0x4D] = KEYCODE_RIGHT,
+    [0x4F] = KEYCODE_END, [0x50] = KEYCODE_DOWN, [0x51] = KEYCODE_PAGEDOWN,
+    [0x52] = KEYCODE_INSERT, [0x53] = KEYCODE_DELETE
+};
+
+// Decoder state, only touched from the IRQ handler
 static int shift_pressed = 0;
+static int ctrl_pressed = 0;
+static int alt_pressed = 0;
+static int caps_lock = 0;
+static int extended = 0;
+static int pause_bytes = 0;
+
+// Single-producer / single-consumer (shell) ring of key events. Producers
+// are IRQ handlers (keyboard, serial), which never nest on one CPU, so they
+// act as a single producer that only writes key_head; the consumer only
+// writes key_tail. Neither side needs a lock; the indices run freely and
+// are masked on use.
+static volatile uint16_t key_buffer[KEYBOARD_BUFFER_SIZE];
+static volatile uint32_t key_head = 0;
+static volatile uint32_t key_tail = 0;
+static volatile uint32_t key_dropped = 0;
 
-// Port I/O functions
-static inline uint8_t inb(uint16_t port) {
-    uint8_t result;
-    __asm__ volatile("inb %1, %0" : "=a"(result) : "Nd"(port));
-    return result;
+// Queue a key event; called from interrupt context
+void keyboard_push_event(uint16_t event) {
+    if (key_head - key_tail >= KEYBOARD_BUFFER_SIZE) {
+        key_dropped++;
+        return;
+    }
+    key_buffer[key_head & (KEYBOARD_BUFFER_SIZE - 1)] = event;
+    __asm__ volatile("" ::: "memory"); // Publish the slot before the index
+    key_head++;
 }
 
-static inline void outb(uint16_t port, uint8_t data) {
-    __asm__ volatile("outb %0, %1" : : "a"(data), "Nd"(port));
+static uint8_t current_modifiers(void) {
+    uint8_t mods = 0;
+    if (shift_pressed) mods |= KEYMOD_SHIFT;
+    if (ctrl_pressed) mods |= KEYMOD_CTRL;
+    if (alt_pressed) mods |= KEYMOD_ALT;
+    return mods;
+}
+
+static void keyboard_handle_scancode(uint8_t scancode) {
+    // Pause/Break sends E1 1D 45 E1 9D C5 and has no release event
+    if (pause_bytes > 0) {
+        pause_bytes--;
+        return;
+    }
+    if (scancode == SCANCODE_PAUSE) {
+        pause_bytes = 5;
+        return;
+    }
+    if (scancode == SCANCODE_EXTENDED) {
+        extended = 1;
+        return;
+    }
+
+    int released = scancode & 0x80;
+    int is_extended = extended;
+    scancode &= 0x7F;
+    extended = 0;
+
+    // Modifiers (right Ctrl/Alt arrive as extended versions of the left ones)
+    if (scancode == KEY_LSHIFT || scancode == KEY_RSHIFT) {
+        // E0 2A / E0 36 are fake shifts sent around some extended keys
+        if (!is_extended) {
+            shift_pressed = !released;
+        }
+        return;
+    }
+    if (scancode == KEY_CTRL) {
+        ctrl_pressed = !released;
+        return;
+    }
+    if (scancode == KEY_ALT) {
+        alt_pressed = !released;
+        return;
+    }
+    if (released) {
+        return; // Don't report characters for key releases
+    }
+    if (scancode == KEY_CAPSLOCK && !is_extended) {
+        caps_lock = !caps_lock;
+        return;
+    }
+
+    uint8_t c;
+    if (is_extended) {
+        c = extended_keymap[scancode];
+    } else {
+        c = shift_pressed ? shift_keymap[scancode] : keymap[scancode];
+        if (caps_lock && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+            c ^= 0x20;
+        }
+    }
+    if (c == 0) {
+        return;
+    }
+
+    // Ctrl+letter produces the matching control character (Ctrl+D = 4)
+    if (ctrl_pressed && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+        c &= 0x1F;
+    }
+
+    keyboard_push_event((uint16_t)c | ((uint16_t)current_modifiers() << 8));
+}
+
+static void keyboard_irq_handler(struct interrupt_frame* frame) {
+    (void)frame;
+    // Drain everything the controller has latched for us
+    while (inb(KEYBOARD_STATUS_PORT) & 0x01) {
+        keyboard_handle_scancode(inb(KEYBOARD_PORT));
+    }
 }
 
 void keyboard_init(void) {
@@ -41,44 +144,38 @@ void keyboard_init(void) {
     while (inb(KEYBOARD_STATUS_PORT) & 0x01) {
         inb(KEYBOARD_PORT);
     }
+
+    irq_install_handler(IRQ_KEYBOARD, keyboard_irq_handler);
 }
 
 int keyboard_available(void) {
-    return inb(KEYBOARD_STATUS_PORT) & 0x01;
+    return key_head != key_tail;
 }
 
-char keyboard_getchar(void) {
-    uint8_t scancode;
-    char c = 0;
-    
+uint32_t keyboard_dropped(void) {
+    return key_dropped;
+}
+
+// Returns the next key event: character in the low byte, KEYMOD_* in the high byte
+uint16_t keyboard_getkey(void) {
+    // Sleep until the IRQ handler has queued something. Interrupts are
+    // disabled around the check so a key arriving between the test and the
+    // hlt can't be missed; cpu_idle() only opens the window once halted.
     while (!keyboard_available()) {
-        // Wait for key press
-    }
-    
-    scancode = inb(KEYBOARD_PORT);
-    
-    // Handle key releases (high bit set)
-    if (scancode & 0x80) {
-        scancode &= 0x7F;
-        if (scancode == KEY_LSHIFT || scancode == KEY_RSHIFT) {
-            shift_pressed = 0;
-        }
-        return 0; // Don't return character for key release
-    }
-    
-    // Handle key presses
-    if (scancode == KEY_LSHIFT || scancode == KEY_RSHIFT) {
-        shift_pressed = 1;
-        return 0;
-    }
-    
-    if (scancode < 128) {
-        if (shift_pressed) {
-            c = shift_keymap[scancode];
-        } else {
-            c = keymap[scancode];
+        interrupts_disable();
+        if (keyboard_available()) {
+            interrupts_enable();
+            break;
         }
+        cpu_idle();
     }
-    
-    return c;
-}
\ No newline at end of file
+
+    uint16_t event = key_buffer[key_tail & (KEYBOARD_BUFFER_SIZE - 1)];
+    __asm__ volatile("" ::: "memory"); // Consume the slot before freeing it
+    key_tail++;
+    return event;
+}
+
+char keyboard_getchar(void) {
+    return (char)(keyboard_getkey() & 0xFF);
+}
@@ -14,10 +14,40 @@
 #define KEY_SPACE   0x39
 #define KEY_LSHIFT  0x2A
 #define KEY_RSHIFT  0x36
+#define KEY_CTRL    0x1D
+#define KEY_ALT     0x38
+#define KEY_CAPSLOCK 0x3A
+
+// Scancode prefixes
+#define SCANCODE_EXTENDED 0xE0
+#define SCANCODE_PAUSE    0xE1
+
+// Characters above ASCII reported for extended (non-printing) keys
+#define KEYCODE_UP       0x80
+#define KEYCODE_DOWN     0x81
+#define KEYCODE_LEFT     0x82
+#define KEYCODE_RIGHT    0x83
+#define KEYCODE_HOME     0x84
+#define KEYCODE_END      0x85
+#define KEYCODE_PAGEUP   0x86
+#define KEYCODE_PAGEDOWN 0x87
+#define KEYCODE_INSERT   0x88
+#define KEYCODE_DELETE   0x89
+
+// Modifier flags carried in the high byte of a key event
+#define KEYMOD_SHIFT 0x01
+#define KEYMOD_CTRL  0x02
+#define KEYMOD_ALT   0x04
+
+// Must be a power of two so the ring indices can wrap with a mask
+#define KEYBOARD_BUFFER_SIZE 256
 
 // Function prototypes
 void keyboard_init(void);
 char keyboard_getchar(void);
+uint16_t keyboard_getkey(void);
+void keyboard_push_event(uint16_t event);
 int keyboard_available(void);
+uint32_t keyboard_dropped(void);
 
-#endif
\ No newline at end of file
+#endif
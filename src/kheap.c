@@ -0,0 +1,357 @@
+// kheap.c - Kernel heap allocator
+//
+// Small objects are carved from slabs, each slab being a naturally aligned
+// buddy block dedicated to one size class with its header at the start.
+// A pointer-per-frame table maps any address back to the slab that owns it,
+// so kfree() is constant time. Partially used slabs sit on a per-class list;
+// a slab that empties is returned to the page allocator unless it is the
+// class's only spare.
+//
+// Large allocations are whole buddy blocks with a small header in front of
+// the returned pointer.
+//
+// One lock covers the whole heap; it is never taken in interrupt context.
+#include "kheap.h"
+#include "pmm.h"
+#include "klib.h"
+#include "spinlock.h"
+
+#define KHEAP_SLAB_MAGIC  0x51AB51ABu
+#define KHEAP_LARGE_MAGIC 0x1A46E000u
+#define KHEAP_LARGE_HEADER 16
+
+struct slab {
+    uint32_t magic;
+    uint16_t class_index;
+    uint16_t in_use;
+    uint16_t capacity;
+    uint16_t order;
+    void* free_list;        // Singly linked through the free objects
+    struct slab* next;      // Partial list links
+    struct slab* prev;
+    int on_partial_list;
+};
+
+struct large_header {
+    uint32_t magic;
+    uint32_t order;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+struct size_class {
+    uint32_t object_size;
+    int slab_order;         // Slab size is 2^slab_order pages
+    uint32_t first_offset;  // Offset of the first object past the header
+    struct slab* partial;
+    struct slab* spare;     // One empty slab kept to avoid page churn
+};
+
+static struct size_class classes[KHEAP_CLASS_COUNT];
+static struct slab** frame_slab = 0;   // Owning slab for every physical frame
+static uint32_t frame_slab_count = 0;
+static struct kheap_stats stats;
+static int heap_ready = 0;
+static struct spinlock heap_lock;
+
+int kheap_init(void) {
+    struct pmm_stats pmm;
+    pmm_get_stats(&pmm);
+    if (pmm.total_frames == 0) {
+        return -1;
+    }
+
+    // Reverse map from frame number to slab, sized for every managed frame
+    frame_slab_count = pmm.highest_frame;
+    uint32_t table_bytes = frame_slab_count * sizeof(struct slab*);
+    uint32_t table = pmm_alloc_pages(pmm_order_for_size(table_bytes));
+    if (!table) {
+        return -1;
+    }
+    frame_slab = (struct slab**)table;
+    memset(frame_slab, 0, table_bytes);
+    stats.footprint_bytes = (uint32_t)PAGE_SIZE << pmm_order_for_size(table_bytes);
+
+    for (int i = 0; i < KHEAP_CLASS_COUNT; i++) {
+        uint32_t size = 1u << (KHEAP_MIN_CLASS_SHIFT + i);
+        classes[i].object_size = size;
+        classes[i].partial = 0;
+        classes[i].spare = 0;
+
+        // Give every slab room for at least eight objects after its header
+        classes[i].first_offset = (sizeof(struct slab) + size - 1) & ~(size - 1);
+        classes[i].slab_order = pmm_order_for_size(classes[i].first_offset + size * 8);
+        stats.classes[i].object_size = size;
+    }
+
+    heap_ready = 1;
+    return 0;
+}
+
+static int size_to_class(uint32_t size) {
+    int index = 0;
+    while ((1u << (KHEAP_MIN_CLASS_SHIFT + index)) < size) {
+        index++;
+    }
+    return index;
+}
+
+static void partial_push(struct size_class* cls, struct slab* slab) {
+    slab->prev = 0;
+    slab->next = cls->partial;
+    if (cls->partial) {
+        cls->partial->prev = slab;
+    }
+    cls->partial = slab;
+    slab->on_partial_list = 1;
+}
+
+static void partial_remove(struct size_class* cls, struct slab* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        cls->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = slab->prev = 0;
+    slab->on_partial_list = 0;
+}
+
+static void set_frame_owner(uint32_t address, int order, struct slab* owner) {
+    uint32_t frame = address >> PAGE_SHIFT;
+    for (uint32_t i = 0; i < (1u << order); i++) {
+        frame_slab[frame + i] = owner;
+    }
+}
+
+static struct slab* slab_create(int class_index) {
+    struct size_class* cls = &classes[class_index];
+    uint32_t base = pmm_alloc_pages(cls->slab_order);
+    if (!base) {
+        return 0;
+    }
+
+    struct slab* slab = (struct slab*)base;
+    uint32_t slab_bytes = (uint32_t)PAGE_SIZE << cls->slab_order;
+    slab->magic = KHEAP_SLAB_MAGIC;
+    slab->class_index = class_index;
+    slab->in_use = 0;
+    slab->order = cls->slab_order;
+    slab->capacity = (slab_bytes - cls->first_offset) / cls->object_size;
+    slab->next = slab->prev = 0;
+    slab->on_partial_list = 0;
+
+    // Thread every slot onto the free list, lowest address first
+    slab->free_list = 0;
+    for (int i = slab->capacity - 1; i >= 0; i--) {
+        void** object = (void**)(base + cls->first_offset + i * cls->object_size);
+        *object = slab->free_list;
+        slab->free_list = object;
+    }
+
+    set_frame_owner(base, cls->slab_order, slab);
+    stats.footprint_bytes += slab_bytes;
+    stats.classes[class_index].slabs++;
+    stats.classes[class_index].capacity += slab->capacity;
+    return slab;
+}
+
+static void slab_destroy(struct slab* slab) {
+    uint32_t slab_bytes = (uint32_t)PAGE_SIZE << slab->order;
+    stats.footprint_bytes -= slab_bytes;
+    stats.classes[slab->class_index].slabs--;
+    stats.classes[slab->class_index].capacity -= slab->capacity;
+    set_frame_owner((uint32_t)slab, slab->order, 0);
+    slab->magic = 0;
+    pmm_free_pages((uint32_t)slab, slab->order);
+}
+
+static void* slab_alloc(int class_index) {
+    struct size_class* cls = &classes[class_index];
+    struct kheap_class_stats* cstats = &stats.classes[class_index];
+    struct slab* slab = cls->partial;
+
+    if (slab) {
+        cstats->slab_hits++;
+    } else if (cls->spare) {
+        cstats->slab_hits++;
+        slab = cls->spare;
+        cls->spare = 0;
+        partial_push(cls, slab);
+    } else {
+        cstats->slab_misses++;
+        slab = slab_create(class_index);
+        if (!slab) {
+            return 0;
+        }
+        partial_push(cls, slab);
+    }
+
+    void** object = (void**)slab->free_list;
+    slab->free_list = *object;
+    slab->in_use++;
+    if (!slab->free_list) {
+        partial_remove(cls, slab);
+    }
+
+    cstats->allocs++;
+    cstats->live_objects++;
+    stats.live_bytes += cls->object_size;
+    return object;
+}
+
+static void slab_free(struct slab* slab, void* ptr) {
+    struct size_class* cls = &classes[slab->class_index];
+    struct kheap_class_stats* cstats = &stats.classes[slab->class_index];
+
+    *(void**)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->in_use--;
+
+    cstats->frees++;
+    cstats->live_objects--;
+    stats.live_bytes -= cls->object_size;
+
+    if (slab->in_use == 0) {
+        if (slab->on_partial_list) {
+            partial_remove(cls, slab);
+        }
+        if (!cls->spare) {
+            cls->spare = slab;
+        } else {
+            slab_destroy(slab);
+        }
+    } else if (!slab->on_partial_list) {
+        // Was full, has room again
+        partial_push(cls, slab);
+    }
+}
+
+static void* large_alloc(uint32_t size) {
+    int order = pmm_order_for_size(size + KHEAP_LARGE_HEADER);
+    if (order > PMM_MAX_ORDER) {
+        return 0;
+    }
+    uint32_t base = pmm_alloc_pages(order);
+    if (!base) {
+        return 0;
+    }
+
+    struct large_header* header = (struct large_header*)base;
+    header->magic = KHEAP_LARGE_MAGIC;
+    header->order = order;
+    header->size = size;
+
+    stats.large_allocs++;
+    stats.large_live++;
+    stats.live_bytes += size;
+    stats.footprint_bytes += (uint32_t)PAGE_SIZE << order;
+    return (void*)(base + KHEAP_LARGE_HEADER);
+}
+
+void* kmalloc(uint32_t size) {
+    if (!heap_ready || size == 0) {
+        return 0;
+    }
+
+    void* ptr;
+    spin_lock(&heap_lock);
+    if (size <= KHEAP_MAX_SLAB_SIZE) {
+        ptr = slab_alloc(size_to_class(size));
+    } else {
+        ptr = large_alloc(size);
+    }
+    if (!ptr) {
+        stats.failed_allocs++;
+    }
+    spin_unlock(&heap_lock);
+    return ptr;
+}
+
+void* kzalloc(uint32_t size) {
+    void* ptr = kmalloc(size);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+static struct slab* owning_slab(void* ptr) {
+    uint32_t frame = (uint32_t)ptr >> PAGE_SHIFT;
+    if (frame >= frame_slab_count) {
+        return 0;
+    }
+    return frame_slab[frame];
+}
+
+static struct large_header* large_header_of(void* ptr) {
+    struct large_header* header = (struct large_header*)((uint32_t)ptr - KHEAP_LARGE_HEADER);
+    if (((uint32_t)header & (PAGE_SIZE - 1)) != 0 || header->magic != KHEAP_LARGE_MAGIC) {
+        return 0;
+    }
+    return header;
+}
+
+uint32_t kmalloc_usable_size(void* ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    struct slab* slab = owning_slab(ptr);
+    if (slab) {
+        return classes[slab->class_index].object_size;
+    }
+    struct large_header* header = large_header_of(ptr);
+    if (header) {
+        return ((uint32_t)PAGE_SIZE << header->order) - KHEAP_LARGE_HEADER;
+    }
+    return 0;
+}
+
+void kfree(void* ptr) {
+    if (!ptr || !heap_ready) {
+        return;
+    }
+
+    spin_lock(&heap_lock);
+    struct slab* slab = owning_slab(ptr);
+    struct large_header* header = slab ? 0 : large_header_of(ptr);
+    if (slab) {
+        slab_free(slab, ptr);
+    } else if (header) {
+        header->magic = 0;
+        stats.large_live--;
+        stats.live_bytes -= header->size;
+        stats.footprint_bytes -= (uint32_t)PAGE_SIZE << header->order;
+        pmm_free_pages((uint32_t)header, header->order);
+    }
+    spin_unlock(&heap_lock);
+}
+
+void* krealloc(void* ptr, uint32_t size) {
+    if (!ptr) {
+        return kmalloc(size);
+    }
+    if (size == 0) {
+        kfree(ptr);
+        return 0;
+    }
+
+    uint32_t usable = kmalloc_usable_size(ptr);
+    if (size <= usable && size > usable / 2) {
+        return ptr; // Still a sensible fit
+    }
+
+    void* grown = kmalloc(size);
+    if (!grown) {
+        return 0;
+    }
+    memcpy(grown, ptr, size < usable ? size : usable);
+    kfree(ptr);
+    return grown;
+}
+
+void kheap_get_stats(struct kheap_stats* out) {
+    *out = stats;
+}
@@ -0,0 +1,42 @@
+// kheap.h - Kernel heap allocator (size-class slabs + page-backed large blocks)
+#ifndef KHEAP_H
+#define KHEAP_H
+
+#include <stdint.h>
+
+// Objects up to KHEAP_MAX_SLAB_SIZE come from per-class slabs; anything
+// bigger gets its own block of pages from the physical memory manager
+#define KHEAP_MIN_CLASS_SHIFT 4   // 16 bytes
+#define KHEAP_CLASS_COUNT 8       // 16 .. 2048 bytes
+#define KHEAP_MAX_SLAB_SIZE (1u << (KHEAP_MIN_CLASS_SHIFT + KHEAP_CLASS_COUNT - 1))
+
+struct kheap_class_stats {
+    uint32_t object_size;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t slab_hits;     // Allocations served from an existing slab
+    uint32_t slab_misses;   // Allocations that had to create a slab
+    uint32_t slabs;
+    uint32_t live_objects;
+    uint32_t capacity;      // Object slots across all slabs
+};
+
+struct kheap_stats {
+    uint32_t live_bytes;        // Bytes handed out and not yet freed
+    uint32_t footprint_bytes;   // Pages currently owned by the heap
+    uint32_t large_allocs;
+    uint32_t large_live;
+    uint32_t failed_allocs;
+    struct kheap_class_stats classes[KHEAP_CLASS_COUNT];
+};
+
+// Function prototypes
+int kheap_init(void);
+void* kmalloc(uint32_t size);
+void* kzalloc(uint32_t size);
+void* krealloc(void* ptr, uint32_t size);
+void kfree(void* ptr);
+uint32_t kmalloc_usable_size(void* ptr);
+void kheap_get_stats(struct kheap_stats* stats);
+
+#endif
@@ -0,0 +1,344 @@
+// klib.c - Memory and string primitives shared by the whole kernel
+//
+// Three tiers: byte loops (kept for comparison), rep movs/stos and aligned
+// word scans that any i386 runs, and 16-byte SSE2 loops. klib_init() turns
+// SSE on in CR0/CR4 when CPUID reports SSE2 and FXSR, and the public
+// functions pick a tier per call. Interrupt handlers always get the integer
+// tier, so the XMM registers belong to the interrupted code alone and no
+// FXSAVE is needed on interrupt entry.
+//
+// The SSE2 string scans read whole aligned 16-byte blocks, or unaligned ones
+// that stay inside a page, so they may look past a terminator but never
+// into a page the string does not touch.
+#include "klib.h"
+#include "cpu.h"
+#include "idt.h"
+
+#define SSE2 __attribute__((target("sse2")))
+
+#define PAGE_OFFSET_MASK 4095
+
+static int sse_enabled;
+
+void klib_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_FXSR) || !(edx & CPUID_EDX_SSE2)) {
+        return;
+    }
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP);
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    sse_enabled = 1;
+}
+
+int klib_sse_enabled(void) {
+    return sse_enabled;
+}
+
+static int use_sse(void) {
+    return sse_enabled && !in_interrupt();
+}
+
+// Bytes
+
+void memcpy_bytes(void* dest, const void* src, size_t size) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    for (size_t i = 0; i < size; i++) {
+        d[i] = s[i];
+    }
+}
+
+void memset_bytes(void* ptr, int value, size_t size) {
+    uint8_t* p = (uint8_t*)ptr;
+    for (size_t i = 0; i < size; i++) {
+        p[i] = (uint8_t)value;
+    }
+}
+
+size_t strlen_bytes(const char* str) {
+    size_t length = 0;
+    while (str[length]) {
+        length++;
+    }
+    return length;
+}
+
+int strcmp_bytes(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *(const unsigned char*)a - *(const unsigned char*)b;
+}
+
+// Words
+
+void memcpy_words(void* dest, const void* src, size_t size) {
+    size_t dwords = size / 4;
+    size_t rest = size % 4;
+    __asm__ volatile("rep movsl" : "+D"(dest), "+S"(src), "+c"(dwords) : : "memory");
+    __asm__ volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(rest) : : "memory");
+}
+
+void memset_words(void* ptr, int value, size_t size) {
+    uint32_t pattern = (uint8_t)value * 0x01010101u;
+    size_t dwords = size / 4;
+    size_t rest = size % 4;
+    __asm__ volatile("rep stosl" : "+D"(ptr), "+c"(dwords) : "a"(pattern) : "memory");
+    __asm__ volatile("rep stosb" : "+D"(ptr), "+c"(rest) : "a"(pattern) : "memory");
+}
+
+// A word has a zero byte iff this is nonzero
+static uint32_t zero_byte_bits(uint32_t word) {
+    return (word - 0x01010101u) & ~word & 0x80808080u;
+}
+
+size_t strlen_words(const char* str) {
+    const char* p = str;
+    while ((uintptr_t)p & 3) {
+        if (!*p) {
+            return p - str;
+        }
+        p++;
+    }
+    const uint32_t* word = (const uint32_t*)p;
+    while (!zero_byte_bits(*word)) {
+        word++;
+    }
+    p = (const char*)word;
+    while (*p) {
+        p++;
+    }
+    return p - str;
+}
+
+// Only when a and b share an alignment are whole words compared, so that
+// neither read can reach a page past the end of its string
+int strcmp_words(const char* a, const char* b) {
+    while ((uintptr_t)a & 3) {
+        if (*a != *b || !*a) {
+            return *(const unsigned char*)a - *(const unsigned char*)b;
+        }
+        a++;
+        b++;
+    }
+    if (!((uintptr_t)b & 3)) {
+        const uint32_t* word_a = (const uint32_t*)a;
+        const uint32_t* word_b = (const uint32_t*)b;
+        while (*word_a == *word_b && !zero_byte_bits(*word_a)) {
+            word_a++;
+            word_b++;
+        }
+        a = (const char*)word_a;
+        b = (const char*)word_b;
+    }
+    return strcmp_bytes(a, b);
+}
+
+// SSE2
+
+// Copy blocks of 64 bytes to a 16-byte aligned destination
+SSE2 static void copy_blocks(uint8_t* dest, const uint8_t* src, size_t blocks) {
+    __asm__ volatile("1:\n\t"
+                     "movdqu (%1), %%xmm0\n\t"
+                     "movdqu 16(%1), %%xmm1\n\t"
+                     "movdqu 32(%1), %%xmm2\n\t"
+                     "movdqu 48(%1), %%xmm3\n\t"
+                     "movdqa %%xmm0, (%0)\n\t"
+                     "movdqa %%xmm1, 16(%0)\n\t"
+                     "movdqa %%xmm2, 32(%0)\n\t"
+                     "movdqa %%xmm3, 48(%0)\n\t"
+                     "add $64, %1\n\t"
+                     "add $64, %0\n\t"
+                     "dec %2\n\t"
+                     "jnz 1b"
+                     : "+r"(dest), "+r"(src), "+r"(blocks)
+                     :
+                     : "xmm0", "xmm1", "xmm2", "xmm3", "memory");
+}
+
+// Store the 16-byte pattern over blocks of 64 bytes at an aligned address
+SSE2 static void fill_blocks(uint8_t* dest, const uint32_t* pattern, size_t blocks) {
+    __asm__ volatile("movdqu (%2), %%xmm0\n\t"
+                     "1:\n\t"
+                     "movdqa %%xmm0, (%0)\n\t"
+                     "movdqa %%xmm0, 16(%0)\n\t"
+                     "movdqa %%xmm0, 32(%0)\n\t"
+                     "movdqa %%xmm0, 48(%0)\n\t"
+                     "add $64, %0\n\t"
+                     "dec %1\n\t"
+                     "jnz 1b"
+                     : "+r"(dest), "+r"(blocks)
+                     : "r"(pattern)
+                     : "xmm0", "memory");
+}
+
+void memcpy_sse2(void* dest, const void* src, size_t size) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    if (head > size) {
+        head = size;
+    }
+    memcpy_words(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    size_t blocks = size / 64;
+    if (blocks) {
+        copy_blocks(d, s, blocks);
+        d += blocks * 64;
+        s += blocks * 64;
+    }
+    memcpy_words(d, s, size % 64);
+}
+
+void memset_sse2(void* ptr, int value, size_t size) {
+    uint8_t* p = (uint8_t*)ptr;
+    size_t head = (16 - ((uintptr_t)p & 15)) & 15;
+    if (head > size) {
+        head = size;
+    }
+    memset_words(p, value, head);
+    p += head;
+    size -= head;
+
+    size_t blocks = size / 64;
+    if (blocks) {
+        uint32_t word = (uint8_t)value * 0x01010101u;
+        uint32_t pattern[4] = {word, word, word, word};
+        fill_blocks(p, pattern, blocks);
+        p += blocks * 64;
+    }
+    memset_words(p, value, size % 64);
+}
+
+// Bit i set where byte i of the 16 at block is zero
+SSE2 static uint32_t zero_mask(const char* block) {
+    uint32_t mask;
+    __asm__ volatile("pxor %%xmm0, %%xmm0\n\t"
+                     "pcmpeqb (%1), %%xmm0\n\t"
+                     "pmovmskb %%xmm0, %0"
+                     : "=r"(mask)
+                     : "r"(block)
+                     : "xmm0", "memory");
+    return mask;
+}
+
+size_t strlen_sse2(const char* str) {
+    // Aligned blocks never cross a page; ignore the bytes before str
+    const char* block = (const char*)((uintptr_t)str & ~(uintptr_t)15);
+    uint32_t mask = zero_mask(block) >> (str - block);
+    if (mask) {
+        return __builtin_ctz(mask);
+    }
+    for (;;) {
+        block += 16;
+        mask = zero_mask(block);
+        if (mask) {
+            return block + __builtin_ctz(mask) - str;
+        }
+    }
+}
+
+// Bit i set where byte i of a and b differ or a ends
+SSE2 static uint32_t stop_mask(const char* a, const char* b) {
+    uint32_t mask;
+    __asm__ volatile("movdqu (%1), %%xmm0\n\t"
+                     "movdqu (%2), %%xmm1\n\t"
+                     "pxor %%xmm2, %%xmm2\n\t"
+                     "pcmpeqb %%xmm0, %%xmm2\n\t"
+                     "pcmpeqb %%xmm0, %%xmm1\n\t"
+                     "pandn %%xmm1, %%xmm2\n\t"
+                     "pmovmskb %%xmm2, %0"
+                     : "=r"(mask)
+                     : "r"(a), "r"(b)
+                     : "xmm0", "xmm1", "xmm2", "memory");
+    return ~mask & 0xFFFF;
+}
+
+int strcmp_sse2(const char* a, const char* b) {
+    for (;;) {
+        if (((uintptr_t)a & PAGE_OFFSET_MASK) > PAGE_OFFSET_MASK - 15 ||
+            ((uintptr_t)b & PAGE_OFFSET_MASK) > PAGE_OFFSET_MASK - 15) {
+            // Within 16 bytes of a page end: a byte at a time until past it
+            if (*a != *b || !*a) {
+                return *(const unsigned char*)a - *(const unsigned char*)b;
+            }
+            a++;
+            b++;
+            continue;
+        }
+        uint32_t stop = stop_mask(a, b);
+        if (stop) {
+            uint32_t i = __builtin_ctz(stop);
+            return (unsigned char)a[i] - (unsigned char)b[i];
+        }
+        a += 16;
+        b += 16;
+    }
+}
+
+// Public entry points
+
+void* memcpy(void* dest, const void* src, size_t size) {
+    if (size >= KLIB_SSE_THRESHOLD && use_sse()) {
+        memcpy_sse2(dest, src, size);
+    } else {
+        memcpy_words(dest, src, size);
+    }
+    return dest;
+}
+
+void* memset(void* ptr, int value, size_t size) {
+    if (size >= KLIB_SSE_THRESHOLD && use_sse()) {
+        memset_sse2(ptr, value, size);
+    } else {
+        memset_words(ptr, value, size);
+    }
+    return ptr;
+}
+
+int memcmp(const void* a, const void* b, size_t size) {
+    const uint8_t* x = (const uint8_t*)a;
+    const uint8_t* y = (const uint8_t*)b;
+    for (size_t i = 0; i < size; i++) {
+        if (x[i] != y[i]) {
+            return x[i] - y[i];
+        }
+    }
+    return 0;
+}
+
+size_t strlen(const char* str) {
+    return use_sse() ? strlen_sse2(str) : strlen_words(str);
+}
+
+int strcmp(const char* a, const char* b) {
+    return use_sse() ? strcmp_sse2(a, b) : strcmp_words(a, b);
+}
+
+int strncmp(const char* a, const char* b, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (a[i] != b[i] || !a[i]) {
+            return (unsigned char)a[i] - (unsigned char)b[i];
+        }
+    }
+    return 0;
+}
+
+char* strcpy(char* dest, const char* src) {
+    memcpy_words(dest, src, strlen(src) + 1);
+    return dest;
+}
+
+char* strchr(const char* str, int c) {
+    for (; *str; str++) {
+        if (*str == (char)c) {
+            return (char*)str;
+        }
+    }
+    return c == 0 ? (char*)str : 0;
+}
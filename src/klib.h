@@ -0,0 +1,39 @@
+// klib.h - Memory and string primitives shared by the whole kernel
+#ifndef KLIB_H
+#define KLIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Copies and fills shorter than this are not worth the SSE2 setup
+#define KLIB_SSE_THRESHOLD 128
+
+// Function prototypes
+void klib_init(void);
+int klib_sse_enabled(void);
+
+void* memcpy(void* dest, const void* src, size_t size);
+void* memset(void* ptr, int value, size_t size);
+int memcmp(const void* a, const void* b, size_t size);
+size_t strlen(const char* str);
+int strcmp(const char* a, const char* b);
+int strncmp(const char* a, const char* b, size_t length);
+char* strcpy(char* dest, const char* src);
+char* strchr(const char* str, int c);
+
+// Each implementation on its own, for benchmarks; the _sse2 ones need
+// klib_sse_enabled() and must not run in interrupt handlers
+void memcpy_bytes(void* dest, const void* src, size_t size);
+void memcpy_words(void* dest, const void* src, size_t size);
+void memcpy_sse2(void* dest, const void* src, size_t size);
+void memset_bytes(void* ptr, int value, size_t size);
+void memset_words(void* ptr, int value, size_t size);
+void memset_sse2(void* ptr, int value, size_t size);
+size_t strlen_bytes(const char* str);
+size_t strlen_words(const char* str);
+size_t strlen_sse2(const char* str);
+int strcmp_bytes(const char* a, const char* b);
+int strcmp_words(const char* a, const char* b);
+int strcmp_sse2(const char* a, const char* b);
+
+#endif
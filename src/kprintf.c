@@ -0,0 +1,275 @@
+// kprintf.c - Kernel string formatting
+//
+// Supports %c %s %d %i %u %x %X %p %% with the '-', '0', '+' and ' ' flags,
+// field width and precision (either may be '*'), and the h, l, ll and z
+// length modifiers. Output is staged in a small buffer and handed to the
+// sink in chunks, so callers see a few bulk writes rather than one per char.
+#include "kprintf.h"
+#include "math64.h"
+
+#define KPRINTF_CHUNK 128
+
+#define FLAG_LEFT  0x01
+#define FLAG_ZERO  0x02
+#define FLAG_PLUS  0x04
+#define FLAG_SPACE 0x08
+
+struct kprintf_state {
+    kprintf_sink_t sink;
+    void* context;
+    char chunk[KPRINTF_CHUNK];
+    uint32_t used;
+    int total;
+};
+
+static void emit_flush(struct kprintf_state* state) {
+    if (state->used > 0) {
+        state->sink(state->context, state->chunk, state->used);
+        state->used = 0;
+    }
+}
+
+static void emit_char(struct kprintf_state* state, char c) {
+    if (state->used == KPRINTF_CHUNK) {
+        emit_flush(state);
+    }
+    state->chunk[state->used++] = c;
+    state->total++;
+}
+
+static void emit_repeat(struct kprintf_state* state, char c, int count) {
+    while (count-- > 0) {
+        emit_char(state, c);
+    }
+}
+
+static void emit_string(struct kprintf_state* state, const char* str, int len, int width, int flags) {
+    int pad = width > len ? width - len : 0;
+    if (!(flags & FLAG_LEFT)) {
+        emit_repeat(state, ' ', pad);
+    }
+    for (int i = 0; i < len; i++) {
+        emit_char(state, str[i]);
+    }
+    if (flags & FLAG_LEFT) {
+        emit_repeat(state, ' ', pad);
+    }
+}
+
+static void emit_number(struct kprintf_state* state, uint64_t value, int negative, uint32_t base,
+                        int uppercase, int width, int precision, int flags, const char* prefix) {
+    const char* digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+    char buffer[24];
+    int len = 0;
+
+    // Convert least significant digit first
+    if (value == 0 && precision != 0) {
+        buffer[len++] = '0';
+    }
+    while (value) {
+        uint32_t digit;
+        value = div_u64_rem(value, base, &digit);
+        buffer[len++] = digits[digit];
+    }
+
+    char sign = 0;
+    if (negative) {
+        sign = '-';
+    } else if (flags & FLAG_PLUS) {
+        sign = '+';
+    } else if (flags & FLAG_SPACE) {
+        sign = ' ';
+    }
+
+    int prefix_len = 0;
+    while (prefix && prefix[prefix_len]) {
+        prefix_len++;
+    }
+
+    int zeros = precision > len ? precision - len : 0;
+    int body = len + zeros + (sign ? 1 : 0) + prefix_len;
+    int pad = width > body ? width - body : 0;
+
+    // Zero padding only applies when there is no explicit precision
+    if ((flags & FLAG_ZERO) && !(flags & FLAG_LEFT) && precision < 0) {
+        zeros += pad;
+        pad = 0;
+    }
+
+    if (!(flags & FLAG_LEFT)) {
+        emit_repeat(state, ' ', pad);
+    }
+    if (sign) {
+        emit_char(state, sign);
+    }
+    for (int i = 0; i < prefix_len; i++) {
+        emit_char(state, prefix[i]);
+    }
+    emit_repeat(state, '0', zeros);
+    while (len > 0) {
+        emit_char(state, buffer[--len]);
+    }
+    if (flags & FLAG_LEFT) {
+        emit_repeat(state, ' ', pad);
+    }
+}
+
+int kformat(kprintf_sink_t sink, void* context, const char* format, va_list args) {
+    struct kprintf_state state;
+    state.sink = sink;
+    state.context = context;
+    state.used = 0;
+    state.total = 0;
+
+    for (const char* p = format; *p != '\0'; p++) {
+        if (*p != '%') {
+            emit_char(&state, *p);
+            continue;
+        }
+        p++; // Skip '%'
+
+        // Flags
+        int flags = 0;
+        for (;; p++) {
+            if (*p == '-') flags |= FLAG_LEFT;
+            else if (*p == '0') flags |= FLAG_ZERO;
+            else if (*p == '+') flags |= FLAG_PLUS;
+            else if (*p == ' ') flags |= FLAG_SPACE;
+            else break;
+        }
+
+        // Field width
+        int width = 0;
+        if (*p == '*') {
+            width = va_arg(args, int);
+            if (width < 0) {
+                flags |= FLAG_LEFT;
+                width = -width;
+            }
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                width = width * 10 + (*p++ - '0');
+            }
+        }
+
+        // Precision
+        int precision = -1;
+        if (*p == '.') {
+            p++;
+            precision = 0;
+            if (*p == '*') {
+                precision = va_arg(args, int);
+                p++;
+            } else {
+                while (*p >= '0' && *p <= '9') {
+                    precision = precision * 10 + (*p++ - '0');
+                }
+            }
+        }
+
+        // Length modifier: only "ll" changes the argument size on i386
+        int is_long_long = 0;
+        if (*p == 'l') {
+            p++;
+            if (*p == 'l') {
+                is_long_long = 1;
+                p++;
+            }
+        } else if (*p == 'h' || *p == 'z') {
+            p++;
+            if (*p == 'h') p++;
+        }
+
+        switch (*p) {
+            case 'c': {
+                char c = (char)va_arg(args, int);
+                emit_string(&state, &c, 1, width, flags);
+                break;
+            }
+            case 's': {
+                const char* str = va_arg(args, const char*);
+                if (!str) {
+                    str = "(null)";
+                }
+                int len = 0;
+                while (str[len] && (precision < 0 || len < precision)) {
+                    len++;
+                }
+                emit_string(&state, str, len, width, flags);
+                break;
+            }
+            case 'd':
+            case 'i': {
+                int64_t value = is_long_long ? va_arg(args, int64_t) : va_arg(args, int32_t);
+                uint64_t magnitude = value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+                emit_number(&state, magnitude, value < 0, 10, 0, width, precision, flags, 0);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X': {
+                uint64_t value = is_long_long ? va_arg(args, uint64_t) : va_arg(args, uint32_t);
+                uint32_t base = (*p == 'u') ? 10 : 16;
+                emit_number(&state, value, 0, base, *p == 'X', width, precision,
+                            flags & ~(FLAG_PLUS | FLAG_SPACE), 0);
+                break;
+            }
+            case 'p': {
+                uintptr_t value = (uintptr_t)va_arg(args, void*);
+                int digits = (int)sizeof(void*) * 2;
+                emit_number(&state, value, 0, 16, 0, width, digits, flags & FLAG_LEFT, "0x");
+                break;
+            }
+            case '%':
+                emit_char(&state, '%');
+                break;
+            case '\0':
+                p--; // Trailing '%': stop at the terminator
+                break;
+            default:
+                emit_char(&state, '%');
+                emit_char(&state, *p);
+                break;
+        }
+    }
+
+    emit_flush(&state);
+    return state.total;
+}
+
+struct buffer_sink {
+    char* buffer;
+    uint32_t size;
+    uint32_t pos;
+};
+
+static void buffer_sink_write(void* context, const char* data, uint32_t len) {
+    struct buffer_sink* sink = (struct buffer_sink*)context;
+    for (uint32_t i = 0; i < len && sink->pos + 1 < sink->size; i++) {
+        sink->buffer[sink->pos++] = data[i];
+    }
+}
+
+// Format into buffer, always NUL-terminating when size > 0. Returns the
+// length the full output would have had, like C99 vsnprintf.
+int kvsnprintf(char* buffer, uint32_t size, const char* format, va_list args) {
+    struct buffer_sink sink;
+    sink.buffer = buffer;
+    sink.size = size;
+    sink.pos = 0;
+
+    int total = kformat(buffer_sink_write, &sink, format, args);
+    if (size > 0) {
+        buffer[sink.pos] = '\0';
+    }
+    return total;
+}
+
+int ksnprintf(char* buffer, uint32_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int total = kvsnprintf(buffer, size, format, args);
+    va_end(args);
+    return total;
+}
@@ -0,0 +1,17 @@
+// kprintf.h - Kernel string formatting
+#ifndef KPRINTF_H
+#define KPRINTF_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+// Receives formatted output in chunks; len is never zero
+typedef void (*kprintf_sink_t)(void* context, const char* data, uint32_t len);
+
+// Function prototypes
+int kformat(kprintf_sink_t sink, void* context, const char* format, va_list args);
+int kvsnprintf(char* buffer, uint32_t size, const char* format, va_list args);
+int ksnprintf(char* buffer, uint32_t size, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif
@@ -0,0 +1,16 @@
+// ksyms.h - Kernel function symbols, generated from kernel.elf at build time
+#ifndef KSYMS_H
+#define KSYMS_H
+
+#include <stdint.h>
+
+struct ksym {
+    uint32_t address;
+    const char* name;
+};
+
+// Sorted by address; see tools/ksyms.sh
+extern const struct ksym ksyms[];
+extern const uint32_t ksym_count;
+
+#endif
@@ -0,0 +1,49 @@
+// math64.h - 64-bit arithmetic helpers for the 32-bit kernel
+//
+// The kernel is linked without libgcc, so plain 64-bit division would pull
+// in __udivdi3. These helpers stick to what i386 can do inline.
+#ifndef MATH64_H
+#define MATH64_H
+
+#include <stdint.h>
+
+// Divide a 64-bit value by a 32-bit divisor, optionally returning the remainder
+static inline uint64_t div_u64_rem(uint64_t dividend, uint32_t divisor, uint32_t* remainder) {
+#if defined(__x86_64__)
+    if (remainder) {
+        *remainder = (uint32_t)(dividend % divisor);
+    }
+    return dividend / divisor;
+#else
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+    uint32_t quotient_high = 0;
+    uint32_t quotient_low;
+    uint32_t rem;
+
+    // Reduce the high word first so the second divl cannot overflow
+    if (high >= divisor) {
+        quotient_high = high / divisor;
+        high %= divisor;
+    }
+    __asm__("divl %4" : "=a"(quotient_low), "=d"(rem) : "a"(low), "d"(high), "rm"(divisor));
+
+    if (remainder) {
+        *remainder = rem;
+    }
+    return ((uint64_t)quotient_high << 32) | quotient_low;
+#endif
+}
+
+// Compute (value * multiplier) >> shift without losing the top bits (shift <= 32)
+static inline uint64_t mul_u64_u32_shr(uint64_t value, uint32_t multiplier, unsigned int shift) {
+    uint32_t high = (uint32_t)(value >> 32);
+    uint32_t low = (uint32_t)value;
+    uint64_t result = ((uint64_t)low * multiplier) >> shift;
+    if (high) {
+        result += ((uint64_t)high * multiplier) << (32 - shift);
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,56 @@
+// multiboot.h - Multiboot (version 1) boot information structures
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdint.h>
+
+// Value left in EAX by a multiboot-compliant bootloader
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+// multiboot_info.flags bits
+#define MULTIBOOT_INFO_MEMORY  0x001
+#define MULTIBOOT_INFO_CMDLINE 0x004
+#define MULTIBOOT_INFO_MODS    0x008
+#define MULTIBOOT_INFO_MMAP    0x040
+
+// multiboot_mmap_entry.type values
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+#define MULTIBOOT_MEMORY_RESERVED  2
+#define MULTIBOOT_MEMORY_ACPI      3
+#define MULTIBOOT_MEMORY_NVS       4
+#define MULTIBOOT_MEMORY_BADRAM    5
+
+struct multiboot_info {
+    uint32_t flags;
+    uint32_t mem_lower;      // KiB below 1 MiB
+    uint32_t mem_upper;      // KiB above 1 MiB
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+} __attribute__((packed));
+
+// Entries are variable length: the next one starts size + 4 bytes later
+struct multiboot_mmap_entry {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed));
+
+struct multiboot_module {
+    uint32_t mod_start;
+    uint32_t mod_end;
+    uint32_t string;
+    uint32_t reserved;
+} __attribute__((packed));
+
+#endif
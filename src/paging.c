@@ -0,0 +1,236 @@
+// paging.c - Paging with 4 MiB identity mappings and demand-filled regions
+//
+// All physical memory the kernel manages is identity mapped with PSE large
+// pages, so the whole kernel fits in a handful of TLB entries and nothing
+// that ran before paging needs to change its pointers. Above that, a window
+// of 4 KiB pages backs lazy regions: each region has a fill callback, and a
+// page is only allocated and filled when it is first touched. Lazy pages are
+// mapped read-only, so stray writes fault instead of corrupting the source.
+#include "paging.h"
+#include "cpu.h"
+#include "idt.h"
+#include "pmm.h"
+#include "vga.h"
+
+#define PAGE_FAULT_VECTOR 14
+
+struct lazy_region {
+    uint32_t base;
+    uint32_t size;
+    page_fill_t fill;
+    void* context;
+    int used;
+};
+
+static uint32_t page_directory[PAGE_DIRECTORY_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static struct lazy_region regions[MAX_LAZY_REGIONS];
+static struct paging_stats stats;
+static int paging_on = 0;
+
+static void page_fault_panic(struct interrupt_frame* frame, uint32_t address, const char* reason) {
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
+    vga_printf("\nKernel panic: page fault at %08x (%s, %s): %s\n", address,
+               (frame->error_code & PF_PRESENT) ? "protection" : "not present",
+               (frame->error_code & PF_WRITE) ? "write" : "read", reason);
+    vga_printf("EIP=%08x EFLAGS=%08x\n", frame->eip, frame->eflags);
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+
+    for (;;) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
+// Page table covering a lazy-window address, allocated on first use
+static uint32_t* lazy_page_table(uint32_t address, int create) {
+    uint32_t pde = page_directory[address >> 22];
+    if (pde & PTE_PRESENT) {
+        return (uint32_t*)(pde & ~(PAGE_SIZE - 1));
+    }
+    if (!create) {
+        return 0;
+    }
+
+    uint32_t table = pmm_alloc_frame();
+    if (!table) {
+        return 0;
+    }
+    uint32_t* entries = (uint32_t*)table;
+    for (int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        entries[i] = 0;
+    }
+    page_directory[address >> 22] = table | PTE_PRESENT | PTE_WRITABLE;
+    return entries;
+}
+
+static struct lazy_region* find_region(uint32_t address) {
+    for (int i = 0; i < MAX_LAZY_REGIONS; i++) {
+        if (regions[i].used && address >= regions[i].base &&
+            address - regions[i].base < regions[i].size) {
+            return &regions[i];
+        }
+    }
+    return 0;
+}
+
+static void page_fault_handler(struct interrupt_frame* frame) {
+    uint32_t address = read_cr2();
+
+    if (frame->error_code & PF_PRESENT) {
+        page_fault_panic(frame, address, "write to a read-only mapping");
+    }
+
+    struct lazy_region* region = find_region(address);
+    if (!region) {
+        page_fault_panic(frame, address, "address is not mapped");
+    }
+
+    uint32_t page = address & ~(PAGE_SIZE - 1);
+    uint32_t* table = lazy_page_table(page, 1);
+    uint32_t physical = pmm_alloc_frame();
+    if (!table || !physical) {
+        page_fault_panic(frame, address, "out of memory populating mapping");
+    }
+
+    // The new frame is reachable through the identity map while we fill it
+    region->fill(region->context, page - region->base, (uint8_t*)physical);
+    table[(page >> 12) & (PAGE_TABLE_ENTRIES - 1)] = physical | PTE_PRESENT;
+    invlpg(page);
+
+    stats.lazy_faults++;
+    stats.lazy_pages++;
+}
+
+int paging_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_PSE)) {
+        vga_puts("Error: CPU lacks 4 MiB pages, paging disabled.\n");
+        return -1;
+    }
+    uint32_t global = (edx & CPUID_EDX_PGE) ? PTE_GLOBAL : 0;
+
+    // Identity map everything the frame allocator can hand out
+    struct pmm_stats pmm;
+    pmm_get_stats(&pmm);
+    uint64_t end = (uint64_t)pmm.highest_frame << PAGE_SHIFT;
+    if (end < 16 * 1024 * 1024) {
+        end = 16 * 1024 * 1024;
+    }
+    end = (end + LARGE_PAGE_SIZE - 1) & ~(uint64_t)(LARGE_PAGE_SIZE - 1);
+    if (end > PMM_MAX_ADDRESS) {
+        end = PMM_MAX_ADDRESS;
+    }
+
+    for (int i = 0; i < PAGE_DIRECTORY_ENTRIES; i++) {
+        page_directory[i] = 0;
+    }
+    for (uint32_t address = 0; address < end; address += LARGE_PAGE_SIZE) {
+        page_directory[address >> 22] = address | PTE_PRESENT | PTE_WRITABLE | PTE_LARGE | global;
+    }
+    stats.identity_mapped = (uint32_t)end;
+
+    idt_set_handler(PAGE_FAULT_VECTOR, page_fault_handler);
+
+    write_cr4(read_cr4() | CR4_PSE | (global ? CR4_PGE : 0));
+    write_cr3((uint32_t)page_directory);
+    // WP makes read-only pages apply to ring 0 too
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+    paging_on = 1;
+
+    vga_printf("Paging enabled: %u MiB identity mapped with 4 MiB pages.\n", stats.identity_mapped >> 20);
+    return 0;
+}
+
+int paging_enabled(void) {
+    return paging_on;
+}
+
+// Identity map the 4 MiB page holding a device's registers, uncached.
+// Fails if the page is already cached RAM or part of the lazy window.
+int paging_map_device(uint32_t address) {
+    if (!paging_on) {
+        return 0;
+    }
+    uint32_t page = address & ~(LARGE_PAGE_SIZE - 1);
+    uint32_t* pde = &page_directory[page >> 22];
+    if (page < stats.identity_mapped || (page >= LAZY_REGION_BASE && page < LAZY_REGION_BASE + LAZY_REGION_SIZE)) {
+        return -1;
+    }
+    if (!(*pde & PTE_PRESENT)) {
+        *pde = page | PTE_PRESENT | PTE_WRITABLE | PTE_LARGE | PTE_WRITE_THROUGH | PTE_NO_CACHE;
+        invlpg(page);
+    }
+    return 0;
+}
+
+// Reserve size bytes of the lazy window; pages are filled on first access
+void* paging_map_lazy(uint32_t size, page_fill_t fill, void* context) {
+    if (!paging_on || size == 0 || size > LAZY_REGION_SIZE) {
+        return 0;
+    }
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    int slot = -1;
+    for (int i = 0; i < MAX_LAZY_REGIONS; i++) {
+        if (!regions[i].used) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        return 0;
+    }
+
+    // First fit: slide past any region the candidate overlaps
+    uint32_t base = LAZY_REGION_BASE;
+    int moved = 1;
+    while (moved) {
+        moved = 0;
+        for (int i = 0; i < MAX_LAZY_REGIONS; i++) {
+            if (regions[i].used && base < regions[i].base + regions[i].size &&
+                regions[i].base < base + size) {
+                base = regions[i].base + regions[i].size;
+                moved = 1;
+            }
+        }
+        if (base + size > LAZY_REGION_BASE + LAZY_REGION_SIZE || base < LAZY_REGION_BASE) {
+            return 0;
+        }
+    }
+
+    regions[slot].base = base;
+    regions[slot].size = size;
+    regions[slot].fill = fill;
+    regions[slot].context = context;
+    regions[slot].used = 1;
+    stats.lazy_regions++;
+    return (void*)base;
+}
+
+void paging_unmap_lazy(void* address) {
+    struct lazy_region* region = find_region((uint32_t)address);
+    if (!region || region->base != (uint32_t)address) {
+        return;
+    }
+
+    for (uint32_t page = region->base; page < region->base + region->size; page += PAGE_SIZE) {
+        uint32_t* table = lazy_page_table(page, 0);
+        if (!table) {
+            continue;
+        }
+        uint32_t* entry = &table[(page >> 12) & (PAGE_TABLE_ENTRIES - 1)];
+        if (*entry & PTE_PRESENT) {
+            pmm_free_frame(*entry & ~(PAGE_SIZE - 1));
+            *entry = 0;
+            invlpg(page);
+            stats.lazy_pages--;
+        }
+    }
+
+    region->used = 0;
+    stats.lazy_regions--;
+}
+
+void paging_get_stats(struct paging_stats* out) {
+    *out = stats;
+}
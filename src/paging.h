@@ -0,0 +1,46 @@
+// paging.h - Paging with 4 MiB identity mappings and demand-filled regions
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+
+#define PAGE_DIRECTORY_ENTRIES 1024
+#define PAGE_TABLE_ENTRIES 1024
+#define LARGE_PAGE_SIZE 0x400000
+
+// Page directory / table entry flags
+#define PTE_PRESENT  0x001
+#define PTE_WRITABLE 0x002
+#define PTE_WRITE_THROUGH 0x008
+#define PTE_NO_CACHE 0x010
+#define PTE_LARGE    0x080
+#define PTE_GLOBAL   0x100
+
+// Page fault error code bits
+#define PF_PRESENT 0x01
+#define PF_WRITE   0x02
+
+// Virtual window for lazily populated mappings (256 MiB)
+#define LAZY_REGION_BASE 0xD0000000u
+#define LAZY_REGION_SIZE 0x10000000u
+#define MAX_LAZY_REGIONS 32
+
+// Fill one page of a lazy region; offset is the page's offset in the region
+typedef void (*page_fill_t)(void* context, uint32_t offset, uint8_t* page);
+
+struct paging_stats {
+    uint32_t identity_mapped;   // Bytes covered by 4 MiB identity pages
+    uint32_t lazy_regions;
+    uint32_t lazy_faults;       // Pages populated on first touch
+    uint32_t lazy_pages;        // Currently resident lazy pages
+};
+
+// Function prototypes
+int paging_init(void);
+int paging_enabled(void);
+int paging_map_device(uint32_t address);
+void* paging_map_lazy(uint32_t size, page_fill_t fill, void* context);
+void paging_unmap_lazy(void* address);
+void paging_get_stats(struct paging_stats* stats);
+
+#endif
@@ -0,0 +1,52 @@
+// pci.c - PCI configuration space access (mechanism #1)
+#include "pci.h"
+#include "io.h"
+
+static uint32_t config_address(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    return 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)(slot & 0x1F) << 11) |
+           ((uint32_t)(function & 0x07) << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_read32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, slot, function, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_write32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t value) {
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, slot, function, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+// Brute-force scan of every bus/slot/function for the first device of a class
+int pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_device* device) {
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            uint32_t id = pci_read32(bus, slot, 0, PCI_VENDOR_ID);
+            if ((id & 0xFFFF) == 0xFFFF) {
+                continue;
+            }
+
+            // Only multi-function devices have functions 1-7
+            uint8_t header = (pci_read32(bus, slot, 0, PCI_HEADER_TYPE & 0xFC) >> 16) & 0xFF;
+            uint8_t functions = (header & 0x80) ? 8 : 1;
+
+            for (uint8_t function = 0; function < functions; function++) {
+                id = pci_read32(bus, slot, function, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) == 0xFFFF) {
+                    continue;
+                }
+                uint32_t class_rev = pci_read32(bus, slot, function, PCI_CLASS_REVISION);
+                if ((class_rev >> 24) == class_code && ((class_rev >> 16) & 0xFF) == subclass) {
+                    device->bus = bus;
+                    device->slot = slot;
+                    device->function = function;
+                    device->vendor_id = id & 0xFFFF;
+                    device->device_id = id >> 16;
+                    device->prog_if = (class_rev >> 8) & 0xFF;
+                    return 0;
+                }
+            }
+        }
+    }
+    return -1;
+}
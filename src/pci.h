@@ -0,0 +1,38 @@
+// pci.h - PCI configuration space access (mechanism #1)
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+// Configuration space offsets
+#define PCI_VENDOR_ID   0x00
+#define PCI_COMMAND     0x04
+#define PCI_CLASS_REVISION 0x08
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0        0x10
+#define PCI_BAR4        0x20
+
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_BUS_MASTER  0x0004
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE  0x01
+
+struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t prog_if;
+};
+
+// Function prototypes
+uint32_t pci_read32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset);
+void pci_write32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t value);
+int pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_device* device);
+
+#endif
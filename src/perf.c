@@ -0,0 +1,89 @@
+// perf.c - TSC probes with log2 cycle histograms
+//
+// Each probe is a static struct next to the code it times and joins the
+// list the first time it fires, so nothing has to be declared up front.
+// Recording is a handful of adds and a bit scan; percentiles are read off
+// the histogram and are only as precise as a power of two.
+#include "perf.h"
+#include "idt.h"
+#include "math64.h"
+
+static struct perf_probe* probes;
+
+void perf_record(struct perf_probe* probe, uint64_t cycles) {
+    if (!probe->registered) {
+        uint32_t flags = irq_save();
+        if (!probe->registered) {
+            probe->next = probes;
+            probes = probe;
+            probe->registered = 1;
+        }
+        irq_restore(flags);
+    }
+
+    uint32_t bucket = 0;
+    if (cycles >> 32) {
+        bucket = 32 + (31 - __builtin_clz((uint32_t)(cycles >> 32)));
+    } else if (cycles) {
+        bucket = 31 - __builtin_clz((uint32_t)cycles);
+    }
+    if (bucket >= PERF_BUCKETS) {
+        bucket = PERF_BUCKETS - 1;
+    }
+
+    if (probe->count == 0 || cycles < probe->min) {
+        probe->min = cycles;
+    }
+    if (cycles > probe->max) {
+        probe->max = cycles;
+    }
+    probe->count++;
+    probe->total += cycles;
+    probe->buckets[bucket]++;
+}
+
+struct perf_probe* perf_probes(void) {
+    return probes;
+}
+
+// Upper bound of the bucket holding the given percentile, kept within the
+// observed minimum and maximum
+uint64_t perf_percentile(struct perf_probe* probe, uint32_t percent) {
+    if (probe->count == 0) {
+        return 0;
+    }
+    uint32_t rank = (uint32_t)div_u64_rem((uint64_t)probe->count * percent + 99, 100, 0);
+    uint32_t seen = 0;
+    uint32_t bucket = 0;
+    while (bucket < PERF_BUCKETS - 1) {
+        seen += probe->buckets[bucket];
+        if (seen >= rank) {
+            break;
+        }
+        bucket++;
+    }
+
+    uint64_t bound = (2ull << bucket) - 1;
+    if (bound > probe->max) {
+        bound = probe->max;
+    }
+    if (bound < probe->min) {
+        bound = probe->min;
+    }
+    return bound;
+}
+
+// Clear every probe's numbers; they stay registered
+void perf_reset(void) {
+    uint32_t flags = irq_save();
+    for (struct perf_probe* probe = probes; probe; probe = probe->next) {
+        probe->count = 0;
+        probe->total = 0;
+        probe->min = 0;
+        probe->max = 0;
+        for (int i = 0; i < PERF_BUCKETS; i++) {
+            probe->buckets[i] = 0;
+        }
+    }
+    irq_restore(flags);
+}
@@ -0,0 +1,52 @@
+// perf.h - TSC probes with log2 cycle histograms
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include "timer.h"
+
+// Bucket i counts calls that took [2^i, 2^(i+1)) cycles
+#define PERF_BUCKETS 40
+
+struct perf_probe {
+    const char* name;
+    struct perf_probe* next;    // Registered probes, most recent first
+    uint32_t registered;
+    uint32_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[PERF_BUCKETS];
+};
+
+struct perf_scope {
+    struct perf_probe* probe;
+    uint64_t start;
+};
+
+// Function prototypes
+void perf_record(struct perf_probe* probe, uint64_t cycles);
+struct perf_probe* perf_probes(void);
+uint64_t perf_percentile(struct perf_probe* probe, uint32_t percent);
+void perf_reset(void);
+
+// Probes exist only in builds made with -DPERF_PROBES (the default; make
+// RELEASE=1 leaves them out). PERF_FUNCTION() at the top of a function body
+// times everything up to whichever return it leaves by, callees included.
+#ifdef PERF_PROBES
+#define PERF_ENABLED 1
+
+static inline void perf_scope_end(struct perf_scope* scope) {
+    perf_record(scope->probe, rdtsc() - scope->start);
+}
+
+#define PERF_FUNCTION()                                                   \
+    static struct perf_probe perf_probe_ = { .name = __func__ };          \
+    struct perf_scope perf_scope_ __attribute__((cleanup(perf_scope_end))) = \
+        { &perf_probe_, rdtsc() }
+#else
+#define PERF_ENABLED 0
+#define PERF_FUNCTION() do { } while (0)
+#endif
+
+#endif
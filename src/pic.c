@@ -0,0 +1,83 @@
+// pic.c - 8259 programmable interrupt controller driver
+#include "pic.h"
+#include "io.h"
+
+#define ICW1_INIT   0x10
+#define ICW1_ICW4   0x01
+#define ICW4_8086   0x01
+#define OCW3_READ_ISR 0x0B
+
+void pic_init(void) {
+    // Start the initialization sequence on both controllers
+    outb(PIC1_COMMAND, ICW1_INIT | ICW1_ICW4);
+    io_wait();
+    outb(PIC2_COMMAND, ICW1_INIT | ICW1_ICW4);
+    io_wait();
+
+    // Move IRQ vectors out of the way of CPU exceptions
+    outb(PIC1_DATA, PIC1_VECTOR_OFFSET);
+    io_wait();
+    outb(PIC2_DATA, PIC2_VECTOR_OFFSET);
+    io_wait();
+
+    // Wire the slave PIC to IRQ2 of the master
+    outb(PIC1_DATA, 1 << 2);
+    io_wait();
+    outb(PIC2_DATA, 2);
+    io_wait();
+
+    outb(PIC1_DATA, ICW4_8086);
+    io_wait();
+    outb(PIC2_DATA, ICW4_8086);
+    io_wait();
+
+    // Mask everything except the cascade line; drivers unmask their own IRQs
+    outb(PIC1_DATA, 0xFF & ~(1 << 2));
+    outb(PIC2_DATA, 0xFF);
+}
+
+void pic_send_eoi(uint8_t irq) {
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+void pic_mask_irq(uint8_t irq) {
+    uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+void pic_unmask_irq(uint8_t irq) {
+    uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
+// Bit n set when IRQ n is masked
+uint16_t pic_get_mask(void) {
+    return inb(PIC1_DATA) | (inb(PIC2_DATA) << 8);
+}
+
+// Mask every line, for when the IO APIC takes over
+void pic_disable(void) {
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+// IRQ7 and IRQ15 fire spuriously when a request is withdrawn before the
+// CPU acknowledges it; the in-service register tells the two cases apart.
+int pic_is_spurious(uint8_t irq) {
+    if (irq == 7) {
+        outb(PIC1_COMMAND, OCW3_READ_ISR);
+        return !(inb(PIC1_COMMAND) & 0x80);
+    }
+    if (irq == 15) {
+        outb(PIC2_COMMAND, OCW3_READ_ISR);
+        if (!(inb(PIC2_COMMAND) & 0x80)) {
+            // The master still saw a real cascade interrupt
+            outb(PIC1_COMMAND, PIC_EOI);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+// pic.h - 8259 programmable interrupt controller driver
+#ifndef PIC_H
+#define PIC_H
+
+#include <stdint.h>
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+
+// IRQs 0-15 are remapped above the CPU exception vectors
+#define PIC1_VECTOR_OFFSET 0x20
+#define PIC2_VECTOR_OFFSET 0x28
+
+#define PIC_EOI 0x20
+
+// Function prototypes
+void pic_init(void);
+void pic_send_eoi(uint8_t irq);
+void pic_mask_irq(uint8_t irq);
+void pic_unmask_irq(uint8_t irq);
+int pic_is_spurious(uint8_t irq);
+uint16_t pic_get_mask(void);
+void pic_disable(void);
+
+#endif
@@ -0,0 +1,290 @@
+// pmm.c - Physical memory manager (buddy page-frame allocator)
+//
+// Free blocks of 2^order frames are kept on one doubly linked list per order,
+// with the list links stored in the free frames themselves. A byte per frame
+// records whether the frame heads a free block and of which order, which is
+// all that is needed to find and merge buddies. Allocation and free are
+// O(PMM_MAX_ORDER), i.e. logarithmic in the largest block. A spinlock
+// serialises them between CPUs. The page fault handler allocates too, but
+// the allocator only touches identity-mapped memory, so it cannot fault
+// while holding the lock.
+#include "pmm.h"
+#include "vga.h"
+#include "spinlock.h"
+
+#define FRAME_FREE_HEAD 0x80
+#define FRAME_ORDER_MASK 0x0F
+
+struct free_block {
+    struct free_block* next;
+    struct free_block* prev;
+};
+
+struct reserved_range {
+    uint32_t start;
+    uint32_t end;
+};
+
+// Provided by linker.ld
+extern uint8_t _kernel_start[];
+extern uint8_t _kernel_end[];
+
+static uint8_t* frame_state = 0;
+static uint32_t frame_count = 0;
+static struct free_block* free_lists[PMM_MAX_ORDER + 1];
+static struct pmm_stats stats;
+static struct spinlock pmm_lock;
+
+static struct reserved_range reserved[PMM_MAX_RESERVED];
+static int reserved_count = 0;
+
+static uint32_t align_up(uint32_t value) {
+    return (value + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+static void reserve_range(uint32_t start, uint32_t end) {
+    if (reserved_count < PMM_MAX_RESERVED && end > start) {
+        reserved[reserved_count].start = start & ~(PAGE_SIZE - 1);
+        reserved[reserved_count].end = align_up(end);
+        reserved_count++;
+    }
+}
+
+static int is_reserved(uint32_t address) {
+    for (int i = 0; i < reserved_count; i++) {
+        if (address >= reserved[i].start && address < reserved[i].end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void list_push(int order, uint32_t frame) {
+    struct free_block* block = (struct free_block*)(frame << PAGE_SHIFT);
+    block->prev = 0;
+    block->next = free_lists[order];
+    if (free_lists[order]) {
+        free_lists[order]->prev = block;
+    }
+    free_lists[order] = block;
+    frame_state[frame] = FRAME_FREE_HEAD | order;
+    stats.free_blocks[order]++;
+}
+
+static void list_remove(int order, uint32_t frame) {
+    struct free_block* block = (struct free_block*)(frame << PAGE_SHIFT);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        free_lists[order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    frame_state[frame] = 0;
+    stats.free_blocks[order]--;
+}
+
+// Walk the multiboot memory map, calling visit() for each available region
+static void for_each_available(struct multiboot_info* mbi, void (*visit)(uint64_t start, uint64_t end)) {
+    uint32_t offset = 0;
+    while (offset < mbi->mmap_length) {
+        struct multiboot_mmap_entry* entry = (struct multiboot_mmap_entry*)(mbi->mmap_addr + offset);
+        if (entry->type == MULTIBOOT_MEMORY_AVAILABLE && entry->len > 0) {
+            visit(entry->addr, entry->addr + entry->len);
+        }
+        offset += entry->size + sizeof(entry->size);
+    }
+}
+
+static uint64_t highest_available = 0;
+
+static void find_highest(uint64_t start, uint64_t end) {
+    (void)start;
+    if (end > highest_available) {
+        highest_available = end;
+    }
+}
+
+// Pick a spot for the frame_state array: the first available range that can
+// hold it without touching anything already reserved
+static uint32_t metadata_address = 0;
+
+static void find_metadata_spot(uint64_t start, uint64_t end) {
+    if (metadata_address || start >= PMM_MAX_ADDRESS) {
+        return;
+    }
+    if (end > PMM_MAX_ADDRESS) {
+        end = PMM_MAX_ADDRESS;
+    }
+    uint32_t candidate = align_up((uint32_t)start);
+    uint32_t needed = align_up(frame_count);
+    while ((uint64_t)candidate + needed <= end) {
+        int clear = 1;
+        for (uint32_t page = candidate; page < candidate + needed; page += PAGE_SIZE) {
+            if (is_reserved(page)) {
+                candidate = page + PAGE_SIZE;
+                clear = 0;
+                break;
+            }
+        }
+        if (clear) {
+            metadata_address = candidate;
+            return;
+        }
+    }
+}
+
+static void free_available(uint64_t start, uint64_t end) {
+    if (start >= PMM_MAX_ADDRESS) {
+        return;
+    }
+    if (end > PMM_MAX_ADDRESS) {
+        end = PMM_MAX_ADDRESS;
+    }
+    uint32_t first = align_up((uint32_t)start);
+    uint32_t last = (uint32_t)end & ~(PAGE_SIZE - 1);
+
+    for (uint32_t page = first; page < last; page += PAGE_SIZE) {
+        if (!is_reserved(page)) {
+            pmm_free_pages(page, 0);
+            stats.total_frames++;
+        }
+    }
+}
+
+int pmm_init(uint32_t magic, struct multiboot_info* mbi) {
+    for (int i = 0; i <= PMM_MAX_ORDER; i++) {
+        free_lists[i] = 0;
+        stats.free_blocks[i] = 0;
+    }
+    stats.total_memory = 0;
+    stats.total_frames = 0;
+    stats.free_frames = 0;
+
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !(mbi->flags & MULTIBOOT_INFO_MMAP)) {
+        vga_puts("Error: No multiboot memory map, physical memory manager disabled.\n");
+        return -1;
+    }
+
+    // Low memory (BIOS data, VGA, option ROMs), the kernel image, and
+    // everything GRUB handed over must never be allocated
+    reserve_range(0, 0x100000);
+    reserve_range((uint32_t)_kernel_start, (uint32_t)_kernel_end);
+    reserve_range((uint32_t)mbi, (uint32_t)mbi + sizeof(struct multiboot_info));
+    reserve_range(mbi->mmap_addr, mbi->mmap_addr + mbi->mmap_length);
+    if (mbi->flags & MULTIBOOT_INFO_MODS) {
+        struct multiboot_module* mods = (struct multiboot_module*)mbi->mods_addr;
+        reserve_range(mbi->mods_addr, mbi->mods_addr + mbi->mods_count * sizeof(struct multiboot_module));
+        for (uint32_t i = 0; i < mbi->mods_count; i++) {
+            reserve_range(mods[i].mod_start, mods[i].mod_end);
+        }
+    }
+
+    // Total memory across all map entries, for reporting
+    uint32_t offset = 0;
+    while (offset < mbi->mmap_length) {
+        struct multiboot_mmap_entry* entry = (struct multiboot_mmap_entry*)(mbi->mmap_addr + offset);
+        stats.total_memory += entry->len;
+        offset += entry->size + sizeof(entry->size);
+    }
+
+    for_each_available(mbi, find_highest);
+    if (highest_available > PMM_MAX_ADDRESS) {
+        highest_available = PMM_MAX_ADDRESS;
+    }
+    frame_count = (uint32_t)(highest_available >> PAGE_SHIFT);
+    stats.highest_frame = frame_count;
+
+    for_each_available(mbi, find_metadata_spot);
+    if (!metadata_address) {
+        vga_puts("Error: No room for the frame table, physical memory manager disabled.\n");
+        frame_count = 0;
+        return -1;
+    }
+    frame_state = (uint8_t*)metadata_address;
+    for (uint32_t i = 0; i < frame_count; i++) {
+        frame_state[i] = 0;
+    }
+    reserve_range(metadata_address, metadata_address + frame_count);
+
+    for_each_available(mbi, free_available);
+
+    vga_printf("Physical memory: %u MiB free in %u frames.\n",
+               stats.free_frames >> (20 - PAGE_SHIFT), stats.free_frames);
+    return 0;
+}
+
+// Allocate 2^order physically contiguous frames. Returns 0 when out of memory.
+uint32_t pmm_alloc_pages(int order) {
+    if (order < 0 || order > PMM_MAX_ORDER) {
+        return 0;
+    }
+
+    spin_lock(&pmm_lock);
+    int current = order;
+    while (current <= PMM_MAX_ORDER && !free_lists[current]) {
+        current++;
+    }
+    if (current > PMM_MAX_ORDER) {
+        spin_unlock(&pmm_lock);
+        return 0;
+    }
+
+    uint32_t frame = (uint32_t)free_lists[current] >> PAGE_SHIFT;
+    list_remove(current, frame);
+
+    // Split down to the requested size, returning the upper halves
+    while (current > order) {
+        current--;
+        list_push(current, frame + (1u << current));
+    }
+
+    frame_state[frame] = order;
+    stats.free_frames -= 1u << order;
+    spin_unlock(&pmm_lock);
+    return frame << PAGE_SHIFT;
+}
+
+void pmm_free_pages(uint32_t address, int order) {
+    uint32_t frame = address >> PAGE_SHIFT;
+    if (address == 0 || frame >= frame_count || order < 0 || order > PMM_MAX_ORDER) {
+        return;
+    }
+    spin_lock(&pmm_lock);
+    stats.free_frames += 1u << order;
+
+    // Merge with the buddy for as long as it is a free block of the same order
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = frame ^ (1u << order);
+        if (buddy >= frame_count || frame_state[buddy] != (FRAME_FREE_HEAD | order)) {
+            break;
+        }
+        list_remove(order, buddy);
+        frame &= ~(1u << order);
+        order++;
+    }
+    list_push(order, frame);
+    spin_unlock(&pmm_lock);
+}
+
+uint32_t pmm_alloc_frame(void) {
+    return pmm_alloc_pages(0);
+}
+
+void pmm_free_frame(uint32_t address) {
+    pmm_free_pages(address, 0);
+}
+
+// Smallest order whose block holds size bytes
+int pmm_order_for_size(uint32_t size) {
+    int order = 0;
+    while (order <= PMM_MAX_ORDER && ((uint32_t)PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+void pmm_get_stats(struct pmm_stats* out) {
+    *out = stats;
+}
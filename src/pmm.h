@@ -0,0 +1,37 @@
+// pmm.h - Physical memory manager (buddy page-frame allocator)
+#ifndef PMM_H
+#define PMM_H
+
+#include <stdint.h>
+#include "multiboot.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+
+// Largest block is 2^PMM_MAX_ORDER frames (4 MiB)
+#define PMM_MAX_ORDER 10
+
+// Frames above this address are left alone so the top of the 32-bit
+// address space stays free for MMIO and kernel virtual mappings
+#define PMM_MAX_ADDRESS 0xC0000000u
+
+#define PMM_MAX_RESERVED 16
+
+struct pmm_stats {
+    uint64_t total_memory;      // Bytes reported by the bootloader (all types)
+    uint32_t total_frames;      // Frames handed to the allocator at boot
+    uint32_t free_frames;
+    uint32_t highest_frame;     // One past the highest managed frame number
+    uint32_t free_blocks[PMM_MAX_ORDER + 1];
+};
+
+// Function prototypes
+int pmm_init(uint32_t magic, struct multiboot_info* mbi);
+uint32_t pmm_alloc_pages(int order);
+void pmm_free_pages(uint32_t address, int order);
+uint32_t pmm_alloc_frame(void);
+void pmm_free_frame(uint32_t address);
+int pmm_order_for_size(uint32_t size);
+void pmm_get_stats(struct pmm_stats* stats);
+
+#endif
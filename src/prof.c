@@ -0,0 +1,92 @@
+// prof.c - Sampling profiler driven by the timer tick
+//
+// Every timer interrupt stores the interrupted EIP in a fixed ring, which
+// is all the work done per tick. Samples are only attributed when a report
+// is asked for: each is looked up in the symbol table the Makefile builds
+// from kernel.elf (tools/ksyms.sh) and counted against the function
+// containing it. Time spent halted shows up under cpu_idle.
+#include "prof.h"
+#include "ksyms.h"
+#include "kheap.h"
+
+// End of the kernel's code, from linker.ld
+extern char _text_end[];
+
+static uint32_t samples[PROF_SAMPLES];
+static volatile uint32_t head;          // Samples taken since the last reset
+static volatile int enabled = 1;
+
+// Called from the timer interrupt
+void prof_sample(uint32_t eip) {
+    if (enabled) {
+        samples[head & (PROF_SAMPLES - 1)] = eip;
+        head++;
+    }
+}
+
+void prof_set_enabled(int on) {
+    enabled = on;
+}
+
+int prof_enabled(void) {
+    return enabled;
+}
+
+void prof_reset(void) {
+    head = 0;
+}
+
+// Index of the function containing address, or ksym_count if none does
+static uint32_t find_symbol(uint32_t address) {
+    if (ksym_count == 0 || address < ksyms[0].address || address >= (uint32_t)_text_end) {
+        return ksym_count;
+    }
+    uint32_t low = 0;
+    uint32_t high = ksym_count;
+    while (high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if (ksyms[middle].address <= address) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Fill top with up to max functions by sample count, most sampled first,
+// and set total to the samples considered. Samples outside every function
+// form one entry with a null name. Returns the entries filled or -1.
+int prof_top(struct prof_entry* top, uint32_t max, uint32_t* total) {
+    uint32_t* counts = kzalloc((ksym_count + 1) * sizeof(uint32_t));
+    if (!counts) {
+        return -1;
+    }
+
+    // Samples landing while this runs may replace the oldest; that is noise
+    uint32_t taken = head;
+    uint32_t count = taken < PROF_SAMPLES ? taken : PROF_SAMPLES;
+    for (uint32_t i = 0; i < count; i++) {
+        counts[find_symbol(samples[(taken - 1 - i) & (PROF_SAMPLES - 1)])]++;
+    }
+    *total = count;
+
+    uint32_t filled = 0;
+    while (filled < max) {
+        uint32_t best = 0;
+        for (uint32_t i = 1; i <= ksym_count; i++) {
+            if (counts[i] > counts[best]) {
+                best = i;
+            }
+        }
+        if (counts[best] == 0) {
+            break;
+        }
+        top[filled].name = best < ksym_count ? ksyms[best].name : 0;
+        top[filled].samples = counts[best];
+        counts[best] = 0;
+        filled++;
+    }
+    kfree(counts);
+    return (int)filled;
+}
@@ -0,0 +1,24 @@
+// prof.h - Sampling profiler driven by the timer tick
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+
+// Most recent samples kept; a power of two, about a minute at TIMER_HZ
+#define PROF_SAMPLES 65536
+
+#define PROF_DEFAULT_TOP 20
+
+struct prof_entry {
+    const char* name;           // Null for addresses outside any function
+    uint32_t samples;
+};
+
+// Function prototypes
+void prof_sample(uint32_t eip);
+void prof_set_enabled(int on);
+int prof_enabled(void);
+void prof_reset(void);
+int prof_top(struct prof_entry* top, uint32_t max, uint32_t* total);
+
+#endif
@@ -0,0 +1,191 @@
+// sched.c - Per-CPU run queues with work stealing
+//
+// Kernel work is split into tasks: a function and an argument that run to
+// completion on whichever CPU picks them up. Each CPU owns a bounded deque.
+// It spawns onto the tail and takes work back from the tail, so the task it
+// queued last, whose data is still in its cache, runs first; an idle CPU
+// steals from the head of another queue instead, taking the oldest task.
+// A CPU that finds nothing anywhere sets its bit in idle_mask and halts, and
+// spawning wakes one such CPU with an IPI. The CPU waiting on a task group
+// runs tasks itself until the group is done.
+//
+// Tasks run with interrupts enabled on any CPU. They may allocate memory
+// and spawn more tasks, but must not use the console, the file system or
+// lazy mappings, none of which is safe to enter from two CPUs at once.
+#include "sched.h"
+#include "smp.h"
+#include "apic.h"
+#include "cpu.h"
+#include "spinlock.h"
+
+struct task {
+    task_fn_t fn;
+    void* arg;
+    struct task_group* group;
+};
+
+struct run_queue {
+    struct spinlock lock;
+    uint32_t head;                  // Oldest task, where thieves take
+    uint32_t tail;                  // Next free slot, where the owner works
+    struct task tasks[SCHED_QUEUE_SIZE];
+    struct sched_stats stats;       // Only written by the owning CPU
+} __attribute__((aligned(64)));
+
+static struct run_queue queues[SMP_MAX_CPUS];
+static volatile uint32_t idle_mask;
+
+static int queue_empty(struct run_queue* queue) {
+    return __atomic_load_n(&queue->head, __ATOMIC_RELAXED) ==
+           __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+}
+
+static void run_task(struct run_queue* queue, struct task* task) {
+    task->fn(task->arg);
+    queue->stats.executed++;
+    __atomic_sub_fetch(&task->group->pending, 1, __ATOMIC_RELEASE);
+}
+
+// Wake one halted CPU other than self, if there is one
+static void wake_idle_cpu(uint32_t self) {
+    // Pairs with the idle loop setting its bit before checking the queues
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t idle = idle_mask & ~(1u << self);
+    while (idle) {
+        uint32_t target = __builtin_ctz(idle);
+        uint32_t bit = 1u << target;
+        if (__atomic_fetch_and(&idle_mask, ~bit, __ATOMIC_SEQ_CST) & bit) {
+            lapic_send_ipi(cpus[target].apic_id, APIC_IPI_VECTOR);
+            return;
+        }
+        idle &= ~bit;
+    }
+}
+
+// Queue fn(arg) as part of group. Not for interrupt handlers.
+void sched_spawn(struct task_group* group, task_fn_t fn, void* arg) {
+    uint32_t self = this_cpu()->index;
+    struct run_queue* queue = &queues[self];
+    struct task task = {fn, arg, group};
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+
+    spin_lock(&queue->lock);
+    if (queue->tail - queue->head == SCHED_QUEUE_SIZE) {
+        spin_unlock(&queue->lock);
+        queue->stats.overflowed++;
+        run_task(queue, &task);
+        return;
+    }
+    queue->tasks[queue->tail % SCHED_QUEUE_SIZE] = task;
+    queue->tail++;
+    queue->stats.spawned++;
+    spin_unlock(&queue->lock);
+
+    wake_idle_cpu(self);
+}
+
+static int take_own(struct run_queue* queue, struct task* task) {
+    if (queue_empty(queue)) {
+        return 0;
+    }
+    spin_lock(&queue->lock);
+    int found = queue->tail != queue->head;
+    if (found) {
+        queue->tail--;
+        *task = queue->tasks[queue->tail % SCHED_QUEUE_SIZE];
+    }
+    spin_unlock(&queue->lock);
+    return found;
+}
+
+// Thieves skip a queue whose lock is busy rather than wait on it
+static int steal(struct run_queue* queue, struct task* task) {
+    if (queue_empty(queue) || !spin_trylock(&queue->lock)) {
+        return 0;
+    }
+    int found = queue->tail != queue->head;
+    if (found) {
+        *task = queue->tasks[queue->head % SCHED_QUEUE_SIZE];
+        queue->head++;
+    }
+    spin_unlock(&queue->lock);
+    return found;
+}
+
+// Run one task from this CPU's queue or, failing that, another's. Returns
+// whether there was one.
+static int run_one(uint32_t self) {
+    struct run_queue* queue = &queues[self];
+    struct task task;
+    if (take_own(queue, &task)) {
+        run_task(queue, &task);
+        return 1;
+    }
+
+    // Start with the next CPU so thieves spread over the victims
+    uint32_t count = smp_cpu_count();
+    for (uint32_t i = 1; i < count; i++) {
+        if (steal(&queues[(self + i) % count], &task)) {
+            queue->stats.stolen++;
+            run_task(queue, &task);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int work_queued(void) {
+    uint32_t count = smp_cpu_count();
+    for (uint32_t i = 0; i < count; i++) {
+        if (!queue_empty(&queues[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Help with queued work until every task in group has finished
+void sched_wait(struct task_group* group) {
+    uint32_t self = this_cpu()->index;
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE)) {
+        if (!run_one(self)) {
+            cpu_relax();
+        }
+    }
+}
+
+// Where application processors spend their lives
+void sched_idle(void) {
+    uint32_t self = this_cpu()->index;
+    uint32_t bit = 1u << self;
+    for (;;) {
+        if (run_one(self)) {
+            continue;
+        }
+
+        // Advertise as idle, then look once more with interrupts off: a
+        // spawn after the look sends an IPI, and sti only takes effect once
+        // hlt has started, so the IPI always ends the halt.
+        interrupts_disable();
+        __atomic_or_fetch(&idle_mask, bit, __ATOMIC_SEQ_CST);
+        if (work_queued()) {
+            __atomic_and_fetch(&idle_mask, ~bit, __ATOMIC_SEQ_CST);
+            interrupts_enable();
+            continue;
+        }
+        queues[self].stats.sleeps++;
+        __asm__ volatile("sti; hlt");
+        __atomic_and_fetch(&idle_mask, ~bit, __ATOMIC_SEQ_CST);
+    }
+}
+
+void sched_get_stats(uint32_t cpu, struct sched_stats* stats) {
+    *stats = queues[cpu].stats;
+}
+
+void sched_reset_stats(void) {
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        struct sched_stats empty = {0};
+        queues[i].stats = empty;
+    }
+}
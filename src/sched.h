@@ -0,0 +1,33 @@
+// sched.h - Per-CPU run queues with work stealing
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+// Tasks one CPU can have queued; spawning onto a full queue runs the task
+// on the spot
+#define SCHED_QUEUE_SIZE 256
+
+typedef void (*task_fn_t)(void* arg);
+
+// Tasks spawned and not yet finished; zero-initialise before the first spawn
+struct task_group {
+    volatile uint32_t pending;
+};
+
+struct sched_stats {
+    uint32_t spawned;       // Pushed onto this CPU's queue
+    uint32_t executed;      // Run on this CPU, from any queue
+    uint32_t stolen;        // Taken from another CPU's queue
+    uint32_t overflowed;    // Run at spawn time because the queue was full
+    uint32_t sleeps;        // Halts waiting for work
+};
+
+// Function prototypes
+void sched_spawn(struct task_group* group, task_fn_t fn, void* arg);
+void sched_wait(struct task_group* group);
+void sched_idle(void) __attribute__((noreturn));
+void sched_get_stats(uint32_t cpu, struct sched_stats* stats);
+void sched_reset_stats(void);
+
+#endif
@@ -0,0 +1,196 @@
+// serial.c - 16550 UART serial console driver
+//
+// Output is queued in a ring and drained by the transmitter-empty interrupt,
+// 16 bytes per interrupt into the UART FIFO, so printing never spins on the
+// line status register. Received bytes are fed into the keyboard event ring
+// so the shell can be driven over the serial line.
+#include "serial.h"
+#include "idt.h"
+#include "io.h"
+#include "keyboard.h"
+#include "timer.h"
+
+#define IER_RX_AVAILABLE 0x01
+#define IER_TX_EMPTY     0x02
+#define LSR_DATA_READY   0x01
+#define LSR_TX_EMPTY     0x20
+#define LSR_TX_IDLE      0x40   // Holding and shift registers both empty
+
+static int uart_present = 0;
+static int last_rx_was_cr = 0;
+
+// Producer: serial_write(); consumer: the IRQ4 handler
+static char tx_buffer[SERIAL_TX_BUFFER_SIZE];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+static volatile int tx_active = 0;   // THRE interrupt enabled and pending
+
+static struct serial_stats stats;
+
+// Move up to one FIFO's worth of queued bytes into the transmitter.
+// Only called with interrupts disabled.
+static void serial_fill_fifo(void) {
+    int sent = 0;
+    while (tx_tail != tx_head && sent < UART_FIFO_SIZE) {
+        outb(COM1_PORT + UART_DATA, tx_buffer[tx_tail & (SERIAL_TX_BUFFER_SIZE - 1)]);
+        tx_tail++;
+        sent++;
+    }
+    stats.tx_bytes += sent;
+}
+
+static void serial_receive(char c) {
+    // Terminals send CR (or CR LF) for Enter and DEL for Backspace
+    if (c == '\n' && last_rx_was_cr) {
+        last_rx_was_cr = 0;
+        return;
+    }
+    last_rx_was_cr = (c == '\r');
+    if (c == '\r') {
+        c = '\n';
+    } else if (c == 0x7F) {
+        c = '\b';
+    }
+    stats.rx_bytes++;
+    keyboard_push_event((uint8_t)c);
+}
+
+static void serial_irq_handler(struct interrupt_frame* frame) {
+    (void)frame;
+
+    // Service every pending cause; bit 0 of IIR is set when none remain
+    uint8_t iir;
+    while (!((iir = inb(COM1_PORT + UART_IIR)) & 0x01)) {
+        switch (iir & 0x0E) {
+            case 0x06: // Line status
+                inb(COM1_PORT + UART_LSR);
+                break;
+            case 0x04: // Received data
+            case 0x0C: // Character timeout
+                while (inb(COM1_PORT + UART_LSR) & LSR_DATA_READY) {
+                    serial_receive((char)inb(COM1_PORT + UART_DATA));
+                }
+                break;
+            case 0x02: // Transmitter holding register empty
+                stats.tx_interrupts++;
+                if (tx_tail == tx_head) {
+                    outb(COM1_PORT + UART_IER, IER_RX_AVAILABLE);
+                    tx_active = 0;
+                } else {
+                    serial_fill_fifo();
+                }
+                break;
+            default: // Modem status
+                inb(COM1_PORT + UART_MSR);
+                break;
+        }
+    }
+}
+
+int serial_init(void) {
+    outb(COM1_PORT + UART_IER, 0x00);          // Disable interrupts
+    outb(COM1_PORT + UART_LCR, 0x80);          // DLAB on to set the divisor
+    outb(COM1_PORT + UART_DATA, (115200 / SERIAL_BAUD) & 0xFF);
+    outb(COM1_PORT + UART_IER, ((115200 / SERIAL_BAUD) >> 8) & 0xFF);
+    outb(COM1_PORT + UART_LCR, 0x03);          // 8 bits, no parity, one stop bit
+    outb(COM1_PORT + UART_IIR, 0xC7);          // Enable and clear FIFOs, 14-byte RX trigger
+
+    // Loopback self-test to see whether a UART is actually there
+    outb(COM1_PORT + UART_MCR, 0x1E);
+    outb(COM1_PORT + UART_DATA, 0xAE);
+    if (inb(COM1_PORT + UART_DATA) != 0xAE) {
+        return -1;
+    }
+
+    // Normal operation: DTR, RTS and OUT2 (which gates the IRQ line)
+    outb(COM1_PORT + UART_MCR, 0x0B);
+    uart_present = 1;
+
+    irq_install_handler(IRQ_COM1, serial_irq_handler);
+    outb(COM1_PORT + UART_IER, IER_RX_AVAILABLE);
+    return 0;
+}
+
+int serial_present(void) {
+    return uart_present;
+}
+
+// Push queued bytes out by polling. Used when interrupts are off (early boot,
+// panics, IRQ context) and nothing else would ever drain the queue.
+static void serial_drain_polling(void) {
+    while (tx_tail != tx_head) {
+        while (!(inb(COM1_PORT + UART_LSR) & LSR_TX_EMPTY)) {
+        }
+        serial_fill_fifo();
+    }
+}
+
+// Arm the transmitter interrupt; a 16550 raises THRE right away if idle
+static void serial_kick(void) {
+    uint32_t flags = irq_save();
+    if (!tx_active && tx_tail != tx_head) {
+        tx_active = 1;
+        outb(COM1_PORT + UART_IER, IER_RX_AVAILABLE | IER_TX_EMPTY);
+    }
+    irq_restore(flags);
+}
+
+static void serial_enqueue(char c) {
+    while (tx_head - tx_tail >= SERIAL_TX_BUFFER_SIZE) {
+        stats.tx_stalls++;
+        if (interrupts_enabled()) {
+            serial_kick();
+            cpu_idle();
+        } else {
+            serial_drain_polling();
+        }
+    }
+    tx_buffer[tx_head & (SERIAL_TX_BUFFER_SIZE - 1)] = c;
+    __asm__ volatile("" ::: "memory");
+    tx_head++;
+}
+
+void serial_write(const char* data, uint32_t len) {
+    if (!uart_present) {
+        return;
+    }
+
+    int irqs_on = interrupts_enabled();
+    for (uint32_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (c == '\n') {
+            serial_enqueue('\r');
+        } else if (c == '\b') {
+            // Erase the character on the terminal like the VGA console does
+            serial_enqueue('\b');
+            serial_enqueue(' ');
+        }
+        serial_enqueue(c);
+    }
+
+    if (irqs_on) {
+        serial_kick();
+    } else {
+        serial_drain_polling();
+    }
+}
+
+// Wait until every queued byte has left the line, e.g. before powering off
+void serial_flush(void) {
+    if (!uart_present) {
+        return;
+    }
+    uint32_t flags = irq_save();
+    serial_drain_polling();
+    while (!(inb(COM1_PORT + UART_LSR) & LSR_TX_IDLE)) {
+    }
+    irq_restore(flags);
+}
+
+void serial_putchar(char c) {
+    serial_write(&c, 1);
+}
+
+void serial_get_stats(struct serial_stats* out) {
+    *out = stats;
+}
@@ -0,0 +1,39 @@
+// serial.h - 16550 UART serial console driver
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+
+#define COM1_PORT 0x3F8
+#define SERIAL_BAUD 115200
+
+// UART register offsets from the base port
+#define UART_DATA       0   // RBR/THR (DLL when DLAB is set)
+#define UART_IER        1   // Interrupt enable (DLM when DLAB is set)
+#define UART_IIR        2   // Interrupt identification (read) / FIFO control (write)
+#define UART_LCR        3
+#define UART_MCR        4
+#define UART_LSR        5
+#define UART_MSR        6
+
+#define UART_FIFO_SIZE 16
+
+// Must be a power of two so the ring indices can wrap with a mask
+#define SERIAL_TX_BUFFER_SIZE 4096
+
+struct serial_stats {
+    uint32_t tx_bytes;
+    uint32_t rx_bytes;
+    uint32_t tx_interrupts;
+    uint32_t tx_stalls;    // Writes that found the queue full
+};
+
+// Function prototypes
+int serial_init(void);
+int serial_present(void);
+void serial_putchar(char c);
+void serial_write(const char* data, uint32_t len);
+void serial_flush(void);
+void serial_get_stats(struct serial_stats* stats);
+
+#endif
@@ -3,28 +3,57 @@
 #include "vga.h"
 #include "keyboard.h"
 #include "filesystem.h"
+#include "timer.h"
+#include "serial.h"
+#include "pmm.h"
+#include "kheap.h"
+#include "paging.h"
+#include "math64.h"
+#include "ata.h"
+#include "bcache.h"
+#include "perf.h"
+#include "prof.h"
+#include "ksyms.h"
+#include "smp.h"
+#include "sched.h"
+#include "apic.h"
+#include "klib.h"
 
-static char shell_buffer[SHELL_BUFFER_SIZE];
-static char file_buffer[MAX_FILE_SIZE];
-
-// Simple string functions
-
-static int strncmp(const char* str1, const char* str2, int n) {
-    while (n > 0 && *str1 && (*str1 == *str2)) {
-        str1++;
-        str2++;
-        n--;
+// Match the first word of a command line exactly, so "rm" doesn't swallow "rmdir"
+static int command_is(const char* command, const char* name) {
+    int len = strlen(name);
+    if (strncmp(command, name, len) != 0) {
+        return 0;
     }
-    if (n == 0) return 0;
-    return *(unsigned char*)str1 - *(unsigned char*)str2;
+    return command[len] == '\0' || command[len] == ' ' || command[len] == '\t';
 }
 
+// Parse a non-negative decimal number ending the argument, returning -1 if
+// there are no digits, anything else follows them, or it exceeds INT_MAX
+static int parse_uint(const char* str) {
+    int value = 0;
+    if (*str < '0' || *str > '9') {
+        return -1;
+    }
+    while (*str >= '0' && *str <= '9') {
+        int digit = *str - '0';
+        if (value > (__INT_MAX__ - digit) / 10) {
+            return -1;
+        }
+        value = value * 10 + digit;
+        str++;
+    }
+    if (*str != '\0' && *str != ' ' && *str != '\t') {
+        return -1;
+    }
+    return value;
+}
 
-
-static int strlen(const char* str) {
-    int len = 0;
-    while (str[len]) len++;
-    return len;
+// Format a nanosecond duration as milliseconds with three decimals
+static void print_ms(uint64_t ns) {
+    uint32_t frac_us;
+    uint64_t ms = div_u64_rem(div_u64_rem(ns, 1000, 0), 1000, &frac_us);
+    vga_printf("%llu.%03u ms", ms, frac_us);
 }
 
 // Skip whitespace
@@ -55,12 +84,9 @@ void shell_init(void) {
 }
 
 void shell_prompt(void) {
-    char current_path[MAX_PATH_LENGTH];
-    fs_get_current_path(current_path, MAX_PATH_LENGTH);
-    
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     vga_puts("myos:");
-    vga_puts(current_path);
+    vga_puts(fs_current_path());
     vga_puts("$ ");
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
 }
@@ -97,63 +123,73 @@ int shell_read_line(char* buffer, int max_length) {
 }
 
 void shell_execute_command(const char* command) {
+    PERF_FUNCTION();
     command = skip_whitespace(command);
     
     if (strlen(command) == 0) {
         return;
     }
     
-    if (strncmp(command, "help", 4) == 0) {
+    if (command_is(command, "help")) {
         cmd_help();
-    } else if (strncmp(command, "create", 6) == 0) {
+    } else if (command_is(command, "create")) {
         const char* filename = skip_whitespace(find_next_arg(command));
         if (strlen(filename) > 0) {
             cmd_create(filename);
         } else {
             vga_puts("Usage: create <filename>\n");
         }
-    } else if (strncmp(command, "list", 4) == 0 || strncmp(command, "ls", 2) == 0) {
-        cmd_list();
-    } else if (strncmp(command, "read", 4) == 0 || strncmp(command, "cat", 3) == 0) {
+    } else if (command_is(command, "list") || command_is(command, "ls")) {
+        cmd_list(skip_whitespace(find_next_arg(command)));
+    } else if (command_is(command, "read") || command_is(command, "cat")) {
         const char* filename = skip_whitespace(find_next_arg(command));
         if (strlen(filename) > 0) {
             cmd_read(filename);
         } else {
             vga_puts("Usage: read <filename>\n");
         }
-    } else if (strncmp(command, "write", 5) == 0 || strncmp(command, "edit", 4) == 0) {
+    } else if (command_is(command, "write") || command_is(command, "edit")) {
         const char* filename = skip_whitespace(find_next_arg(command));
         if (strlen(filename) > 0) {
             cmd_write(filename);
         } else {
             vga_puts("Usage: write <filename>\n");
         }
-    } else if (strncmp(command, "delete", 6) == 0 || strncmp(command, "rm", 2) == 0) {
+    } else if (command_is(command, "append")) {
+        const char* args = skip_whitespace(find_next_arg(command));
+        if (strlen(args) > 0) {
+            cmd_append(args);
+        } else {
+            vga_puts("Usage: append <filename> <text>\n");
+        }
+    } else if (command_is(command, "delete") || command_is(command, "rm")) {
         const char* filename = skip_whitespace(find_next_arg(command));
         if (strlen(filename) > 0) {
             cmd_delete(filename);
         } else {
             vga_puts("Usage: delete <filename>\n");
         }
-    } else if (strncmp(command, "clear", 5) == 0) {
+    } else if (command_is(command, "clear")) {
         cmd_clear();
-    } else if (strncmp(command, "info", 4) == 0) {
+    } else if (command_is(command, "info")) {
         cmd_info();
-    } else if (strncmp(command, "mkdir", 5) == 0) {
+    } else if (command_is(command, "check")) {
+        cmd_check();
+    } else if (command_is(command, "mkdir")) {
         const char* dirname = skip_whitespace(find_next_arg(command));
         if (strlen(dirname) > 0) {
             cmd_mkdir(dirname);
         } else {
             vga_puts("Usage: mkdir <dirname>\n");
         }
-    } else if (strncmp(command, "rmdir", 5) == 0) {
+    } else if (command_is(command, "rmdir")) {
         const char* dirname = skip_whitespace(find_next_arg(command));
         if (strlen(dirname) > 0) {
             cmd_rmdir(dirname);
         } else {
             vga_puts("Usage: rmdir <dirname>\n");
         }
-    } else if (strncmp(command, "cd", 2) == 0) {
+    } else if (command_is(command, "cd")) {
         const char* path = skip_whitespace(find_next_arg(command));
         if (strlen(path) > 0) {
             cmd_cd(path);
@@ -161,8 +197,51 @@ void shell_execute_command(const char* command) {
             // cd with no arguments goes to root
             cmd_cd("/");
         }
-    } else if (strncmp(command, "pwd", 3) == 0) {
+    } else if (command_is(command, "pwd")) {
         cmd_pwd();
+    } else if (command_is(command, "time")) {
+        const char* timed = skip_whitespace(find_next_arg(command));
+        if (strlen(timed) > 0) {
+            cmd_time(timed);
+        } else {
+            vga_puts("Usage: time <command>\n");
+        }
+    } else if (command_is(command, "uptime")) {
+        cmd_uptime();
+    } else if (command_is(command, "sleep")) {
+        const char* ms = skip_whitespace(find_next_arg(command));
+        if (strlen(ms) > 0) {
+            cmd_sleep(ms);
+        } else {
+            vga_puts("Usage: sleep <milliseconds>\n");
+        }
+    } else if (command_is(command, "mem")) {
+        cmd_mem();
+    } else if (command_is(command, "map")) {
+        const char* filename = skip_whitespace(find_next_arg(command));
+        if (strlen(filename) > 0) {
+            cmd_map(filename);
+        } else {
+            vga_puts("Usage: map <filename>\n");
+        }
+    } else if (command_is(command, "heap")) {
+        cmd_heap();
+    } else if (command_is(command, "sync")) {
+        cmd_sync();
+    } else if (command_is(command, "disk")) {
+        cmd_disk();
+    } else if (command_is(command, "cache")) {
+        cmd_cache();
+    } else if (command_is(command, "journal")) {
+        cmd_journal();
+    } else if (command_is(command, "prof")) {
+        cmd_prof(skip_whitespace(find_next_arg(command)));
+    } else if (command_is(command, "perf")) {
+        cmd_perf(skip_whitespace(find_next_arg(command)));
+    } else if (command_is(command, "smp")) {
+        cmd_smp(skip_whitespace(find_next_arg(command)));
+    } else if (command_is(command, "serial")) {
+        cmd_serial(skip_whitespace(find_next_arg(command)));
     } else {
         vga_printf("Unknown command: %s\n", command);
         vga_puts("Type 'help' for available commands.\n");
@@ -170,6 +249,7 @@ void shell_execute_command(const char* command) {
 }
 
 void cmd_help(void) {
+    vga_batch_begin();
     vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
     vga_puts("Available commands:\n");
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
@@ -179,25 +259,42 @@ void cmd_help(void) {
     vga_puts("  cat <file>        - Alias for read\n");
     vga_puts("  write <file>      - Write text to file\n");
     vga_puts("  edit <file>       - Alias for write\n");
+    vga_puts("  append <file> <text> - Append a line to a file\n");
+    vga_puts("  map <file>        - Display a file through a demand-paged mapping\n");
     vga_puts("  delete <file>     - Delete a file\n");
     vga_puts("  rm <file>         - Alias for delete\n");
     vga_puts("\nDirectory Operations:\n");
     vga_puts("  mkdir <dir>       - Create a new directory\n");
     vga_puts("  rmdir <dir>       - Remove an empty directory\n");
-    vga_puts("  cd <path>         - Change to directory (/, .., dir)\n");
+    vga_puts("  cd <path>         - Change directory (e.g. /a/b, ../c)\n");
     vga_puts("  pwd               - Show current directory\n");
-    vga_puts("  list, ls          - List directory contents\n");
+    vga_puts("  list, ls [path]   - List directory contents\n");
     vga_puts("\nSystem Operations:\n");
     vga_puts("  clear             - Clear screen\n");
     vga_puts("  info              - Show file system info\n");
+    vga_puts("  check             - Verify file system structure\n");
+    vga_puts("  time <command>    - Run a command and report its cost\n");
+    vga_puts("  uptime            - Show time since boot and idle ratio\n");
+    vga_puts("  sleep <ms>        - Sleep for a number of milliseconds\n");
+    vga_puts("  serial [on|off]   - Show serial stats or toggle mirroring\n");
+    vga_puts("  mem               - Show physical memory usage\n");
+    vga_puts("  heap              - Show kernel heap statistics\n");
+    vga_puts("  sync              - Write file system changes to disk\n");
+    vga_puts("  disk              - Show disk model and transfer statistics\n");
+    vga_puts("  cache             - Show buffer cache hit rate and read-ahead\n");
+    vga_puts("  journal           - Show journal commits, batch sizes and latency\n");
+    vga_puts("  perf [reset]      - Show or clear per-function cycle histograms\n");
+    vga_puts("  prof [n|reset|on|off] - Show the n most sampled functions\n");
+    vga_puts("  smp [reset]       - Show or clear per-CPU scheduler counters\n");
     vga_puts("  help              - Show this help message\n");
+    vga_batch_end();
 }
 
 void cmd_create(const char* filename) {
     // Extract just the filename (stop at first space)
-    char clean_filename[MAX_FILENAME_LENGTH];
+    char clean_filename[MAX_PATH_LENGTH];
     int i = 0;
-    while (filename[i] && filename[i] != ' ' && filename[i] != '\t' && i < MAX_FILENAME_LENGTH - 1) {
+    while (filename[i] && filename[i] != ' ' && filename[i] != '\t' && i < MAX_PATH_LENGTH - 1) {
         clean_filename[i] = filename[i];
         i++;
     }
@@ -206,38 +303,60 @@ void cmd_create(const char* filename) {
     fs_create_file(clean_filename);
 }
 
-void cmd_list(void) {
-    fs_list_files();
+void cmd_list(const char* path) {
+    // Extract just the path; none lists the current directory
+    char clean_path[MAX_PATH_LENGTH];
+    int i = 0;
+    while (path[i] && path[i] != ' ' && path[i] != '\t' && i < MAX_PATH_LENGTH - 1) {
+        clean_path[i] = path[i];
+        i++;
+    }
+    clean_path[i] = '\0';
+    
+    fs_list_directory(clean_path);
 }
 
 void cmd_read(const char* filename) {
     // Extract just the filename
-    char clean_filename[MAX_FILENAME_LENGTH];
+    char clean_filename[MAX_PATH_LENGTH];
     int i = 0;
-    while (filename[i] && filename[i] != ' ' && filename[i] != '\t' && i < MAX_FILENAME_LENGTH - 1) {
+    while (filename[i] && filename[i] != ' ' && filename[i] != '\t' && i < MAX_PATH_LENGTH - 1) {
         clean_filename[i] = filename[i];
         i++;
     }
     clean_filename[i] = '\0';
     
-    int size = fs_read_file(clean_filename, file_buffer, MAX_FILE_SIZE);
-    if (size > 0) {
-        vga_printf("Contents of '%s':\n", clean_filename);
-        vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
-        vga_puts("--- BEGIN FILE ---\n");
-        vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
-        vga_puts(file_buffer);
-        vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
-        vga_puts("\n--- END FILE ---\n");
-        vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    struct fs_view view;
+    int size = fs_view_open(clean_filename, &view);
+    if (size == 0) {
+        vga_printf("File '%s' is empty.\n", clean_filename);
+    }
+    if (size <= 0) {
+        return;
     }
+    
+    // Stream straight from the buffer cache to the console
+    vga_batch_begin();
+    vga_printf("Contents of '%s':\n", clean_filename);
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_puts("--- BEGIN FILE ---\n");
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    const char* data;
+    uint32_t length;
+    while (fs_view_next(&view, &data, &length) > 0) {
+        vga_write(data, length);
+    }
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_puts("\n--- END FILE ---\n");
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    vga_batch_end();
 }
 
 void cmd_write(const char* filename) {
     // Extract just the filename
-    char clean_filename[MAX_FILENAME_LENGTH];
+    char clean_filename[MAX_PATH_LENGTH];
     int i = 0;
-    while (filename[i] && filename[i] != ' ' && filename[i] != '\t' && i < MAX_FILENAME_LENGTH - 1) {
+    while (filename[i] && filename[i] != ' ' && filename[i] != '\t' && i < MAX_PATH_LENGTH - 1) {
         clean_filename[i] = filename[i];
         i++;
     }
@@ -251,13 +370,19 @@ void cmd_write(const char* filename) {
         }
     }
     
+    char* file_buffer = kmalloc(SHELL_EDIT_BUFFER_SIZE);
+    if (!file_buffer) {
+        vga_puts("Error: Out of memory.\n");
+        return;
+    }
+    
     vga_printf("Enter text for file '%s' (press Ctrl+D or empty line to finish):\n", clean_filename);
     vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
     
     int pos = 0;
     char c;
     
-    while (pos < MAX_FILE_SIZE - 1) {
+    while (pos < SHELL_EDIT_BUFFER_SIZE - 1) {
         c = keyboard_getchar();
         
         if (c == 0) {
@@ -296,13 +421,77 @@ void cmd_write(const char* filename) {
     } else {
         vga_puts("No text entered.\n");
     }
+    kfree(file_buffer);
+}
+
+void cmd_append(const char* args) {
+    // Extract the filename; the rest of the line is the text
+    char clean_filename[MAX_PATH_LENGTH];
+    int i = 0;
+    while (args[i] && args[i] != ' ' && args[i] != '\t' && i < MAX_PATH_LENGTH - 1) {
+        clean_filename[i] = args[i];
+        i++;
+    }
+    clean_filename[i] = '\0';
+    const char* text = skip_whitespace(args + i);
+    
+    int fd = fs_open(clean_filename, FS_O_WRONLY | FS_O_CREAT | FS_O_APPEND);
+    if (fd < 0) {
+        return;
+    }
+    
+    // Only the appended bytes are written; the rest of the file is untouched
+    uint32_t length = strlen(text);
+    int written = fs_write(fd, text, length);
+    if (written == (int)length && fs_write(fd, "\n", 1) == 1) {
+        written++;
+    }
+    fs_close(fd);
+    
+    if (written > 0) {
+        vga_printf("Appended %d bytes to '%s'.\n", written, clean_filename);
+    }
+}
+
+void cmd_map(const char* filename) {
+    // Extract just the filename
+    char clean_filename[MAX_PATH_LENGTH];
+    int i = 0;
+    while (filename[i] && filename[i] != ' ' && filename[i] != '\t' && i < MAX_PATH_LENGTH - 1) {
+        clean_filename[i] = filename[i];
+        i++;
+    }
+    clean_filename[i] = '\0';
+    
+    if (!paging_enabled()) {
+        vga_puts("Error: Paging is not enabled.\n");
+        return;
+    }
+    
+    uint32_t size;
+    const char* data = fs_map_file(clean_filename, &size);
+    if (!data) {
+        return;
+    }
+    
+    struct paging_stats before;
+    paging_get_stats(&before);
+    
+    vga_printf("Mapped '%s' at %p (%u bytes):\n", clean_filename, data, size);
+    vga_write(data, size);
+    
+    struct paging_stats after;
+    paging_get_stats(&after);
+    vga_printf("\n%u page faults to read %u bytes.\n", after.lazy_faults - before.lazy_faults, size);
+    
+    fs_unmap_file(data);
 }
 
 void cmd_delete(const char* filename) {
     // Extract just the filename
-    char clean_filename[MAX_FILENAME_LENGTH];
+    char clean_filename[MAX_PATH_LENGTH];
     int i = 0;
-    while (filename[i] && filename[i] != ' ' && filename[i] != '\t' && i < MAX_FILENAME_LENGTH - 1) {
+    while (filename[i] && filename[i] != ' ' && filename[i] != '\t' && i < MAX_PATH_LENGTH - 1) {
         clean_filename[i] = filename[i];
         i++;
     }
@@ -319,11 +508,18 @@ void cmd_info(void) {
     fs_print_info();
 }
 
+void cmd_check(void) {
+    int entries = fs_check();
+    if (entries >= 0) {
+        vga_printf("File system is consistent (%d entries).\n", entries);
+    }
+}
+
 void cmd_mkdir(const char* dirname) {
     // Extract just the directory name
-    char clean_dirname[MAX_FILENAME_LENGTH];
+    char clean_dirname[MAX_PATH_LENGTH];
     int i = 0;
-    while (dirname[i] && dirname[i] != ' ' && dirname[i] != '\t' && i < MAX_FILENAME_LENGTH - 1) {
+    while (dirname[i] && dirname[i] != ' ' && dirname[i] != '\t' && i < MAX_PATH_LENGTH - 1) {
         clean_dirname[i] = dirname[i];
         i++;
     }
@@ -334,9 +530,9 @@ void cmd_mkdir(const char* dirname) {
 
 void cmd_rmdir(const char* dirname) {
     // Extract just the directory name
-    char clean_dirname[MAX_FILENAME_LENGTH];
+    char clean_dirname[MAX_PATH_LENGTH];
     int i = 0;
-    while (dirname[i] && dirname[i] != ' ' && dirname[i] != '\t' && i < MAX_FILENAME_LENGTH - 1) {
+    while (dirname[i] && dirname[i] != ' ' && dirname[i] != '\t' && i < MAX_PATH_LENGTH - 1) {
         clean_dirname[i] = dirname[i];
         i++;
     }
@@ -368,8 +564,313 @@ void cmd_pwd(void) {
     vga_printf("%s\n", current_path);
 }
 
+void cmd_time(const char* command) {
+    uint64_t start_ns = timer_now_ns();
+    uint64_t start_cycles = rdtsc();
+    
+    shell_execute_command(command);
+    
+    uint64_t cycles = rdtsc() - start_cycles;
+    uint64_t elapsed_ns = timer_now_ns() - start_ns;
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_puts("\nreal: ");
+    print_ms(elapsed_ns);
+    vga_printf(" (%llu cycles)\n", cycles);
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+}
+
+void cmd_uptime(void) {
+    uint64_t uptime_ms = timer_uptime_ms();
+    uint32_t ms, secs, mins;
+    uint64_t seconds = div_u64_rem(uptime_ms, 1000, &ms);
+    uint64_t minutes = div_u64_rem(seconds, 60, &secs);
+    uint64_t hours = div_u64_rem(minutes, 60, &mins);
+    
+    // Share of time spent halted in cpu_idle(), in tenths of a percent
+    uint64_t idle_ms = div_u64_rem(timer_cycles_to_ns(timer_idle_cycles()), 1000000, 0);
+    uint32_t idle_permille = 0;
+    if (uptime_ms > 0 && uptime_ms <= 0xFFFFFFFFu) {
+        idle_permille = (uint32_t)div_u64_rem(idle_ms * 1000, (uint32_t)uptime_ms, 0);
+    }
+    
+    vga_printf("Up %lluh %02um %02u.%03us, idle %u.%u%%\n",
+               hours, mins, secs, ms, idle_permille / 10, idle_permille % 10);
+    vga_printf("Timer ticks: %llu at %d Hz, TSC %u kHz\n", timer_ticks(), TIMER_HZ, timer_tsc_khz());
+}
+
+void cmd_sleep(const char* ms) {
+    int value = parse_uint(ms);
+    if (value < 0) {
+        vga_puts("Usage: sleep <milliseconds>\n");
+        return;
+    }
+    timer_sleep_ms(value);
+}
+
+void cmd_serial(const char* arg) {
+    if (!serial_present()) {
+        vga_puts("No serial port detected.\n");
+        return;
+    }
+    
+    if (command_is(arg, "on")) {
+        vga_set_mirror(serial_write);
+        vga_puts("Console mirroring to COM1 enabled.\n");
+    } else if (command_is(arg, "off")) {
+        vga_set_mirror(0);
+        vga_puts("Console mirroring to COM1 disabled.\n");
+    } else {
+        struct serial_stats stats;
+        serial_get_stats(&stats);
+        vga_printf("COM1 at %d baud\n", SERIAL_BAUD);
+        vga_printf("TX: %u bytes, %u interrupts, %u stalls\n",
+                   stats.tx_bytes, stats.tx_interrupts, stats.tx_stalls);
+        vga_printf("RX: %u bytes\n", stats.rx_bytes);
+    }
+}
+
+void cmd_mem(void) {
+    struct pmm_stats stats;
+    pmm_get_stats(&stats);
+    
+    uint32_t used = stats.total_frames - stats.free_frames;
+    vga_printf("Memory reported by bootloader: %llu KiB\n", stats.total_memory >> 10);
+    vga_printf("Managed frames: %u (%u KiB)\n", stats.total_frames, stats.total_frames * (PAGE_SIZE / 1024));
+    vga_printf("Free frames:    %u (%u KiB)\n", stats.free_frames, stats.free_frames * (PAGE_SIZE / 1024));
+    vga_printf("Used frames:    %u (%u KiB)\n", used, used * (PAGE_SIZE / 1024));
+    vga_puts("Free blocks by order:");
+    for (int order = 0; order <= PMM_MAX_ORDER; order++) {
+        vga_printf(" %d:%u", order, stats.free_blocks[order]);
+    }
+    vga_putchar('\n');
+}
+
+void cmd_heap(void) {
+    struct kheap_stats stats;
+    kheap_get_stats(&stats);
+    
+    // Fragmentation: share of heap-owned memory not backing a live allocation
+    uint32_t frag_permille = 0;
+    if (stats.footprint_bytes > 0) {
+        frag_permille = (uint32_t)div_u64_rem((uint64_t)(stats.footprint_bytes - stats.live_bytes) * 1000,
+                                              stats.footprint_bytes, 0);
+    }
+    
+    vga_batch_begin();
+    vga_printf("Live: %u bytes, footprint: %u bytes, fragmentation: %u.%u%%\n",
+               stats.live_bytes, stats.footprint_bytes, frag_permille / 10, frag_permille % 10);
+    vga_printf("Large blocks: %u live, %u total; failed allocations: %u\n",
+               stats.large_live, stats.large_allocs, stats.failed_allocs);
+    vga_puts("Class   Allocs    Frees     Live  Slabs  Hit rate\n");
+    for (int i = 0; i < KHEAP_CLASS_COUNT; i++) {
+        struct kheap_class_stats* cls = &stats.classes[i];
+        uint32_t lookups = cls->slab_hits + cls->slab_misses;
+        uint32_t hit_permille = lookups ? (uint32_t)div_u64_rem((uint64_t)cls->slab_hits * 1000, lookups, 0) : 0;
+        vga_printf("%5u %8u %8u %8u %6u  %3u.%u%%\n", cls->object_size, cls->allocs, cls->frees,
+                   cls->live_objects, cls->slabs, hit_permille / 10, hit_permille % 10);
+    }
+    vga_batch_end();
+}
+
+void cmd_sync(void) {
+    if (!ata_present()) {
+        vga_puts("No disk attached; files live in memory only.\n");
+        return;
+    }
+    int blocks = fs_sync();
+    if (blocks >= 0) {
+        vga_printf("Synced %d blocks to disk.\n", blocks);
+    }
+}
+
+void cmd_disk(void) {
+    if (!ata_present()) {
+        vga_puts("No disk attached.\n");
+        return;
+    }
+    struct ata_stats stats;
+    ata_get_stats(&stats);
+    
+    vga_batch_begin();
+    vga_printf("Model: %s\n", ata_model());
+    vga_printf("Size: %u sectors (%u MiB), transfers: %s\n", ata_sector_count(),
+               ata_sector_count() / 2048, ata_dma_enabled() ? "bus-master DMA" : "PIO");
+    vga_printf("Commands: %u reads, %u writes (%u DMA, %u PIO), %u flushes, %u errors\n",
+               stats.read_commands, stats.write_commands, stats.dma_commands, stats.pio_commands,
+               stats.flushes, stats.errors);
+    vga_printf("Sectors: %llu read, %llu written\n", stats.sectors_read, stats.sectors_written);
+    vga_batch_end();
+}
+
+void cmd_cache(void) {
+    struct bcache_stats stats;
+    bcache_get_stats(&stats);
+    
+    uint32_t lookups = stats.hits + stats.misses;
+    uint32_t hit_permille = lookups ? (uint32_t)div_u64_rem((uint64_t)stats.hits * 1000, lookups, 0) : 0;
+    vga_batch_begin();
+    vga_printf("Buffers: %u of %u in use, %u dirty, %u held for the journal\n",
+               stats.cached, stats.buffers, stats.dirty, stats.held);
+    vga_printf("Lookups: %u hits, %u misses (%u.%u%% hit rate)\n",
+               stats.hits, stats.misses, hit_permille / 10, hit_permille % 10);
+    vga_printf("Read-ahead: %u blocks prefetched, %u used\n", stats.readahead_blocks, stats.readahead_hits);
+    vga_printf("Write-back: %u blocks written, %u evictions\n", stats.writebacks, stats.evictions);
+    vga_batch_end();
+}
+
+void cmd_journal(void) {
+    struct journal_stats stats;
+    if (fs_get_journal_stats(&stats) != 0) {
+        vga_puts("The file system has no journal.\n");
+        return;
+    }
+    
+    vga_batch_begin();
+    vga_printf("Log: %u of %u blocks in use, %u checkpoints, %u transactions replayed at mount\n",
+               stats.log_used, stats.log_blocks, stats.checkpoints, stats.replayed);
+    vga_printf("Commits: %u, covering %u operations and %u blocks\n",
+               stats.commits, stats.operations, stats.blocks);
+    if (stats.commits) {
+        uint32_t ops_tenths = (uint32_t)div_u64_rem((uint64_t)stats.operations * 10, stats.commits, 0);
+        uint32_t blocks_tenths = (uint32_t)div_u64_rem((uint64_t)stats.blocks * 10, stats.commits, 0);
+        uint64_t average_us = div_u64_rem(div_u64_rem(stats.commit_ns, stats.commits, 0), 1000, 0);
+        vga_printf("Batch size: %u.%u operations, %u.%u blocks on average (largest %u, %u)\n",
+                   ops_tenths / 10, ops_tenths % 10, blocks_tenths / 10, blocks_tenths % 10,
+                   stats.largest_batch, stats.largest_commit);
+        vga_printf("Commit latency: %llu us on average, %llu us worst\n",
+                   average_us, div_u64_rem(stats.slowest_commit_ns, 1000, 0));
+    }
+    vga_batch_end();
+}
+
+void cmd_perf(const char* arg) {
+    if (!PERF_ENABLED) {
+        vga_puts("Probes are compiled out of this build (RELEASE=1).\n");
+        return;
+    }
+    if (command_is(arg, "reset")) {
+        perf_reset();
+        vga_puts("Probe statistics cleared.\n");
+        return;
+    }
+    
+    // Copy the probes so the table is not disturbed by its own printing
+    uint32_t count = 0;
+    for (struct perf_probe* probe = perf_probes(); probe; probe = probe->next) {
+        count++;
+    }
+    struct perf_probe* snapshot = kmalloc(count * sizeof(struct perf_probe));
+    if (!snapshot) {
+        vga_puts("Error: Not enough memory for the probe table.\n");
+        return;
+    }
+    uint32_t used = 0;
+    for (struct perf_probe* probe = perf_probes(); probe && used < count; probe = probe->next) {
+        if (probe->count) {
+            snapshot[used++] = *probe;
+        }
+    }
+    
+    // Busiest first, by total cycles
+    for (uint32_t i = 1; i < used; i++) {
+        struct perf_probe probe = snapshot[i];
+        uint32_t j = i;
+        while (j > 0 && snapshot[j - 1].total < probe.total) {
+            snapshot[j] = snapshot[j - 1];
+            j--;
+        }
+        snapshot[j] = probe;
+    }
+    
+    vga_batch_begin();
+    vga_printf("Cycles per call at %u MHz, callees included\n", timer_tsc_khz() / 1000);
+    vga_printf("%-21s %7s %8s %8s %8s %8s %10s\n", "Probe", "Calls", "Mean", "p50", "p99", "Min", "Max");
+    for (uint32_t i = 0; i < used; i++) {
+        struct perf_probe* probe = &snapshot[i];
+        vga_printf("%-21s %7u %8llu %8llu %8llu %8llu %10llu\n", probe->name, probe->count,
+                   div_u64_rem(probe->total, probe->count, 0), perf_percentile(probe, 50),
+                   perf_percentile(probe, 99), probe->min, probe->max);
+    }
+    if (used == 0) {
+        vga_puts("No probe has fired since the last reset.\n");
+    }
+    vga_batch_end();
+    kfree(snapshot);
+}
+
+void cmd_prof(const char* arg) {
+    if (command_is(arg, "reset")) {
+        prof_reset();
+        vga_puts("Profile samples cleared.\n");
+        return;
+    }
+    if (command_is(arg, "on") || command_is(arg, "off")) {
+        prof_set_enabled(command_is(arg, "on"));
+        vga_printf("Profiler %s.\n", prof_enabled() ? "sampling" : "stopped");
+        return;
+    }
+    int count = *arg ? parse_uint(arg) : PROF_DEFAULT_TOP;
+    if (count <= 0) {
+        vga_puts("Usage: prof [count|reset|on|off]\n");
+        return;
+    }
+    // No more rows than functions, plus one for samples outside them
+    if ((uint32_t)count > ksym_count + 1) {
+        count = ksym_count + 1;
+    }
+    
+    struct prof_entry* top = kmalloc(count * sizeof(struct prof_entry));
+    uint32_t total = 0;
+    int filled = top ? prof_top(top, count, &total) : -1;
+    if (filled < 0) {
+        vga_puts("Error: Not enough memory for the profile.\n");
+        kfree(top);
+        return;
+    }
+    
+    vga_batch_begin();
+    vga_printf("%u samples at %d Hz%s\n", total, TIMER_HZ, prof_enabled() ? "" : " (stopped)");
+    for (int i = 0; i < filled; i++) {
+        uint32_t permille = (uint32_t)div_u64_rem((uint64_t)top[i].samples * 1000, total, 0);
+        vga_printf("%3u.%u%% %7u  %s\n", permille / 10, permille % 10, top[i].samples,
+                   top[i].name ? top[i].name : "[outside kernel text]");
+    }
+    vga_batch_end();
+    kfree(top);
+}
+
+void cmd_smp(const char* arg) {
+    if (command_is(arg, "reset")) {
+        sched_reset_stats();
+        vga_puts("Scheduler counters cleared.\n");
+        return;
+    }
+    
+    vga_batch_begin();
+    vga_printf("%u CPUs online, IRQs through the %s\n", smp_cpu_count(),
+               ioapic_enabled() ? "IO APIC" : "PIC");
+    vga_printf("%3s %4s %9s %9s %9s %9s %9s\n", "CPU", "APIC", "Spawned", "Executed", "Stolen",
+               "Overflow", "Sleeps");
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        struct sched_stats stats;
+        sched_get_stats(i, &stats);
+        vga_printf("%3u %4u %9u %9u %9u %9u %9u\n", i, cpus[i].apic_id, stats.spawned,
+                   stats.executed, stats.stolen, stats.overflowed, stats.sleeps);
+    }
+    vga_batch_end();
+}
+
 void shell_run(void) {
+    char* shell_buffer = kmalloc(SHELL_BUFFER_SIZE);
+    if (!shell_buffer) {
+        vga_puts("Error: Out of memory for the shell line buffer.\n");
+        return;
+    }
+    
     while (1) {
+        // Whatever the last command changed is committed as one batch
+        fs_commit();
         shell_prompt();
         shell_read_line(shell_buffer, SHELL_BUFFER_SIZE);
         shell_execute_command(shell_buffer);
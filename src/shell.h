@@ -3,6 +3,7 @@
 #define SHELL_H
 
 #define SHELL_BUFFER_SIZE 256
+#define SHELL_EDIT_BUFFER_SIZE 4096   // Text typed into a file with 'write'
 #define MAX_ARGS 16
 
 // Shell functions
@@ -15,15 +16,31 @@ void shell_execute_command(const char* command);
 // Command handlers
 void cmd_help(void);
 void cmd_create(const char* filename);
-void cmd_list(void);
+void cmd_list(const char* path);
 void cmd_read(const char* filename);
 void cmd_write(const char* filename);
+void cmd_append(const char* args);
+void cmd_map(const char* filename);
 void cmd_delete(const char* filename);
 void cmd_clear(void);
 void cmd_info(void);
+void cmd_check(void);
 void cmd_mkdir(const char* dirname);
 void cmd_rmdir(const char* dirname);
 void cmd_cd(const char* path);
 void cmd_pwd(void);
+void cmd_time(const char* command);
+void cmd_uptime(void);
+void cmd_sleep(const char* ms);
+void cmd_serial(const char* arg);
+void cmd_mem(void);
+void cmd_heap(void);
+void cmd_sync(void);
+void cmd_disk(void);
+void cmd_cache(void);
+void cmd_journal(void);
+void cmd_perf(const char* arg);
+void cmd_prof(const char* arg);
+void cmd_smp(const char* arg);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,160 @@
+// smp.c - Application processor startup and per-CPU data
+//
+// Every enabled processor in the MADT other than the bootstrap processor is
+// started in turn with INIT and startup IPIs (the sequence from the Intel
+// MultiProcessor Specification). The AP comes up in trampoline.S, which
+// hands it a stack from the kernel heap and the BSP's paging, and then runs
+// ap_main(): its own %gs, the shared IDT, its local APIC, and from then on
+// the scheduler's idle loop. CPU indices are dense: cpus[0] is the BSP and
+// APs that fail to start do not use one up. An AP claims its index on entry;
+// one that has not by the timeout is abandoned and parked with INIT, so a
+// late one cannot pick up the parameters or index meant for the next.
+#include "smp.h"
+#include "acpi.h"
+#include "apic.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "idt.h"
+#include "kheap.h"
+#include "sched.h"
+#include "timer.h"
+#include "vga.h"
+#include "klib.h"
+
+#define INIT_DELAY_US 10000
+#define STARTUP_DELAY_US 200
+#define ONLINE_TIMEOUT_US 100000
+#define NO_CPU SMP_MAX_CPUS             // starting_cpu once claimed or abandoned
+
+// Filled in before each AP start; laid out like the end of trampoline.S
+struct trampoline_params {
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t stack;
+    uint32_t entry;
+};
+
+extern uint8_t trampoline_start[];
+extern uint8_t trampoline_params[];
+extern uint8_t trampoline_end[];
+
+struct cpu cpus[SMP_MAX_CPUS];
+static volatile uint32_t cpu_count = 1;
+static volatile uint32_t starting_cpu = NO_CPU;    // Index the AP in the trampoline will take
+
+static void delay_us(uint32_t us) {
+    uint64_t end = timer_now_ns() + (uint64_t)us * 1000;
+    while (timer_now_ns() < end) {
+        cpu_relax();
+    }
+}
+
+// Wait up to us microseconds for a starting AP to check in
+static int wait_online(struct cpu* cpu, uint32_t us) {
+    uint64_t end = timer_now_ns() + (uint64_t)us * 1000;
+    while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+        if (timer_now_ns() >= end) {
+            return 0;
+        }
+        cpu_relax();
+    }
+    return 1;
+}
+
+// Wake-up IPIs only need to end a hlt
+static void wake_handler(struct interrupt_frame* frame) {
+    (void)frame;
+}
+
+static void ap_main(void) {
+    uint32_t index = __atomic_exchange_n(&starting_cpu, NO_CPU, __ATOMIC_ACQ_REL);
+    if (index == NO_CPU) {
+        for (;;) {
+            __asm__ volatile("cli; hlt");   // Too late: the BSP gave up on us
+        }
+    }
+    struct cpu* cpu = &cpus[index];
+    gdt_load(cpu->index);
+    idt_load();
+    lapic_init();
+    __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+    sched_idle();
+}
+
+// The parameters in the copy of the trampoline the APs run
+static struct trampoline_params* params(void) {
+    return (struct trampoline_params*)(SMP_TRAMPOLINE_BASE + (trampoline_params - trampoline_start));
+}
+
+// A CPU that has not claimed its index by the timeout is abandoned and sent
+// INIT, which holds it waiting for a startup IPI that never comes. Its stack
+// is kept in case it was already running on it.
+static int start_cpu(struct cpu* cpu) {
+    cpu->stack = kmalloc(SMP_STACK_SIZE);
+    if (!cpu->stack) {
+        return -1;
+    }
+    params()->stack = (uint32_t)cpu->stack + SMP_STACK_SIZE;
+    starting_cpu = cpu->index;
+
+    lapic_send_init(cpu->apic_id);
+    delay_us(INIT_DELAY_US);
+    lapic_send_startup(cpu->apic_id, SMP_TRAMPOLINE_BASE);
+    if (wait_online(cpu, STARTUP_DELAY_US)) {
+        return 0;
+    }
+    // The second startup IPI is ignored by a CPU that took the first
+    lapic_send_startup(cpu->apic_id, SMP_TRAMPOLINE_BASE);
+    if (wait_online(cpu, ONLINE_TIMEOUT_US)) {
+        return 0;
+    }
+
+    // Once claimed the AP is in kernel code and only moments from online
+    if (__atomic_exchange_n(&starting_cpu, NO_CPU, __ATOMIC_ACQ_REL) == NO_CPU) {
+        while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+        return 0;
+    }
+    lapic_send_init(cpu->apic_id);
+    return -1;
+}
+
+// Start every other processor the MADT lists. Needs apic_init(), paging and
+// the heap. Returns the number of CPUs online.
+int smp_init(void) {
+    const struct acpi_madt* madt = acpi_get_madt();
+    cpus[0].online = 1;
+    if (!apic_enabled() || !madt) {
+        return 1;
+    }
+    cpus[0].apic_id = lapic_id();
+    idt_set_handler(APIC_IPI_VECTOR, wake_handler);
+
+    memcpy((void*)SMP_TRAMPOLINE_BASE, trampoline_start, trampoline_end - trampoline_start);
+    params()->cr0 = read_cr0();
+    params()->cr3 = read_cr3();
+    params()->cr4 = read_cr4();
+    params()->entry = (uint32_t)ap_main;
+
+    for (uint32_t i = 0; i < madt->cpu_count && cpu_count < SMP_MAX_CPUS; i++) {
+        if (madt->apic_ids[i] == cpus[0].apic_id) {
+            continue;
+        }
+        struct cpu* cpu = &cpus[cpu_count];
+        cpu->apic_id = madt->apic_ids[i];
+        if (start_cpu(cpu) == 0) {
+            cpu_count++;
+        } else {
+            vga_printf("Error: CPU with APIC ID %u did not start.\n", cpu->apic_id);
+        }
+    }
+
+    vga_printf("SMP: %u of %u CPUs online.\n", cpu_count, madt->cpu_count);
+    return (int)cpu_count;
+}
+
+uint32_t smp_cpu_count(void) {
+    return cpu_count;
+}
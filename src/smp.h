@@ -0,0 +1,38 @@
+// smp.h - Application processor startup and per-CPU data
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+
+#define SMP_MAX_CPUS 16
+#define SMP_STACK_SIZE 16384
+
+// Physical page the AP trampoline is copied to: page-aligned below 1 MiB as
+// the startup IPI requires, where the pmm never hands out frames, and under
+// the 64 KiB mark GRUB keeps its multiboot data above
+#define SMP_TRAMPOLINE_BASE 0x8000
+
+// Per-CPU data. Each CPU's %gs selects a segment based at its own entry,
+// so this_cpu() is a single load.
+struct cpu {
+    struct cpu* self;                   // Must stay first
+    uint32_t index;                     // 0 is the bootstrap processor
+    uint32_t apic_id;
+    volatile uint32_t interrupt_depth;  // Handlers running, counting nested ones
+    volatile uint32_t online;
+    uint8_t* stack;                     // APs only; the BSP runs on boot.S's stack
+};
+
+extern struct cpu cpus[SMP_MAX_CPUS];
+
+static inline struct cpu* this_cpu(void) {
+    struct cpu* cpu;
+    __asm__ volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// Function prototypes
+int smp_init(void);
+uint32_t smp_cpu_count(void);
+
+#endif
@@ -0,0 +1,32 @@
+// spinlock.h - Test-and-test-and-set spinlocks for data shared between CPUs
+//
+// The interrupt flag is left alone, so a lock must never be taken by an
+// interrupt handler that could interrupt its holder on the same CPU.
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+struct spinlock {
+    volatile uint32_t locked;
+};
+
+static inline void spin_lock(struct spinlock* lock) {
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        // Wait with plain reads so the cache line is not bounced by xchg
+        while (lock->locked) {
+            cpu_relax();
+        }
+    }
+}
+
+static inline int spin_trylock(struct spinlock* lock) {
+    return !lock->locked && !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_unlock(struct spinlock* lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+#endif
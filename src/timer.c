@@ -0,0 +1,108 @@
+// timer.c - PIT and TSC timekeeping implementation
+#include "timer.h"
+#include "idt.h"
+#include "io.h"
+#include "math64.h"
+#include "prof.h"
+
+// Fixed-point scale for converting TSC cycles to nanoseconds
+#define NS_SHIFT 20
+
+static volatile uint64_t ticks = 0;
+static uint64_t boot_tsc = 0;
+static uint32_t tsc_khz = 0;
+static uint32_t ns_multiplier = 0;  // (10^6 << NS_SHIFT) / tsc_khz
+static uint64_t idle_cycles = 0;
+
+static void timer_irq_handler(struct interrupt_frame* frame) {
+    ticks++;
+    prof_sample(frame->eip);
+}
+
+// Count TSC cycles across a fixed PIT channel 2 one-shot. Channel 2 can be
+// polled through port 0x61, so this works before interrupts are enabled.
+static uint32_t calibrate_tsc_khz(void) {
+    uint32_t count = PIT_FREQUENCY / (1000 / TSC_CALIBRATION_MS);
+
+    // Enable the channel 2 gate with the speaker output off
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);
+
+    // Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, (count >> 8) & 0xFF);
+
+    // Retrigger the gate so counting starts now
+    uint8_t gate = inb(PIT_GATE_PORT) & ~0x01;
+    outb(PIT_GATE_PORT, gate);
+    outb(PIT_GATE_PORT, gate | 0x01);
+
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {
+        // Wait for OUT2 to go high at terminal count
+    }
+    uint64_t end = rdtsc();
+
+    return (uint32_t)div_u64_rem(end - start, TSC_CALIBRATION_MS, 0);
+}
+
+void timer_init(void) {
+    tsc_khz = calibrate_tsc_khz();
+    if (tsc_khz == 0) {
+        tsc_khz = 1;
+    }
+    ns_multiplier = (uint32_t)div_u64_rem((uint64_t)1000000 << NS_SHIFT, tsc_khz, 0);
+    boot_tsc = rdtsc();
+
+    // Channel 0, lobyte/hibyte, mode 2 (rate generator)
+    uint32_t divisor = PIT_FREQUENCY / TIMER_HZ;
+    outb(PIT_COMMAND, 0x34);
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+
+    irq_install_handler(IRQ_TIMER, timer_irq_handler);
+}
+
+uint64_t timer_ticks(void) {
+    // The 64-bit counter is updated from IRQ0, so read it with IRQs off
+    uint32_t flags = irq_save();
+    uint64_t value = ticks;
+    irq_restore(flags);
+    return value;
+}
+
+uint64_t timer_cycles_to_ns(uint64_t cycles) {
+    return mul_u64_u32_shr(cycles, ns_multiplier, NS_SHIFT);
+}
+
+// Monotonic nanoseconds since timer_init()
+uint64_t timer_now_ns(void) {
+    return timer_cycles_to_ns(rdtsc() - boot_tsc);
+}
+
+uint64_t timer_uptime_ms(void) {
+    return div_u64_rem(timer_now_ns(), 1000000, 0);
+}
+
+uint32_t timer_tsc_khz(void) {
+    return tsc_khz;
+}
+
+uint64_t timer_idle_cycles(void) {
+    return idle_cycles;
+}
+
+// Halt until the next interrupt. Callers that test a wakeup condition should
+// do so with interrupts disabled; the "sti; hlt" pair cannot lose a wakeup.
+void cpu_idle(void) {
+    uint64_t start = rdtsc();
+    __asm__ volatile("sti; hlt");
+    idle_cycles += rdtsc() - start;
+}
+
+void timer_sleep_ms(uint32_t ms) {
+    uint64_t deadline = timer_ticks() + div_u64_rem((uint64_t)ms * TIMER_HZ, 1000, 0);
+    while (timer_ticks() < deadline) {
+        cpu_idle();
+    }
+}
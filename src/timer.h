@@ -0,0 +1,36 @@
+// timer.h - PIT and TSC timekeeping
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND  0x43
+#define PIT_GATE_PORT 0x61
+
+// Rate of the periodic tick on IRQ0
+#define TIMER_HZ 1000
+
+// Length of the PIT-gated window used to calibrate the TSC
+#define TSC_CALIBRATION_MS 50
+
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+// Function prototypes
+void timer_init(void);
+uint64_t timer_ticks(void);
+uint64_t timer_now_ns(void);
+uint64_t timer_uptime_ms(void);
+uint64_t timer_cycles_to_ns(uint64_t cycles);
+uint32_t timer_tsc_khz(void);
+void timer_sleep_ms(uint32_t ms);
+uint64_t timer_idle_cycles(void);
+void cpu_idle(void);
+
+#endif
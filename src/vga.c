@@ -1,10 +1,28 @@
 // vga.c - Enhanced VGA text mode driver implementation
+//
+// All drawing goes to a RAM shadow of the screen. The shadow is a ring of
+// lines so scrolling only moves ring_head, and rows touched since the last
+// flush are tracked in a bitmask. vga_flush() copies just those rows to
+// video memory and moves the hardware cursor once.
 #include "vga.h"
+#include "io.h"
+#include "kprintf.h"
+#include "perf.h"
+
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA  0x3D5
+#define VGA_ALL_ROWS   ((1u << VGA_HEIGHT) - 1)
 
 static volatile uint16_t* vga_buffer = (uint16_t*)VGA_MEMORY;
+static uint16_t shadow[VGA_HEIGHT][VGA_WIDTH];
+static int ring_head = 0;           // Shadow line shown on screen row 0
+static uint32_t dirty_rows = 0;     // Bit n set = screen row n needs a copy
+static int batch_depth = 0;
 static int cursor_x = 0;
 static int cursor_y = 0;
+static int hw_cursor_pos = -1;      // Position last written to the CRTC
 static uint8_t current_color = 0x0F; // White on black
+static vga_mirror_t mirror = 0;     // Optional second sink for all output
 
 static uint8_t vga_entry_color(enum vga_color fg, enum vga_color bg) {
     return fg | bg << 4;
@@ -14,7 +32,84 @@ static uint16_t vga_entry(unsigned char uc, uint8_t color) {
     return (uint16_t) uc | (uint16_t) color << 8;
 }
 
+// Shadow line holding screen row y
+static uint16_t* vga_row(int y) {
+    int line = ring_head + y;
+    if (line >= VGA_HEIGHT) {
+        line -= VGA_HEIGHT;
+    }
+    return shadow[line];
+}
+
+static void vga_fill_row(uint16_t* row, uint16_t entry) {
+    uint32_t pair = (uint32_t)entry | ((uint32_t)entry << 16);
+    uint32_t* words = (uint32_t*)row;
+    for (int i = 0; i < VGA_WIDTH / 2; i++) {
+        words[i] = pair;
+    }
+}
+
+static void vga_update_hw_cursor(void) {
+    int pos = cursor_y * VGA_WIDTH + cursor_x;
+    if (pos == hw_cursor_pos) {
+        return;
+    }
+    outb(VGA_CRTC_INDEX, 0x0F);
+    outb(VGA_CRTC_DATA, (uint8_t)(pos & 0xFF));
+    outb(VGA_CRTC_INDEX, 0x0E);
+    outb(VGA_CRTC_DATA, (uint8_t)((pos >> 8) & 0xFF));
+    hw_cursor_pos = pos;
+}
+
+void vga_flush(void) {
+    PERF_FUNCTION();
+    uint32_t rows = dirty_rows;
+    dirty_rows = 0;
+
+    while (rows) {
+        int y = __builtin_ctz(rows);
+        rows &= rows - 1;
+
+        // One row is 160 bytes: copy it as 40 dword stores
+        const uint16_t* src = vga_row(y);
+        volatile uint16_t* dst = vga_buffer + y * VGA_WIDTH;
+        uint32_t count = VGA_WIDTH / 2;
+        __asm__ volatile("rep movsl"
+                         : "+S"(src), "+D"(dst), "+c"(count)
+                         :
+                         : "memory");
+    }
+
+    vga_update_hw_cursor();
+}
+
+// Flush unless a caller is batching several writes together
+static void vga_maybe_flush(void) {
+    if (batch_depth == 0) {
+        vga_flush();
+    }
+}
+
+void vga_set_mirror(vga_mirror_t sink) {
+    PERF_FUNCTION();
+    mirror = sink;
+}
+
+void vga_batch_begin(void) {
+    PERF_FUNCTION();
+    batch_depth++;
+}
+
+void vga_batch_end(void) {
+    PERF_FUNCTION();
+    if (batch_depth > 0) {
+        batch_depth--;
+    }
+    vga_maybe_flush();
+}
+
 void vga_init(void) {
+    PERF_FUNCTION();
     cursor_x = 0;
     cursor_y = 0;
     current_color = vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
@@ -22,47 +117,50 @@ void vga_init(void) {
 }
 
 void vga_clear(void) {
+    PERF_FUNCTION();
     for (int y = 0; y < VGA_HEIGHT; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            const int index = y * VGA_WIDTH + x;
-            vga_buffer[index] = vga_entry(' ', current_color);
-        }
+        vga_fill_row(shadow[y], vga_entry(' ', current_color));
     }
+    ring_head = 0;
+    dirty_rows = VGA_ALL_ROWS;
     cursor_x = 0;
     cursor_y = 0;
+    vga_maybe_flush();
+    
+    if (mirror) {
+        mirror("\033[2J\033[H", 7); // ANSI clear screen and home cursor
+    }
 }
 
 void vga_set_color(enum vga_color fg, enum vga_color bg) {
+    PERF_FUNCTION();
     current_color = vga_entry_color(fg, bg);
 }
 
 void vga_set_cursor(int x, int y) {
+    PERF_FUNCTION();
     cursor_x = x;
     cursor_y = y;
+    vga_maybe_flush();
 }
 
 void vga_get_cursor(int* x, int* y) {
+    PERF_FUNCTION();
     *x = cursor_x;
     *y = cursor_y;
 }
 
 static void vga_scroll(void) {
-    // Move all lines up by one
-    for (int y = 1; y < VGA_HEIGHT; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            vga_buffer[(y - 1) * VGA_WIDTH + x] = vga_buffer[y * VGA_WIDTH + x];
-        }
-    }
-    
-    // Clear the bottom line
-    for (int x = 0; x < VGA_WIDTH; x++) {
-        vga_buffer[(VGA_HEIGHT - 1) * VGA_WIDTH + x] = vga_entry(' ', current_color);
-    }
-    
+    // The old top line becomes the new bottom line
+    ring_head = (ring_head + 1 == VGA_HEIGHT) ? 0 : ring_head + 1;
+    vga_fill_row(vga_row(VGA_HEIGHT - 1), vga_entry(' ', current_color));
+
+    // Every screen row now shows different content
+    dirty_rows = VGA_ALL_ROWS;
     cursor_y = VGA_HEIGHT - 1;
 }
 
-void vga_putchar(char c) {
+static void vga_put_raw(char c) {
     switch (c) {
         case '\n':
             cursor_x = 0;
@@ -74,8 +172,8 @@ void vga_putchar(char c) {
         case '\b':
             if (cursor_x > 0) {
                 cursor_x--;
-                const int index = cursor_y * VGA_WIDTH + cursor_x;
-                vga_buffer[index] = vga_entry(' ', current_color);
+                vga_row(cursor_y)[cursor_x] = vga_entry(' ', current_color);
+                dirty_rows |= 1u << cursor_y;
             }
             break;
         case '\t':
@@ -83,8 +181,8 @@ void vga_putchar(char c) {
             break;
         default:
             if (c >= 32) { // Printable character
-                const int index = cursor_y * VGA_WIDTH + cursor_x;
-                vga_buffer[index] = vga_entry(c, current_color);
+                vga_row(cursor_y)[cursor_x] = vga_entry(c, current_color);
+                dirty_rows |= 1u << cursor_y;
                 cursor_x++;
             }
             break;
@@ -100,91 +198,58 @@ void vga_putchar(char c) {
     }
 }
 
+void vga_putchar(char c) {
+    PERF_FUNCTION();
+    vga_put_raw(c);
+    vga_maybe_flush();
+    if (mirror) {
+        mirror(&c, 1);
+    }
+}
+
 void vga_puts(const char* str) {
-    for (int i = 0; str[i] != '\0'; i++) {
-        vga_putchar(str[i]);
+    PERF_FUNCTION();
+    int i;
+    for (i = 0; str[i] != '\0'; i++) {
+        vga_put_raw(str[i]);
+    }
+    vga_maybe_flush();
+    if (mirror) {
+        mirror(str, i);
     }
 }
 
-// Simple string length function
-static int strlen(const char* str) {
-    int len = 0;
-    while (str[len]) len++;
-    return len;
+void vga_write(const char* data, uint32_t len) {
+    PERF_FUNCTION();
+    for (uint32_t i = 0; i < len; i++) {
+        vga_put_raw(data[i]);
+    }
+    vga_maybe_flush();
+    if (mirror) {
+        mirror(data, len);
+    }
 }
 
-// Simple integer to string conversion
-static void itoa(int value, char* buffer, int base) {
-    char* p = buffer;
-    char* p1, *p2;
-    int digits = 0;
-    
-    if (value < 0 && base == 10) {
-        *p++ = '-';
-        value = -value;
+static void vga_format_sink(void* context, const char* data, uint32_t len) {
+    (void)context;
+    for (uint32_t i = 0; i < len; i++) {
+        vga_put_raw(data[i]);
     }
-    
-    do {
-        int remainder = value % base;
-        *p++ = (remainder < 10) ? remainder + '0' : remainder + 'a' - 10;
-        digits++;
-    } while (value /= base);
-    
-    *p = 0;
-    
-    // Reverse string (excluding sign)
-    p1 = (buffer[0] == '-') ? buffer + 1 : buffer;
-    p2 = p - 1;
-    while (p1 < p2) {
-        char tmp = *p1;
-        *p1 = *p2;
-        *p2 = tmp;
-        p1++;
-        p2--;
+    if (mirror) {
+        mirror(data, len);
     }
 }
 
-// Simplified printf implementation for kernel
+void vga_vprintf(const char* format, va_list args) {
+    PERF_FUNCTION();
+    kformat(vga_format_sink, 0, format, args);
+    vga_maybe_flush();
+}
+
 void vga_printf(const char* format, ...) {
-    char buffer[32];
-    
-    // Get pointer to first argument
-    char** args = (char**)&format + 1;
-    int arg_count = 0;
-    
-    for (const char* p = format; *p != '\0'; p++) {
-        if (*p != '%') {
-            vga_putchar(*p);
-            continue;
-        }
-        
-        p++; // Skip '%'
-        switch (*p) {
-            case 'c':
-                vga_putchar((char)(int)args[arg_count++]);
-                break;
-            case 's':
-                vga_puts((char*)args[arg_count++]);
-                break;
-            case 'd': {
-                int num = (int)args[arg_count++];
-                itoa(num, buffer, 10);
-                vga_puts(buffer);
-                break;
-            }
-            case 'x': {
-                int num = (int)args[arg_count++];
-                itoa(num, buffer, 16);
-                vga_puts(buffer);
-                break;
-            }
-            case '%':
-                vga_putchar('%');
-                break;
-            default:
-                vga_putchar('%');
-                vga_putchar(*p);
-                break;
-        }
-    }
-}
\ No newline at end of file
+    PERF_FUNCTION();
+    va_list args;
+    va_start(args, format);
+    vga_vprintf(format, args);
+    va_end(args);
+}
@@ -2,6 +2,7 @@
 #ifndef VGA_H
 #define VGA_H
 
+#include <stdarg.h>
 #include <stdint.h>
 
 #define VGA_WIDTH 80
@@ -28,14 +29,23 @@ enum vga_color {
     VGA_COLOR_WHITE = 15,
 };
 
+// Receives a copy of everything written to the console
+typedef void (*vga_mirror_t)(const char* data, uint32_t len);
+
 // Function prototypes
 void vga_init(void);
 void vga_clear(void);
 void vga_putchar(char c);
 void vga_puts(const char* str);
-void vga_printf(const char* format, ...);
+void vga_write(const char* data, uint32_t len);
+void vga_printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void vga_vprintf(const char* format, va_list args);
 void vga_set_color(enum vga_color fg, enum vga_color bg);
 void vga_set_cursor(int x, int y);
 void vga_get_cursor(int* x, int* y);
+void vga_flush(void);
+void vga_batch_begin(void);
+void vga_batch_end(void);
+void vga_set_mirror(vga_mirror_t sink);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,17 @@
+#!/bin/sh
+# ksyms.sh - Write the kernel's function symbols as a C table for the profiler
+#
+# Usage: ksyms.sh [nm kernel.elf]
+# With no arguments the table is empty, for the first of the two links.
+echo '// Generated by tools/ksyms.sh; do not edit'
+echo '#include "ksyms.h"'
+echo
+echo 'const struct ksym ksyms[] = {'
+if [ $# -eq 2 ]; then
+    "$1" -n "$2" | awk '$2 ~ /^[tTwW]$/ { printf "    { 0x%s, \"%s\" },\n", $1, $3 }' || exit 1
+fi
+echo '    { 0, 0 }'
+echo '};'
+echo
+echo '// Less the terminating entry'
+echo 'const uint32_t ksym_count = sizeof(ksyms) / sizeof(ksyms[0]) - 1;'